@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "../xml.h"
+
+// deterministic corpora and timings for parse, query and serialize
+// build: gcc -O2 -o xml_bench bench/bench.c xml.c
+//        add -DXML_ENABLE_STATS for the library's own tokenize and build timings
+// run:   ./xml_bench [--scale 1.0] [--corpus name] [--chunk bytes] [--repeat n] [--validate] [--lazy] [--json]
+
+#define DEFAULT_CHUNK   (64*1024)
+
+typedef struct
+{
+    char*   data;
+    size_t  size;
+    size_t  capacity;
+} buffer_t;
+
+typedef struct
+{
+    const char* name;
+    void (*generate)(buffer_t* buffer, long count);
+    long    count;      // units at scale 1.0
+    const char* child;      // queried on every child of the root
+    const char* attribute;
+} corpus_t;
+
+static unsigned int seed = 2463534242u;
+
+// xorshift, same corpus on every run and platform
+static unsigned int next_random()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void append(buffer_t* buffer, const char* format, ...)
+{
+    va_list args;
+    int size = 0;
+
+    for (;;) {
+        size_t room = buffer->capacity - buffer->size;
+        va_start(args, format);
+        size = room ? vsnprintf(buffer->data + buffer->size, room, format, args) : -1;
+        va_end(args);
+        if (size >= 0 && (size_t)size < room) {
+            break;
+        }
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 1024 * 1024;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if (buffer->data == NULL) {
+            printf("out of memory\n");
+            exit(-1);
+        }
+    }
+
+    buffer->size += size;
+}
+
+static void append_words(buffer_t* buffer, int words)
+{
+    static const char* dictionary[] = {
+        "encoding", "charset", "unicode", "gb2312", "gbk", "utf", "byte", "table",
+        "parse", "serialize", "element", "attribute", "value", "node", "tree", "text",
+    };
+    int i = 0;
+    for (i=0; i<words; i++) {
+        append(buffer, i ? " %s" : "%s", dictionary[next_random() % 16]);
+    }
+}
+
+static void generate_flat(buffer_t* buffer, long count)
+{
+    long i = 0;
+    append(buffer, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<records>\n");
+    for (i=0; i<count; i++) {
+        append(buffer, "  <record id=\"%ld\"><name>name%u</name><value>%u</value></record>\n", i, next_random() % 100000, next_random() % 1000000);
+    }
+    append(buffer, "  <end>done</end>\n</records>\n");
+}
+
+static void generate_deep(buffer_t* buffer, long count)
+{
+    const int depth = 1000;
+    long i = 0;
+    int j = 0;
+    append(buffer, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<deep>\n");
+    for (i=0; i<count; i++) {
+        for (j=0; j<depth; j++) {
+            append(buffer, "<level%d>", j % 10);
+        }
+        append(buffer, "%ld", i);
+        for (j=depth-1; j>=0; j--) {
+            append(buffer, "</level%d>", j % 10);
+        }
+        append(buffer, "\n");
+    }
+    append(buffer, "<end>done</end>\n</deep>\n");
+}
+
+static void generate_attributes(buffer_t* buffer, long count)
+{
+    long i = 0;
+    int j = 0;
+    append(buffer, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<items>\n");
+    for (i=0; i<count; i++) {
+        append(buffer, "  <item");
+        for (j=0; j<20; j++) {
+            append(buffer, " attr%d=\"%u\"", j, next_random() % 100000);
+        }
+        append(buffer, "/>\n");
+    }
+    append(buffer, "  <end>done</end>\n</items>\n");
+}
+
+static void generate_text(buffer_t* buffer, long count)
+{
+    long i = 0;
+    append(buffer, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<book>\n");
+    for (i=0; i<count; i++) {
+        append(buffer, "  <p>");
+        append_words(buffer, 60);
+        append(buffer, " <b>");
+        append_words(buffer, 3);
+        append(buffer, "</b> ");
+        append_words(buffer, 40);
+        append(buffer, "</p>\n");
+    }
+    append(buffer, "  <end>done</end>\n</book>\n");
+}
+
+static void generate_soap(buffer_t* buffer, long count)
+{
+    static const char* prefixes[] = {"soap", "env", "s", "SOAP-ENV"};
+    long i = 0;
+    append(buffer, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<batch>\n");
+    for (i=0; i<count; i++) {
+        const char* p = prefixes[next_random() % 4];
+        append(buffer, "<%s:Envelope xmlns:%s=\"http://schemas.xmlsoap.org/soap/envelope/\" xmlns:m=\"urn:example:orders\">"
+            "<%s:Header><m:Trace>%u</m:Trace></%s:Header>"
+            "<%s:Body><m:Order m:id=\"%ld\"><m:Item>item%u</m:Item><m:Quantity>%u</m:Quantity></m:Order></%s:Body>"
+            "</%s:Envelope>\n", p, p, p, next_random(), p, p, i, next_random() % 1000, next_random() % 100, p, p);
+    }
+    append(buffer, "<end>done</end>\n</batch>\n");
+}
+
+static void generate_cdata(buffer_t* buffer, long count)
+{
+    long i = 0;
+    int j = 0;
+    append(buffer, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<scripts>\n");
+    for (i=0; i<count; i++) {
+        append(buffer, "<script id=\"%ld\"><![CDATA[", i);
+        for (j=0; j<256; j++) {
+            append(buffer, "if (a < %u && b > %u) { c &= d; } ", next_random() % 1000, next_random() % 1000);
+        }
+        append(buffer, "]]></script>\n");
+    }
+    append(buffer, "<end>done</end>\n</scripts>\n");
+}
+
+static corpus_t corpora[] = {
+    {"flat",        generate_flat,          1000000,    "value",    "id"},
+    {"deep",        generate_deep,          1000,       "level1",   "id"},
+    {"attributes",  generate_attributes,    200000,     "none",     "attr17"},
+    {"text",        generate_text,          100000,     "b",        "id"},
+    {"soap",        generate_soap,          200000,     "Body",     "xmlns:m"},
+    {"cdata",       generate_cdata,         2000,       "none",     "id"},
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static xml_handle_t parse(const buffer_t* corpus, int chunk, int options)
+{
+    xml_handle_t xml = xml_malloc_handle();
+    if (xml == NULL) {
+        return NULL;
+    }
+    xml_set_option(xml, options, 1);
+
+    size_t offset = 0;
+    for (offset=0; offset<corpus->size; offset+=chunk) {
+        int size = corpus->size - offset < (size_t)chunk ? (int)(corpus->size - offset) : chunk;
+        if (xml_input_raw(xml, corpus->data + offset, size) != XML_STATUS_SUCCEED) {
+            xml_free_handle(xml);
+            return NULL;
+        }
+    }
+
+    return xml;
+}
+
+// every element and text node in document order, values converted on the way
+static long walk(xml_element_t element, long* checksum)
+{
+    long nodes = 1;
+    xml_element_t node = NULL;
+
+    *checksum += element_get_int(element);
+    for (node = element_get_node(element); node; node = element_get_next_node(node)) {
+        if (element_is_text(node)) {
+            nodes++;
+        } else {
+            nodes += walk(node, checksum);
+        }
+    }
+
+    return nodes;
+}
+
+// the usual record loop: siblings under the root, a child and an attribute of each
+static long query(const corpus_t* corpus, xml_handle_t xml, long* checksum)
+{
+    long records = 0;
+    xml_element_t root = xml_get_element(xml);
+    xml_element_t element = NULL;
+
+    for (element = element_get_node(root); element && element_is_text(element); element = element_get_next_node(element)) {
+    }
+    for (; element; element = element_get_sibling(element)) {
+        *checksum += element_get_child_int(element, NULL, corpus->child);
+        *checksum += element_get_attribute_int(element, corpus->attribute);
+        records++;
+    }
+
+    return records;
+}
+
+static void report(int json, const char* corpus, const char* phase, double seconds, double bytes, long nodes, xml_handle_t xml)
+{
+    size_t arena = 0, peak = 0, allocations = 0;
+    if (xml) {
+        xml_get_memory_usage(xml, &arena, &peak, &allocations);
+    }
+    double mbps = seconds > 0 ? bytes / seconds / (1024 * 1024) : 0;
+    double nps = seconds > 0 ? nodes / seconds : 0;
+
+    if (json) {
+        printf("{\"corpus\":\"%s\",\"phase\":\"%s\",\"seconds\":%.6f,\"bytes\":%.0f,\"mb_per_s\":%.2f,"
+            "\"nodes\":%ld,\"nodes_per_s\":%.0f,\"arena_bytes\":%zu,\"peak_bytes\":%zu,\"allocations\":%zu}\n",
+            corpus, phase, seconds, bytes, mbps, nodes, nps, arena, peak, allocations);
+    } else {
+        printf("%-11s %-10s %9.4fs %10.2f MB/s %12.0f nodes/s %12zu arena %12zu peak %8zu allocs\n",
+            corpus, phase, seconds, mbps, nps, arena, peak, allocations);
+    }
+    fflush(stdout);
+}
+
+static int run(const corpus_t* corpus, double scale, int chunk, int repeat, int options, int json)
+{
+    buffer_t buffer = {0};
+    long count = (long)(corpus->count * scale);
+    seed = 2463534242u;
+    corpus->generate(&buffer, count > 0 ? count : 1);
+
+    int i = 0;
+    double best = 0;
+    xml_handle_t xml = NULL;
+    for (i=0; i<repeat; i++) {
+        if (xml) {
+            xml_free_handle(xml);
+        }
+        double begin = now();
+        xml = parse(&buffer, chunk, options);
+        double seconds = now() - begin;
+        if (xml == NULL) {
+            printf("%s: parse failed\n", corpus->name);
+            free(buffer.data);
+            return -1;
+        }
+        if (i == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+
+    long checksum = 0;
+    double begin = now();
+    long nodes = walk(xml_get_element(xml), &checksum);
+    double walk_seconds = now() - begin;
+
+    report(json, corpus->name, "parse", best, buffer.size, nodes, xml);
+
+    // only with a library built with -DXML_ENABLE_STATS
+    xml_stats_t stats;
+    if (xml_get_stats(xml, &stats) == XML_STATUS_SUCCEED) {
+        if (json) {
+            printf("{\"corpus\":\"%s\",\"phase\":\"stats\",\"tokenize_seconds\":%.6f,\"build_seconds\":%.6f,"
+                "\"nodes\":%llu,\"attributes\":%llu,\"max_depth\":%d,\"arena_blocks\":%d}\n",
+                corpus->name, stats.tokenize_seconds, stats.build_seconds, stats.nodes, stats.attributes, stats.max_depth, stats.arena_blocks);
+        } else {
+            printf("%-11s %-10s tokenize %.4fs build %.4fs nodes %llu attributes %llu depth %d blocks %d\n",
+                corpus->name, "stats", stats.tokenize_seconds, stats.build_seconds, stats.nodes, stats.attributes, stats.max_depth, stats.arena_blocks);
+        }
+    }
+    report(json, corpus->name, "walk", walk_seconds, buffer.size, nodes, xml);
+
+    begin = now();
+    long records = query(corpus, xml, &checksum);
+    report(json, corpus->name, "query", now() - begin, buffer.size, records, xml);
+
+    // the last element of every corpus, the worst case for a lookup by name
+    begin = now();
+    for (i=0; i<repeat; i++) {
+        const char* text = xml_get_text(xml, NULL, "end");
+        if (text == NULL || strcmp(text, "done") != 0) {
+            printf("%s: lookup failed\n", corpus->name);
+        }
+    }
+    report(json, corpus->name, "lookup", (now() - begin) / repeat, buffer.size, nodes, xml);
+
+    int size = 0;
+    best = 0;
+    for (i=0; i<repeat; i++) {
+        begin = now();
+        if (xml_serialize_ex(xml, XML_SERIALIZE_COMPACT, &size) == NULL) {
+            printf("%s: serialize failed\n", corpus->name);
+            break;
+        }
+        double seconds = now() - begin;
+        if (i == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    report(json, corpus->name, "serialize", best, size, nodes, xml);
+
+    if (checksum == 42) {
+        printf("\n");   // keep the walk from being optimized away
+    }
+    xml_free_handle(xml);
+    free(buffer.data);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    double scale = 1.0;
+    int chunk = DEFAULT_CHUNK;
+    int repeat = 3;
+    int json = 0;
+    int options = 0;
+    const char* only = NULL;
+
+    int i = 0;
+    for (i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc) {
+            chunk = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else if (strcmp(argv[i], "--validate") == 0) {
+            options |= XML_OPTION_VALIDATE_UTF8;
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            options |= XML_OPTION_LAZY;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else {
+            printf("usage: %s [--scale 1.0] [--corpus name] [--chunk bytes] [--repeat n] [--validate] [--lazy] [--json]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (chunk <= 0 || repeat <= 0 || scale <= 0) {
+        printf("invalid arguments\n");
+        return -1;
+    }
+
+    int ret = 0;
+    for (i=0; i<(int)(sizeof(corpora)/sizeof(corpora[0])); i++) {
+        if (only == NULL || strcmp(only, corpora[i].name) == 0) {
+            if (run(&corpora[i], scale, chunk, repeat, options, json) != 0) {
+                ret = -1;
+            }
+        }
+    }
+
+    return ret;
+}
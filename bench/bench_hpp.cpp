@@ -0,0 +1,156 @@
+// walk and query through xml.hpp next to the same loops on the C API, the wrapper should cost nothing
+// build: gcc -O2 -c xml.c && g++ -std=c++17 -O2 -o xml_bench_hpp bench/bench_hpp.cpp xml.o
+// run:   ./xml_bench_hpp [--scale 1.0] [--repeat n]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "../xml.hpp"
+
+// the flat corpus of bench.c
+static std::string generate_flat(long count)
+{
+    unsigned int seed = 2463534242u;
+    auto next_random = [&seed]() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    };
+
+    std::string corpus = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<records>\n";
+    char line[128];
+    for (long i=0; i<count; i++) {
+        unsigned int name = next_random() % 100000;
+        unsigned int value = next_random() % 1000000;
+        snprintf(line, sizeof(line), "  <record id=\"%ld\"><name>name%u</name><value>%u</value></record>\n", i, name, value);
+        corpus += line;
+    }
+    corpus += "  <end>done</end>\n</records>\n";
+    return corpus;
+}
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static long walk_c(xml_element_t element, long* checksum)
+{
+    long nodes = 1;
+    *checksum += element_get_int(element);
+    for (xml_element_t node = element_get_node(element); node; node = element_get_next_node(node)) {
+        nodes += element_is_text(node) ? 1 : walk_c(node, checksum);
+    }
+    return nodes;
+}
+
+static long walk_hpp(xml::element element, long* checksum)
+{
+    long nodes = 1;
+    // element_get_int is atoi, 0 for "name1", get<int> takes the fallback for anything not a number
+    *checksum += element.text().data() ? element.get<int>(0) : -1;
+    for (xml::element node : element.nodes()) {
+        nodes += node.is_text() ? 1 : walk_hpp(node, checksum);
+    }
+    return nodes;
+}
+
+static long query_c(xml_handle_t xml, long* checksum)
+{
+    long records = 0;
+    xml_element_t element = element_get_node(xml_get_element(xml));
+    while (element && element_is_text(element)) {
+        element = element_get_next_node(element);
+    }
+    for (; element; element = element_get_sibling(element)) {
+        *checksum += element_get_child_int(element, NULL, "value");
+        *checksum += element_get_attribute_int(element, "id");
+        records++;
+    }
+    return records;
+}
+
+static long query_hpp(const xml::document& document, long* checksum)
+{
+    long records = 0;
+    for (xml::element record : document.root().children()) {
+        *checksum += record.child("value").get<int>(-1);
+        *checksum += record.attribute<int>("id", -1);
+        records++;
+    }
+    return records;
+}
+
+template <typename F>
+static double best_of(int repeat, F f)
+{
+    double best = 0;
+    for (int i=0; i<repeat; i++) {
+        double begin = now();
+        f();
+        double seconds = now() - begin;
+        if (i == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+static void report(const char* phase, double seconds, double bytes, long nodes, long checksum)
+{
+    printf("%-11s %-10s %9.4fs %10.2f MB/s %12.0f nodes/s checksum %ld\n",
+        "flat", phase, seconds, bytes / seconds / (1024 * 1024), nodes / seconds, checksum);
+}
+
+int main(int argc, char* argv[])
+{
+    double scale = 1.0;
+    int repeat = 3;
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else {
+            printf("usage: %s [--scale 1.0] [--repeat n]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (repeat <= 0 || scale <= 0) {
+        printf("invalid arguments\n");
+        return -1;
+    }
+
+    std::string corpus = generate_flat((long)(1000000 * scale));
+    int status = XML_STATUS_SUCCEED;
+    xml::document document = xml::document::parse(corpus, 0, &status);
+    if (status != XML_STATUS_SUCCEED || !document.root()) {
+        printf("parse failed\n");
+        return -1;
+    }
+
+    long nodes = 0, checksum_c = 0, checksum_hpp = 0;
+    double seconds = best_of(repeat, [&]() { checksum_c = 0; nodes = walk_c(xml_get_element(document.c_handle()), &checksum_c); });
+    report("walk c", seconds, corpus.size(), nodes, checksum_c);
+    seconds = best_of(repeat, [&]() { checksum_hpp = 0; nodes = walk_hpp(document.root(), &checksum_hpp); });
+    report("walk c++", seconds, corpus.size(), nodes, checksum_hpp);
+    if (checksum_c != checksum_hpp) {
+        printf("walk checksums differ\n");
+        return -1;
+    }
+
+    long records = 0;
+    seconds = best_of(repeat, [&]() { checksum_c = 0; records = query_c(document.c_handle(), &checksum_c); });
+    report("query c", seconds, corpus.size(), records, checksum_c);
+    seconds = best_of(repeat, [&]() { checksum_hpp = 0; records = query_hpp(document, &checksum_hpp); });
+    report("query c++", seconds, corpus.size(), records, checksum_hpp);
+    if (checksum_c != checksum_hpp) {
+        printf("query checksums differ\n");
+        return -1;
+    }
+
+    return 0;
+}
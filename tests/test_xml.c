@@ -0,0 +1,1290 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../xml.h"
+#ifdef XML_ENABLE_ZLIB
+#include <unistd.h>
+#include <zlib.h>
+#endif
+
+// behavioral checks through the public API, every failed check is printed, the exit status counts them
+// build: gcc -o xml_test tests/test_xml.c xml.c
+// gzip:  gcc -DXML_ENABLE_ZLIB -o xml_test tests/test_xml.c xml.c -lz -lpthread
+// run:   ./xml_test
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    checks++; \
+    if (!(condition)) { \
+        failures++; \
+        printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+    } \
+} while (0)
+
+static xml_handle_t parse(const char* doc, int options)
+{
+    xml_handle_t xml = xml_malloc_handle();
+    int option = 0;
+    for (option=1; option<=XML_OPTION_LAZY; option<<=1) {
+        if (options & option) {
+            xml_set_option(xml, option, 1);
+        }
+    }
+    if (xml_input_raw(xml, doc, strlen(doc)) != XML_STATUS_SUCCEED) {
+        printf("parse failed: %s\n", doc);
+    }
+
+    return xml;
+}
+
+// serialized document without the declaration
+static const char* body(xml_handle_t xml)
+{
+    const char* out = xml_serialize(xml);
+    const char* end = out ? strstr(out, "?>") : NULL;
+
+    return end ? end + 2 : out;
+}
+
+// the tree as seen through the accessors, names, ids, attributes and text, so a lazy handle builds all of it
+static void dump_node(xml_element_t node, char* out, size_t size)
+{
+    size_t n = strlen(out);
+    if (element_is_text(node)) {
+        snprintf(out + n, size - n, "'%s'", element_get_text(node));
+        return;
+    }
+    const char* prefix = element_get_prefix(node);
+    snprintf(out + n, size - n, "<%s%s%s %d:%d", prefix ? prefix : "", prefix ? ":" : "", element_get_name(node),
+        element_get_ns_id(node), element_get_name_id(node));
+    xml_attribute_t attribute = NULL;
+    for (attribute=element_get_attributes(node); attribute; attribute=attribute_get_next(attribute)) {
+        n = strlen(out);
+        snprintf(out + n, size - n, " %s=%s", attribute_get_name(attribute), attribute_get_value(attribute));
+    }
+    n = strlen(out);
+    snprintf(out + n, size - n, " %d>", element_child_count(node));
+    xml_element_t child = NULL;
+    for (child=element_get_node(node); child; child=element_get_next_node(child)) {
+        dump_node(child, out, size);
+    }
+    n = strlen(out);
+    snprintf(out + n, size - n, "</>");
+}
+
+static const char* dump(xml_handle_t xml, char* out, size_t size)
+{
+    out[0] = '\0';
+    if (xml_get_element(xml)) {
+        dump_node(xml_get_element(xml), out, size);
+    }
+
+    return out;
+}
+
+// edits on a parsed tree, eager and lazy, must serialize the same
+static void test_mutation(int options)
+{
+    xml_handle_t xml = parse("<r><a>1</a><b k=\"v\">2</b><c></c></r>", options);
+    xml_element_t root = xml_get_element(xml);
+    xml_element_t a = element_get_child(root, NULL, "a");
+    xml_element_t b = element_get_child(root, NULL, "b");
+    xml_element_t c = element_get_child(root, NULL, "c");
+    CHECK(a && b && c);
+
+    CHECK(element_set_text(a, XML_VALUE_TYPE_TEXT, "one") == XML_STATUS_SUCCEED);
+    int two = 2;
+    CHECK(element_set_attribute(b, "n", XML_VALUE_TYPE_INT, &two) == XML_STATUS_SUCCEED);
+    CHECK(element_set_attribute(b, "k", XML_VALUE_TYPE_TEXT, NULL) == XML_STATUS_SUCCEED);
+    CHECK(element_insert_before(a, c) == XML_STATUS_SUCCEED);
+    xml_element_t d = xml_new_element(xml, NULL, "d");
+    CHECK(d && element_append_child(b, d) == XML_STATUS_SUCCEED);
+    CHECK(element_append_child(d, xml_new_text(xml, "x<y")) == XML_STATUS_SUCCEED);
+    CHECK(strcmp(body(xml), "<r><c></c><a>one</a><b n=\"2\">2<d>x&lt;y</d></b></r>") == 0);
+
+    // a node can not move into its own subtree
+    CHECK(element_append_child(d, b) != XML_STATUS_SUCCEED);
+    CHECK(element_remove(b) == XML_STATUS_SUCCEED);
+    CHECK(element_get_child(root, NULL, "b") == NULL);
+    CHECK(strcmp(body(xml), "<r><c></c><a>one</a></r>") == 0);
+    CHECK(strcmp(xml_get_text(xml, NULL, "a"), "one") == 0);
+    xml_free_handle(xml);
+}
+
+// every text segment goes, wherever it sits among the child elements, and a text node removed first is not left behind
+static void test_set_text(int options)
+{
+    xml_handle_t xml = parse("<r> <x></x>b<y></y>c</r>", options);
+    xml_element_t root = xml_get_element(xml);
+    CHECK(element_set_text(root, XML_VALUE_TYPE_TEXT, "t") == XML_STATUS_SUCCEED);
+    CHECK(strcmp(body(xml), "<r>t<x></x><y></y></r>") == 0);
+    CHECK(element_set_text(root, XML_VALUE_TYPE_TEXT, NULL) == XML_STATUS_SUCCEED);
+    CHECK(strcmp(body(xml), "<r><x></x><y></y></r>") == 0);
+    CHECK(element_get_text(root) == NULL || strlen(element_get_text(root)) == 0);
+    int n = 7;
+    CHECK(element_set_text(root, XML_VALUE_TYPE_INT, &n) == XML_STATUS_SUCCEED);
+    CHECK(strcmp(body(xml), "<r>7<x></x><y></y></r>") == 0);
+
+    CHECK(element_remove(element_get_node(root)) == XML_STATUS_SUCCEED);
+    CHECK(element_append_child(root, xml_new_text(xml, "u")) == XML_STATUS_SUCCEED);
+    CHECK(strcmp(element_get_text(root), "u") == 0);
+    CHECK(element_set_text(root, XML_VALUE_TYPE_TEXT, "v") == XML_STATUS_SUCCEED);
+    CHECK(strcmp(body(xml), "<r>v<x></x><y></y></r>") == 0);
+    xml_free_handle(xml);
+}
+
+// moving a subtree or changing a declaration resolves every element and attribute below again
+static void test_mutation_namespaces(int options)
+{
+    xml_handle_t xml = parse("<r xmlns:p=\"urn:1\"><a><p:b p:k=\"v\"><p:c/></p:b></a><s xmlns:p=\"urn:2\"/></r>", options);
+    int one = xml_get_ns_id(xml, "urn:1");
+    int two = xml_get_ns_id(xml, "urn:2");
+    int k = xml_get_name_id(xml, "k");
+    xml_element_t root = xml_get_element(xml);
+    xml_element_t s = element_get_child(root, NULL, "s");
+    xml_element_t b = element_child_at(element_get_child(root, NULL, "a"), 0);
+    xml_element_t c = element_child_at(b, 0);
+    CHECK(one > 0 && two > 0 && one != two);
+    CHECK(element_get_ns_id(b) == one && element_get_ns_id(c) == one);
+
+    CHECK(element_append_child(s, b) == XML_STATUS_SUCCEED);
+    CHECK(element_get_ns_id(b) == two && element_get_ns_id(c) == two);
+    CHECK(element_get_attribute_ns(b, two, k) != NULL && element_get_attribute_ns(b, one, k) == NULL);
+    CHECK(xml_get_element_ns(xml, two, xml_get_name_id(xml, "c")) == c);
+
+    // without its own declaration s falls back to the one on the root
+    CHECK(element_set_attribute(s, "xmlns:p", XML_VALUE_TYPE_TEXT, NULL) == XML_STATUS_SUCCEED);
+    CHECK(element_get_ns_id(b) == one && element_get_ns_id(c) == one);
+    CHECK(element_get_attribute_ns(b, one, k) != NULL);
+
+    // a prefix nothing binds is not "no namespace"
+    CHECK(element_set_attribute(root, "xmlns:p", XML_VALUE_TYPE_TEXT, NULL) == XML_STATUS_SUCCEED);
+    CHECK(element_get_ns_id(c) == -1);
+    CHECK(xml_get_element_ns(xml, 0, xml_get_name_id(xml, "c")) == NULL);
+    CHECK(element_set_attribute(root, "xmlns:p", XML_VALUE_TYPE_TEXT, "urn:1") == XML_STATUS_SUCCEED);
+    CHECK(element_get_ns_id(c) == one);
+    xml_free_handle(xml);
+}
+
+// a tree built by xml_add_* resolves prefixes against the declarations added so far
+static void test_add(void)
+{
+    xml_handle_t xml = xml_malloc_handle();
+    CHECK(xml_add_element(xml, NULL, NULL, NULL, "r", XML_VALUE_TYPE_TEXT, NULL) == XML_STATUS_SUCCEED);
+    CHECK(xml_add_element(xml, NULL, "r", "p", "item", XML_VALUE_TYPE_TEXT, "t") == XML_STATUS_SUCCEED);
+    xml_element_t item = element_get_child(xml_get_element(xml), "p", "item");
+    CHECK(item && element_get_ns_id(item) == -1);
+    CHECK(xml_add_attribute(xml, NULL, "r", "xmlns:p", XML_VALUE_TYPE_TEXT, "urn:p") == XML_STATUS_SUCCEED);
+    CHECK(element_get_ns_id(item) == xml_get_ns_id(xml, "urn:p"));
+    CHECK(xml_get_ns_id(xml, "urn:absent") == -1);
+    CHECK(strcmp(body(xml), "<r xmlns:p=\"urn:p\"><p:item>t</p:item></r>") == 0);
+    xml_free_handle(xml);
+}
+
+static const char* lazy_document =
+    "<?xml version=\"1.0\"?>\n"
+    "<feed xmlns=\"urn:feed\" xmlns:m=\"urn:meta\">\n"
+    "  <!-- comment -->\n"
+    "  <item id=\"1\" m:rank=\"3\"><title>one &amp; two</title><m:tag>a</m:tag><m:tag>b</m:tag></item>\n"
+    "  <item id=\"2\"><title xmlns=\"\">plain</title>text<![CDATA[<raw>\nline]]>tail</item>\n"
+    "  <m:note m:kind=\"x\">n<b>bold</b>after</m:note>\n"
+    "</feed>";
+
+// a lazy handle gives the same tree, ids and output as an eager one
+static void test_lazy_equal(void)
+{
+    static char eager_out[4096];
+    static char lazy_out[4096];
+    xml_handle_t eager = parse(lazy_document, 0);
+    xml_handle_t lazy = parse(lazy_document, XML_OPTION_LAZY);
+
+    // ids are interned while indexing, in the order an eager parse meets the names
+    CHECK(xml_get_name_id(lazy, "tag") == xml_get_name_id(eager, "tag"));
+    CHECK(xml_get_ns_id(lazy, "urn:meta") == xml_get_ns_id(eager, "urn:meta"));
+    CHECK(xml_get_name_id(lazy, "absent") == xml_get_name_id(eager, "absent"));
+    CHECK(strcmp(dump(lazy, lazy_out, sizeof(lazy_out)), dump(eager, eager_out, sizeof(eager_out))) == 0);
+    // untouched subtrees are copied from the source, as XML_OPTION_KEEP_SOURCE does
+    xml_handle_t keep = parse(lazy_document, XML_OPTION_KEEP_SOURCE);
+    CHECK(strcmp(xml_serialize(lazy), xml_serialize(keep)) == 0);
+    xml_element_t note = element_get_child(xml_get_element(lazy), "m", "note");
+    CHECK(element_set_attribute(note, "m:kind", XML_VALUE_TYPE_TEXT, "y") == XML_STATUS_SUCCEED);
+    note = element_get_child(xml_get_element(keep), "m", "note");
+    CHECK(element_set_attribute(note, "m:kind", XML_VALUE_TYPE_TEXT, "y") == XML_STATUS_SUCCEED);
+    CHECK(strcmp(xml_serialize(lazy), xml_serialize(keep)) == 0);
+    xml_free_handle(keep);
+
+    // CDATA keeps its line break, text outside it does not
+    CHECK(strstr(eager_out, "'<raw>\nline'") != NULL);
+    xml_free_handle(eager);
+    xml_free_handle(lazy);
+}
+
+// under every budget a handle either runs out of memory or gives the tree it would give without one
+static void test_lazy_budget(void)
+{
+    static char expected[4096];
+    static char out[4096];
+    xml_handle_t xml = parse(lazy_document, 0);
+    dump(xml, expected, sizeof(expected));
+    xml_free_handle(xml);
+
+    size_t budget = 0;
+    int options = 0;
+    for (options=0; options<=XML_OPTION_LAZY; options+=XML_OPTION_LAZY) {
+        int completed = 0;
+        for (budget=8*1024; budget<=256*1024 && !completed; budget+=256) {
+            xml = xml_malloc_handle_ex(NULL, budget);
+            if (xml == NULL) {
+                continue;
+            }
+            xml_set_option(xml, options, options != 0);
+            xml_error_t error;
+            int status = xml_input_raw(xml, lazy_document, strlen(lazy_document));
+            if (status == XML_STATUS_SUCCEED) {
+                dump(xml, out, sizeof(out));
+                status = xml_get_error(xml, &error);
+                CHECK(status == XML_STATUS_NO_MEMORY || strcmp(out, expected) == 0);
+                completed = status == XML_STATUS_SUCCEED;
+            } else {
+                CHECK(status == XML_STATUS_NO_MEMORY && xml_get_error(xml, &error) == XML_STATUS_NO_MEMORY);
+            }
+            xml_free_handle(xml);
+        }
+        CHECK(completed);
+    }
+}
+
+// limits stop a lazy parse where they stop an eager one
+static void test_lazy_limits(void)
+{
+    static char eager_out[4096];
+    static char lazy_out[4096];
+    static const struct
+    {
+        const char*     doc;
+        xml_limits_t    limits;
+        int             status;
+    } cases[] = {
+        { "<r><a v=\"0123456789abcdef\">short</a></r>", { 0, 0, 0, 0, 8, 0 }, XML_STATUS_LIMIT },
+        { "<r><a v=\"0123456\">0123456</a></r>", { 0, 0, 0, 0, 8, 0 }, XML_STATUS_SUCCEED },
+        { "<r><a x=\"1\" y=\"2\" z=\"3\"/></r>", { 0, 0, 2, 0, 0, 0 }, XML_STATUS_LIMIT },
+        { "<r><a x=\"1\" y=\"2\"/></r>", { 0, 0, 2, 0, 0, 0 }, XML_STATUS_SUCCEED },
+        { "<r><a><b><c/></b></a></r>", { 0, 3, 0, 0, 0, 0 }, XML_STATUS_LIMIT },
+        { "<r><long_element_name/></r>", { 0, 0, 0, 8, 0, 0 }, XML_STATUS_LIMIT },
+        { "<r><a/><a/><a/></r>", { 0, 0, 0, 0, 0, 3 }, XML_STATUS_LIMIT },
+        { "<r><a/><a/><a/></r>", { 0, 0, 0, 0, 0, 4 }, XML_STATUS_SUCCEED },
+    };
+
+    size_t i = 0;
+    for (i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+        xml_handle_t eager = xml_malloc_handle();
+        xml_handle_t lazy = xml_malloc_handle();
+        xml_set_option(lazy, XML_OPTION_LAZY, 1);
+        xml_set_limits(eager, &cases[i].limits);
+        xml_set_limits(lazy, &cases[i].limits);
+        int size = strlen(cases[i].doc);
+        CHECK(xml_input_raw(eager, cases[i].doc, size) == cases[i].status);
+        CHECK(xml_input_raw(lazy, cases[i].doc, size) == cases[i].status);
+        if (cases[i].status == XML_STATUS_SUCCEED) {
+            CHECK(strcmp(dump(lazy, lazy_out, sizeof(lazy_out)), dump(eager, eager_out, sizeof(eager_out))) == 0);
+        }
+        xml_free_handle(eager);
+        xml_free_handle(lazy);
+    }
+}
+
+// element_child_count, element_child_at and element_next_named agree with a walk over the siblings
+static int children_consistent(xml_element_t parent)
+{
+    xml_element_t children[64];
+    int count = 0;
+    xml_element_t child = element_get_node(parent);
+    while (child && element_is_text(child)) {
+        child = element_get_next_node(child);
+    }
+    for (; child && count<64; child=element_get_sibling(child)) {
+        children[count++] = child;
+    }
+
+    if (element_child_count(parent) != count || element_child_at(parent, count) != NULL || element_child_at(parent, -1) != NULL) {
+        return 0;
+    }
+    int i = 0;
+    for (i=0; i<count; i++) {
+        if (element_child_at(parent, i) != children[i]) {
+            return 0;
+        }
+        const char* name = element_get_name(children[i]);
+        int j = i + 1;
+        while (j < count && strcmp(element_get_name(children[j]), name) != 0) {
+            j++;
+        }
+        if (element_next_named(children[i], NULL, name) != (j < count ? children[j] : NULL)) {
+            return 0;
+        }
+        j = i + 1;
+        while (j < count && strcmp(element_get_name(children[j]), "b") != 0) {
+            j++;
+        }
+        if (element_next_named(children[i], NULL, "b") != (j < count ? children[j] : NULL)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// every edit leaves the child index of both parents in step with the tree
+static void test_child_index(int options)
+{
+    xml_handle_t xml = parse("<r><a/>t<b/><a/><s><b/><a/></s>u<b/></r>", options);
+    xml_element_t root = xml_get_element(xml);
+    xml_element_t s = element_get_child(root, NULL, "s");
+    CHECK(children_consistent(root) && children_consistent(s));
+    CHECK(element_child_count(root) == 5);
+
+    xml_element_t first = element_child_at(root, 0);
+    CHECK(element_append_child(root, xml_new_element(xml, NULL, "b")) == XML_STATUS_SUCCEED);
+    CHECK(children_consistent(root));
+    CHECK(element_insert_before(first, xml_new_element(xml, NULL, "b")) == XML_STATUS_SUCCEED);
+    CHECK(children_consistent(root));
+    CHECK(element_insert_after(first, xml_new_element(xml, NULL, "c")) == XML_STATUS_SUCCEED);
+    CHECK(children_consistent(root));
+    CHECK(element_remove(element_child_at(root, 3)) == XML_STATUS_SUCCEED);
+    CHECK(children_consistent(root));
+
+    // moves change two parents
+    CHECK(element_append_child(root, element_child_at(s, 0)) == XML_STATUS_SUCCEED);
+    CHECK(children_consistent(root) && children_consistent(s));
+    CHECK(element_insert_before(element_child_at(s, 0), element_child_at(root, 0)) == XML_STATUS_SUCCEED);
+    CHECK(children_consistent(root) && children_consistent(s));
+    CHECK(element_set_text(root, XML_VALUE_TYPE_TEXT, NULL) == XML_STATUS_SUCCEED);
+    CHECK(children_consistent(root));
+
+    // the index follows appends without going stale
+    int count = element_child_count(s);
+    int i = 0;
+    for (i=0; i<200; i++) {
+        CHECK(element_append_child(s, xml_new_element(xml, NULL, i % 3 ? "a" : "b")) == XML_STATUS_SUCCEED);
+        CHECK(element_child_count(s) == count + i + 1);
+    }
+    CHECK(element_get_sibling(element_child_at(s, count + 198)) == element_child_at(s, count + 199));
+    CHECK(element_next_named(element_child_at(s, count + 196), NULL, "b") == element_child_at(s, count + 198));
+    xml_free_handle(xml);
+}
+
+// a clone carries the declarations its prefixes need and keeps an unprefixed name out of a default namespace
+static void test_clone_namespaces(int options)
+{
+    xml_handle_t src = parse("<r xmlns:p=\"urn:p\" xmlns=\"urn:d\"><p:a p:k=\"v\"><p:b/><c/></p:a><u xmlns=\"\"><v/></u></r>", options);
+    xml_element_t root = xml_get_element(src);
+    xml_element_t a = element_get_child(root, "p", "a");
+    xml_element_t u = element_get_child(root, NULL, "u");
+
+    xml_handle_t dst = xml_malloc_handle();
+    xml_element_t copy = xml_clone_subtree(dst, NULL, a);
+    CHECK(copy && xml_get_element(dst) == copy);
+    CHECK(strcmp(body(dst), "<p:a xmlns=\"urn:d\" xmlns:p=\"urn:p\" p:k=\"v\"><p:b></p:b><c></c></p:a>") == 0);
+    CHECK(element_get_ns_id(copy) == xml_get_ns_id(dst, "urn:p"));
+    CHECK(element_get_attribute_ns(copy, xml_get_ns_id(dst, "urn:p"), xml_get_name_id(dst, "k")) != NULL);
+    CHECK(element_get_ns_id(element_get_child(copy, NULL, "c")) == xml_get_ns_id(dst, "urn:d"));
+
+    // under a parent that binds the same uri nothing is declared again
+    xml_handle_t same = parse("<r xmlns:p=\"urn:p\" xmlns=\"urn:d\"/>", 0);
+    copy = xml_clone_subtree(same, xml_get_element(same), a);
+    CHECK(copy && element_get_attributes(copy) != NULL);
+    CHECK(strcmp(body(same), "<r xmlns:p=\"urn:p\" xmlns=\"urn:d\"><p:a p:k=\"v\"><p:b></p:b><c></c></p:a></r>") == 0);
+
+    // under a default namespace parent an element in no namespace gets xmlns=""
+    xml_handle_t other = parse("<r xmlns=\"urn:other\"/>", 0);
+    copy = xml_clone_subtree(other, xml_get_element(other), element_get_child(u, NULL, "v"));
+    CHECK(copy && element_get_ns_id(copy) == 0);
+    CHECK(strcmp(body(other), "<r xmlns=\"urn:other\"><v xmlns=\"\"></v></r>") == 0);
+
+    xml_free_handle(other);
+    xml_free_handle(same);
+    xml_free_handle(dst);
+    xml_free_handle(src);
+}
+
+// sources a copy can not be taken from give NULL and leave the target as it was
+static void test_clone_errors(void)
+{
+    xml_handle_t dst = xml_malloc_handle();
+    xml_handle_t src = parse("<r>text<a/></r>", 0);
+    xml_element_t text = element_get_node(xml_get_element(src));
+    CHECK(text && element_is_text(text));
+    CHECK(xml_clone_subtree(dst, NULL, text) == NULL);
+    CHECK(xml_get_element(dst) == NULL);
+    CHECK(xml_clone_subtree(dst, NULL, NULL) == NULL);
+
+    // input still open around the element
+    xml_handle_t open = xml_malloc_handle();
+    CHECK(xml_input_raw(open, "<r><a>", 6) == XML_STATUS_SUCCEED);
+    CHECK(xml_get_element(open) != NULL);
+    CHECK(xml_clone_subtree(dst, NULL, xml_get_element(open)) == NULL);
+    CHECK(xml_clone_handle(open) == NULL);
+
+    xml_handle_t failed = xml_malloc_handle();
+    CHECK(xml_input_raw(failed, "<r><a></b></r>", 14) == XML_STATUS_SYNTAX);
+    CHECK(xml_get_element(failed) == NULL || xml_clone_subtree(dst, NULL, xml_get_element(failed)) == NULL);
+    CHECK(xml_clone_handle(failed) == NULL);
+    CHECK(xml_get_element(dst) == NULL);
+
+    xml_free_handle(failed);
+    xml_free_handle(open);
+    xml_free_handle(src);
+    xml_free_handle(dst);
+}
+
+// a copy of a lazy document is fully built and matches a copy of the eager one
+static void test_clone_lazy(void)
+{
+    static char eager_out[4096];
+    static char lazy_out[4096];
+    xml_handle_t eager = parse(lazy_document, 0);
+    xml_handle_t lazy = parse(lazy_document, XML_OPTION_LAZY);
+    xml_handle_t eager_copy = xml_clone_handle(eager);
+    xml_handle_t lazy_copy = xml_clone_handle(lazy);
+    CHECK(eager_copy && lazy_copy);
+    CHECK(strcmp(xml_serialize(lazy_copy), xml_serialize(eager_copy)) == 0);
+    CHECK(strcmp(xml_serialize(lazy_copy), xml_serialize(eager)) == 0);
+    CHECK(strcmp(dump(lazy_copy, lazy_out, sizeof(lazy_out)), dump(eager, eager_out, sizeof(eager_out))) == 0);
+    CHECK(xml_get_name_id(lazy_copy, "tag") == xml_get_name_id(lazy, "tag"));
+
+    xml_handle_t dst = xml_malloc_handle();
+    xml_element_t item = element_child_at(xml_get_element(lazy), 1);
+    CHECK(xml_clone_subtree(dst, NULL, item) != NULL);
+    CHECK(strcmp(body(dst), "<item xmlns=\"urn:feed\" id=\"2\"><title xmlns=\"\">plain</title>text&lt;raw>\nlinetail</item>") == 0);
+
+    xml_free_handle(dst);
+    xml_free_handle(lazy_copy);
+    xml_free_handle(eager_copy);
+    xml_free_handle(lazy);
+    xml_free_handle(eager);
+}
+
+// the part of a document read before a limit stopped it is a whole tree, the rejected tag is not in it
+static void test_limit_tree(void)
+{
+    static const struct
+    {
+        const char*     doc;
+        xml_limits_t    limits;
+        const char*     kept;
+    } cases[] = {
+        { "<a><b><c><d/></c></b>", { 0, 2, 0, 0, 0, 0 }, "<a><b></b></a>" },
+        { "<a><b><long_name/></b>", { 0, 0, 0, 4, 0, 0 }, "<a><b></b></a>" },
+        { "<a><b><c x=\"1\" y=\"2\"/></b>", { 0, 0, 1, 0, 0, 0 }, "<a><b></b></a>" },
+    };
+
+    size_t i = 0;
+    for (i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+        xml_handle_t xml = xml_malloc_handle();
+        xml_set_limits(xml, &cases[i].limits);
+        xml_error_t error;
+        CHECK(xml_input_raw(xml, cases[i].doc, strlen(cases[i].doc)) == XML_STATUS_LIMIT);
+        CHECK(xml_get_error(xml, &error) == XML_STATUS_LIMIT);
+        xml_element_t b = element_get_child(xml_get_element(xml), NULL, "b");
+        CHECK(b != NULL && element_get_child(b, NULL, "c") == NULL && element_child_count(b) == 0);
+        CHECK(element_get_node(b) == NULL);
+        CHECK(strcmp(body(xml), cases[i].kept) == 0);
+        xml_free_handle(xml);
+    }
+}
+
+// once input failed nothing more is parsed, whatever is called on the handle in between
+static void test_failed_input(void)
+{
+    xml_limits_t limits = { 0, 0, 0, 0, 4, 0 };
+    xml_handle_t xml = xml_malloc_handle();
+    xml_set_limits(xml, &limits);
+    CHECK(xml_input_raw(xml, "<a><b>toolongtext</b>", 21) == XML_STATUS_LIMIT);
+    CHECK(xml_serialize_ex(xml, XML_SERIALIZE_COMPACT, NULL) != NULL);
+    CHECK(xml_clone_handle(xml) == NULL);
+    CHECK(xml_input_raw(xml, "<e>ok</e></a>", 13) == XML_STATUS_LIMIT);
+    CHECK(element_get_child(xml_get_element(xml), NULL, "e") == NULL);
+    xml_free_handle(xml);
+
+    xml = xml_malloc_handle();
+    CHECK(xml_input_raw(xml, "<a><b></c>", 10) == XML_STATUS_SYNTAX);
+    CHECK(xml_serialize(xml) != NULL);
+    CHECK(xml_input_raw(xml, "<e/></a>", 8) == XML_STATUS_SYNTAX);
+    xml_error_t error;
+    CHECK(xml_get_error(xml, &error) == XML_STATUS_SYNTAX);
+    CHECK(element_get_child(xml_get_element(xml), NULL, "e") == NULL);
+    xml_free_handle(xml);
+}
+
+static const char* snapshot_path = "xml_test.snapshot";
+
+static char* read_file(const char* path, size_t* size)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = malloc(*size);
+    if (data && fread(data, 1, *size, file) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    return data;
+}
+
+static void write_file(const char* path, const char* data, size_t size)
+{
+    FILE* file = fopen(path, "wb");
+    if (file) {
+        fwrite(data, 1, size, file);
+        fclose(file);
+    }
+}
+
+// a loaded snapshot is the tree that was saved, with the same ids
+static void test_snapshot_round_trip(void)
+{
+    static char saved_out[4096];
+    static char loaded_out[4096];
+    xml_handle_t xml = parse(lazy_document, 0);
+    CHECK(xml_save_snapshot(xml, snapshot_path) == XML_STATUS_SUCCEED);
+    xml_handle_t loaded = xml_load_snapshot(snapshot_path);
+    CHECK(loaded != NULL);
+    if (loaded) {
+        CHECK(strcmp(dump(loaded, loaded_out, sizeof(loaded_out)), dump(xml, saved_out, sizeof(saved_out))) == 0);
+        CHECK(strcmp(xml_serialize(loaded), xml_serialize(xml)) == 0);
+        CHECK(strcmp(xml_serialize_ex(loaded, XML_SERIALIZE_CANONICAL, NULL), xml_serialize_ex(xml, XML_SERIALIZE_CANONICAL, NULL)) == 0);
+        CHECK(xml_get_ns_id(loaded, "urn:meta") == xml_get_ns_id(xml, "urn:meta"));
+        CHECK(xml_get_element_ns(loaded, xml_get_ns_id(loaded, "urn:meta"), xml_get_name_id(loaded, "tag")) != NULL);
+        // the loaded tree takes edits like a parsed one
+        xml_element_t feed = xml_get_element(loaded);
+        CHECK(element_append_child(feed, xml_new_element(loaded, NULL, "end")) == XML_STATUS_SUCCEED);
+        CHECK(element_child_count(feed) == 4 && strcmp(element_get_name(element_child_at(feed, 3)), "end") == 0);
+        xml_free_handle(loaded);
+    }
+    xml_free_handle(xml);
+    remove(snapshot_path);
+}
+
+// any one damaged byte or a cut file either fails to load or loads a tree every accessor can walk
+static void test_snapshot_corrupt(void)
+{
+    static char out[4096];
+    xml_handle_t xml = parse("<?xml version=\"1.0\"?><r xmlns:p=\"urn:p\"><p:a p:k=\"v\" z=\"1\">t</p:a><b/>u</r>", 0);
+    CHECK(xml_save_snapshot(xml, snapshot_path) == XML_STATUS_SUCCEED);
+    xml_free_handle(xml);
+    size_t size = 0;
+    char* image = read_file(snapshot_path, &size);
+    CHECK(image != NULL);
+    if (image == NULL) {
+        return;
+    }
+
+    size_t i = 0;
+    int loaded = 0;
+    for (i=0; i<size*3; i++) {
+        size_t at = i / 3;
+        char saved = image[at];
+        image[at] = i % 3 == 0 ? saved ^ 0x01 : (i % 3 == 1 ? saved ^ 0x80 : 0x7f);
+        write_file(snapshot_path, image, size);
+        image[at] = saved;
+        xml_handle_t copy = xml_load_snapshot(snapshot_path);
+        if (copy == NULL) {
+            continue;
+        }
+        loaded++;
+        dump(copy, out, sizeof(out));
+        xml_serialize(copy);
+        xml_serialize_ex(copy, XML_SERIALIZE_INDENT, NULL);
+        xml_serialize_ex(copy, XML_SERIALIZE_CANONICAL, NULL);
+        xml_element_t root = xml_get_element(copy);
+        element_child_at(root, element_child_count(root) - 1);
+        element_next_named(element_child_at(root, 0), NULL, "b");
+        xml_get_element_ns(copy, xml_get_ns_id(copy, "urn:p"), xml_get_name_id(copy, "a"));
+        xml_free_handle(copy);
+    }
+    // changes inside strings still load
+    CHECK(loaded > 0);
+
+    size_t cuts[] = { 0, 1, 16, size / 2, size - 1 };
+    for (i=0; i<sizeof(cuts)/sizeof(cuts[0]); i++) {
+        write_file(snapshot_path, image, cuts[i]);
+        CHECK(xml_load_snapshot(snapshot_path) == NULL);
+    }
+    free(image);
+    remove(snapshot_path);
+}
+
+// an edit on a lazy element whose children can not be built fails and leaves the element as parsed
+static void test_lazy_edit_budget(void)
+{
+    static char doc[8192];
+    strcpy(doc, "<r>");
+    int i = 0;
+    for (i=0; i<200; i++) {
+        strcat(doc, "<i>some text</i>");
+    }
+    strcat(doc, "</r>");
+
+    size_t budget = 0;
+    int failed = 0;
+    for (budget=64*1024; budget<=512*1024; budget+=1024) {
+        xml_handle_t xml = xml_malloc_handle_ex(NULL, budget);
+        xml_set_option(xml, XML_OPTION_LAZY, 1);
+        xml_element_t d = NULL;
+        if (xml_input_raw(xml, doc, strlen(doc)) != XML_STATUS_SUCCEED || (d = xml_new_element(xml, NULL, "d")) == NULL) {
+            xml_free_handle(xml);
+            continue;
+        }
+        xml_element_t root = xml_get_element(xml);
+        int status = element_append_child(root, d);
+        if (status == XML_STATUS_SUCCEED) {
+            // parsed children first, the new one after them
+            xml_element_t first = element_get_node(root);
+            CHECK(first && strcmp(element_get_name(first), "i") == 0 && element_get_node(first) != NULL);
+            xml_element_t last = first;
+            while (element_get_sibling(last)) {
+                last = element_get_sibling(last);
+            }
+            CHECK(last == d);
+            xml_free_handle(xml);
+            break;
+        }
+        failed++;
+        CHECK(status == XML_STATUS_NO_MEMORY);
+        CHECK(element_set_text(root, XML_VALUE_TYPE_TEXT, "t") == XML_STATUS_NO_MEMORY);
+        CHECK(xml_add_element(xml, NULL, "r", NULL, "e", XML_VALUE_TYPE_TEXT, NULL) == XML_STATUS_NO_MEMORY);
+        const char* out = body(xml);
+        CHECK(out == NULL || strcmp(out, doc) == 0);
+        xml_free_handle(xml);
+    }
+    CHECK(failed > 0);
+}
+
+// with -DXML_ENABLE_STATS a lazy lookup is counted like an eager one, without it there is nothing to check
+static void test_lazy_stats(int options)
+{
+    xml_handle_t xml = parse(lazy_document, options);
+    xml_stats_t before;
+    xml_stats_t after;
+    if (xml_get_stats(xml, &before) != XML_STATUS_SUCCEED) {
+        xml_free_handle(xml);
+        return;
+    }
+    CHECK(xml_get_text(xml, NULL, "title") != NULL);
+    CHECK(xml_get_element_ns(xml, xml_get_ns_id(xml, "urn:meta"), xml_get_name_id(xml, "tag")) != NULL);
+    CHECK(xml_get_stats(xml, &after) == XML_STATUS_SUCCEED);
+    CHECK(after.lookups == before.lookups + 2);
+    CHECK(after.nodes_visited > before.nodes_visited && after.last_lookup_visited > 0);
+    xml_free_handle(xml);
+}
+
+// a clone interns the uris and local names a parse of its output would, prefixes are no atoms
+static void test_clone_atoms(void)
+{
+    xml_handle_t src = parse("<r xmlns:q=\"urn:q\"><q:a u:k=\"1\"><u:b/></q:a></r>", 0);
+    xml_handle_t dst = xml_malloc_handle();
+    xml_element_t copy = xml_clone_subtree(dst, NULL, element_get_child(xml_get_element(src), "q", "a"));
+    CHECK(copy != NULL);
+    xml_handle_t parsed = parse(body(dst), 0);
+    const char* strings[] = { "q", "u", "urn:q", "a", "b", "k" };
+    size_t i = 0;
+    for (i=0; i<sizeof(strings)/sizeof(strings[0]); i++) {
+        CHECK((xml_get_name_id(dst, strings[i]) > 0) == (xml_get_name_id(parsed, strings[i]) > 0));
+        CHECK((xml_get_ns_id(dst, strings[i]) > 0) == (xml_get_ns_id(parsed, strings[i]) > 0));
+    }
+    CHECK(xml_get_ns_id(dst, "u") == -1);
+    CHECK(strcmp(element_get_prefix(copy), "q") == 0 && strcmp(element_get_prefix(element_child_at(copy, 0)), "u") == 0);
+
+    // removing the copy gives its strings back like those of parsed nodes
+    CHECK(element_remove(element_child_at(copy, 0)) == XML_STATUS_SUCCEED);
+    CHECK(strcmp(body(dst), "<q:a xmlns:q=\"urn:q\" u:k=\"1\"></q:a>") == 0);
+    xml_free_handle(parsed);
+    xml_free_handle(dst);
+    xml_free_handle(src);
+}
+
+// a clone that runs out of memory keeps nothing of its reservation, at most the names it interned
+static void test_clone_budget(void)
+{
+    static char doc[8192];
+    strcpy(doc, "<r xmlns:p=\"urn:p\"><p:a>");
+    int i = 0;
+    for (i=0; i<100; i++) {
+        char item[64];
+        snprintf(item, sizeof(item), "<p:i n%d=\"v\">text %d</p:i>", i, i);
+        strcat(doc, item);
+    }
+    strcat(doc, "</p:a></r>");
+    xml_handle_t src = parse(doc, 0);
+    xml_element_t a = element_child_at(xml_get_element(src), 0);
+
+    size_t copied = 0;
+    xml_handle_t xml = xml_malloc_handle();
+    CHECK(xml_clone_subtree(xml, NULL, a) != NULL);
+    xml_get_memory_usage(xml, &copied, NULL, NULL);
+    xml_free_handle(xml);
+
+    size_t budget = 0;
+    int failed = 0;
+    for (budget=8*1024; budget<=1024*1024; budget+=1024) {
+        xml = xml_malloc_handle_ex(NULL, budget);
+        if (xml == NULL) {
+            continue;
+        }
+        size_t before = 0;
+        size_t after = 0;
+        xml_get_memory_usage(xml, &before, NULL, NULL);
+        xml_element_t copy = xml_clone_subtree(xml, NULL, a);
+        xml_get_memory_usage(xml, &after, NULL, NULL);
+        xml_free_handle(xml);
+        if (copy) {
+            break;
+        }
+        failed++;
+        CHECK(after - before < copied / 4);
+    }
+    CHECK(failed > 0 && budget <= 1024*1024);
+    xml_free_handle(src);
+}
+
+// chunks of raw input, the status of the last call, the first failure stops
+static int input_chunks(xml_handle_t xml, const char* const* chunks, int count)
+{
+    int status = XML_STATUS_SUCCEED;
+    int i = 0;
+    for (i=0; i<count && status == XML_STATUS_SUCCEED; i++) {
+        status = xml_input_raw(xml, chunks[i], strlen(chunks[i]));
+    }
+
+    return status;
+}
+
+static int input_utf8(xml_handle_t xml, const char* const* chunks, int count)
+{
+    xml_set_option(xml, XML_OPTION_VALIDATE_UTF8, 1);
+
+    return input_chunks(xml, chunks, count);
+}
+
+static void test_utf8_validation(void)
+{
+    // each document fails at the first byte of the bad sequence
+    static const struct {
+        const char* doc;
+        size_t      offset;
+    } invalid[] = {
+        { "<a>ab\xFF" "cd</a>", 5 },                // never a UTF-8 byte
+        { "<a>\x80</a>", 3 },                       // continuation without a lead
+        { "<a>x\xC0\x80</a>", 4 },                  // overlong NUL
+        { "<a>\xC1\xBF</a>", 3 },                   // overlong ASCII
+        { "<a>\xE0\x80\x80</a>", 3 },               // overlong 3 byte form
+        { "<a>\xF0\x80\x80\x80</a>", 3 },           // overlong 4 byte form
+        { "<a>\xED\xA0\x80</a>", 3 },               // high surrogate
+        { "<a>\xED\xBF\xBF</a>", 3 },               // low surrogate
+        { "<a>\xF4\x90\x80\x80</a>", 3 },           // above U+10FFFF
+        { "<a>\xE4\xB8" "A</a>", 3 },               // cut short by ASCII
+        { "<a b=\"\xE4\"/>", 6 },                   // in an attribute value
+    };
+    int i = 0;
+    for (i=0; i<(int)(sizeof(invalid)/sizeof(invalid[0])); i++) {
+        xml_handle_t xml = xml_malloc_handle();
+        CHECK(input_utf8(xml, &invalid[i].doc, 1) == XML_STATUS_ENCODING);
+        size_t offset = 0;
+        CHECK(xml_get_utf8_error(xml, &offset) == XML_STATUS_ENCODING);
+        CHECK(offset == invalid[i].offset);
+        xml_error_t error;
+        CHECK(xml_get_error(xml, &error) == XML_STATUS_ENCODING);
+        CHECK(error.offset == invalid[i].offset);
+        CHECK(strcmp(error.expected, "UTF-8") == 0);
+        // the error outlives a serialize, which resets the status of the last call
+        xml_serialize(xml);
+        CHECK(xml_get_utf8_error(xml, &offset) == XML_STATUS_ENCODING && offset == invalid[i].offset);
+        xml_free_handle(xml);
+    }
+
+    // the largest code points of each length, and U+FFFF just above the surrogates
+    const char* valid = "<a>\x7F\xDF\xBF\xEF\xBF\xBF\xEE\x80\x80\xF4\x8F\xBF\xBF</a>";
+    xml_handle_t xml = xml_malloc_handle();
+    CHECK(input_utf8(xml, &valid, 1) == XML_STATUS_SUCCEED);
+    CHECK(xml_get_utf8_error(xml, NULL) == XML_STATUS_SUCCEED);
+    xml_free_handle(xml);
+
+    // a sequence split by the chunk boundary is completed by the next chunk
+    const char* split[] = { "<a>\xE4", "\xB8", "\xAD</a>" };
+    xml = xml_malloc_handle();
+    CHECK(input_utf8(xml, split, 3) == XML_STATUS_SUCCEED);
+    CHECK(xml_get_element(xml) && strcmp(element_get_text(xml_get_element(xml)), "\xE4\xB8\xAD") == 0);
+    xml_free_handle(xml);
+
+    // and fails there with the offset of its lead byte in the earlier chunk
+    const char* broken[] = { "<a>xy\xF0\x9F", "A</a>" };
+    xml = xml_malloc_handle();
+    CHECK(input_utf8(xml, broken, 2) == XML_STATUS_ENCODING);
+    size_t offset = 0;
+    CHECK(xml_get_utf8_error(xml, &offset) == XML_STATUS_ENCODING && offset == 5);
+    xml_free_handle(xml);
+
+    // past an all ASCII block, the offset counts every chunk before
+    char text[200];
+    memset(text, 'x', sizeof(text));
+    memcpy(text, "<a>", 3);
+    text[150] = '\xC0';
+    memcpy(text + 151, "</a>", 5);
+    const char* blocks[] = { "<r>", text, "</r>" };
+    xml = xml_malloc_handle();
+    CHECK(input_utf8(xml, blocks, 3) == XML_STATUS_ENCODING);
+    CHECK(xml_get_utf8_error(xml, &offset) == XML_STATUS_ENCODING && offset == 153);
+    xml_free_handle(xml);
+
+    // a sequence cut by the end of the input fails once the document element has closed
+    const char* trailing[] = { "<a>x</a>\xE4" };
+    xml = xml_malloc_handle();
+    CHECK(input_utf8(xml, trailing, 1) == XML_STATUS_ENCODING);
+    CHECK(xml_get_utf8_error(xml, &offset) == XML_STATUS_ENCODING && offset == 8);
+    xml_free_handle(xml);
+
+    // without the option the bytes are taken as they are
+    xml = parse("<a>\xC0\x80</a>", 0);
+    xml_error_t error;
+    CHECK(xml_get_error(xml, &error) == XML_STATUS_SUCCEED);
+    CHECK(xml_get_utf8_error(xml, NULL) == XML_STATUS_SUCCEED);
+    xml_free_handle(xml);
+}
+
+// GB input one byte per call, so every two and four byte character is split, then written back in both encodings
+static xml_handle_t parse_bytes(const char* doc, int options)
+{
+    xml_handle_t xml = xml_malloc_handle();
+    xml_set_option(xml, XML_OPTION_KEEP_ENCODING, (options & XML_OPTION_KEEP_ENCODING) != 0);
+    int status = XML_STATUS_SUCCEED;
+    size_t i = 0;
+    for (i=0; doc[i] && status == XML_STATUS_SUCCEED; i++) {
+        status = xml_input_raw(xml, doc + i, 1);
+    }
+    CHECK(status == XML_STATUS_SUCCEED);
+
+    return xml;
+}
+
+static void test_gb_round_trip(void)
+{
+    // "中文" in GB2312, and U+00A5 as four GB18030 bytes
+    const char* gb2312 = "<?xml version=\"1.0\" encoding=\"GB2312\"?><a k=\"\xD6\xD0\">\xD6\xD0\xCE\xC4</a>";
+    const char* gb18030 = "<?xml version=\"1.0\" encoding=\"GB18030\"?><a>\x81\x30\x84\x36\xD6\xD0</a>";
+
+    xml_handle_t xml = parse_bytes(gb2312, 0);
+    CHECK(strcmp(element_get_text(xml_get_element(xml)), "\xE4\xB8\xAD\xE6\x96\x87") == 0);
+    CHECK(strcmp(element_get_attribute_text(xml_get_element(xml), "k"), "\xE4\xB8\xAD") == 0);
+    CHECK(strcmp(xml_serialize(xml), "<?xml version=\"1.0\" encoding=\"UTF-8\"?><a k=\"\xE4\xB8\xAD\">\xE4\xB8\xAD\xE6\x96\x87</a>") == 0);
+    xml_free_handle(xml);
+
+    xml = parse_bytes(gb2312, XML_OPTION_KEEP_ENCODING);
+    CHECK(strcmp(element_get_text(xml_get_element(xml)), "\xE4\xB8\xAD\xE6\x96\x87") == 0);
+    CHECK(strcmp(xml_serialize(xml), gb2312) == 0);
+    xml_free_handle(xml);
+
+    xml = parse_bytes(gb18030, XML_OPTION_KEEP_ENCODING);
+    CHECK(strcmp(element_get_text(xml_get_element(xml)), "\xC2\xA5\xE4\xB8\xAD") == 0);
+    CHECK(strcmp(xml_serialize(xml), gb18030) == 0);
+    xml_free_handle(xml);
+
+    // a character GB2312 does not hold moves the declaration to GB18030, inside the set it stays
+    xml = parse_bytes(gb2312, XML_OPTION_KEEP_ENCODING);
+    CHECK(element_set_text(xml_get_element(xml), XML_VALUE_TYPE_TEXT, "\xE6\x96\x87") == XML_STATUS_SUCCEED);
+    CHECK(strcmp(xml_serialize(xml), "<?xml version=\"1.0\" encoding=\"GB2312\"?><a k=\"\xD6\xD0\">\xCE\xC4</a>") == 0);
+    CHECK(element_set_text(xml_get_element(xml), XML_VALUE_TYPE_TEXT, "\xC2\xA5") == XML_STATUS_SUCCEED);
+    CHECK(strcmp(xml_serialize(xml), "<?xml version=\"1.0\" encoding=\"GB18030\"?><a k=\"\xD6\xD0\">\x81\x30\x84\x36</a>") == 0);
+    xml_free_handle(xml);
+
+    // U+4E02 is a two byte GBK code below A1, outside GB2312 but inside GBK
+    const char* gbk = "<?xml version=\"1.0\" encoding=\"GBK\"?><a>\x81\x40</a>";
+    xml = parse_bytes(gbk, XML_OPTION_KEEP_ENCODING);
+    CHECK(strcmp(element_get_text(xml_get_element(xml)), "\xE4\xB8\x82") == 0);
+    CHECK(strcmp(xml_serialize(xml), gbk) == 0);
+    xml_free_handle(xml);
+    xml = parse_bytes(gb2312, XML_OPTION_KEEP_ENCODING);
+    CHECK(element_set_text(xml_get_element(xml), XML_VALUE_TYPE_TEXT, "\xE4\xB8\x82") == XML_STATUS_SUCCEED);
+    CHECK(strcmp(xml_serialize(xml), "<?xml version=\"1.0\" encoding=\"GB18030\"?><a k=\"\xD6\xD0\">\x81\x40</a>") == 0);
+    xml_free_handle(xml);
+
+    // a lead byte with a trail no GB18030 code has fails at the lead byte
+    const char* invalid = "<?xml version=\"1.0\" encoding=\"GB18030\"?><a>x\x81\x20</a>";
+    xml = xml_malloc_handle();
+    CHECK(xml_input_raw(xml, invalid, strlen(invalid)) == XML_STATUS_ENCODING);
+    size_t offset = 0;
+    CHECK(xml_get_utf8_error(xml, &offset) == XML_STATUS_ENCODING && offset == strlen(invalid) - 6);
+    xml_free_handle(xml);
+}
+
+typedef struct
+{
+    int     id;
+    char    name[8];
+    char    city[16];
+    char    zip[8];
+    float   price;
+} record_t;
+
+static const xml_binding_t record_bindings[] = {
+    { "@id", XML_VALUE_TYPE_INT, offsetof(record_t, id), 0 },
+    { "name", XML_VALUE_TYPE_TEXT, offsetof(record_t, name), sizeof(((record_t*)0)->name) },
+    { "address/city", XML_VALUE_TYPE_TEXT, offsetof(record_t, city), sizeof(((record_t*)0)->city) },
+    { "address/@zip", XML_VALUE_TYPE_TEXT, offsetof(record_t, zip), sizeof(((record_t*)0)->zip) },
+    { "price", XML_VALUE_TYPE_FLOAT, offsetof(record_t, price), 0 },
+};
+
+static int extract(xml_bind_t bind, const char* doc, record_t* records, int capacity, int* count)
+{
+    memset(records, 0xA5, sizeof(record_t) * capacity);
+    return xml_bind_extract(bind, doc, strlen(doc), records, sizeof(record_t), capacity, count);
+}
+
+// records under the record path only, nested fields, missing ones left zero, GB input in UTF-8
+static void test_bind(void)
+{
+    xml_bind_t bind = xml_bind_compile("feed/item", record_bindings, sizeof(record_bindings) / sizeof(record_bindings[0]));
+    CHECK(bind != NULL);
+    record_t records[4];
+    int count = -1;
+
+    const char* doc =
+        "<feed>"
+        "<item id=\"1\"><name>one</name><address zip=\"100\"><city>Beijing</city></address><price>1.5</price></item>"
+        "<other><item id=\"9\"><name>nested</name></item></other>"
+        "<item id=\"2\"><name>a long name</name><note><city>not this</city></note></item>"
+        "<item><address><city>x</city><city>y</city></address></item>"
+        "</feed>";
+    CHECK(extract(bind, doc, records, 4, &count) == XML_STATUS_SUCCEED);
+    CHECK(count == 3);
+    CHECK(records[0].id == 1 && strcmp(records[0].name, "one") == 0);
+    CHECK(strcmp(records[0].city, "Beijing") == 0 && strcmp(records[0].zip, "100") == 0 && records[0].price == 1.5f);
+    // text is cut to the field, what the record lacks is zero
+    CHECK(records[1].id == 2 && strcmp(records[1].name, "a long ") == 0);
+    CHECK(records[1].city[0] == '\0' && records[1].zip[0] == '\0' && records[1].price == 0.0f);
+    // a field given twice keeps the first
+    CHECK(records[2].id == 0 && records[2].name[0] == '\0');
+    CHECK(strcmp(records[2].city, "x") == 0);
+
+    // more records than room, the first ones are kept
+    CHECK(extract(bind, doc, records, 2, &count) == XML_STATUS_NO_MEMORY);
+    CHECK(count == 2 && records[0].id == 1 && records[1].id == 2);
+
+    const char* mismatched = "<feed><item id=\"1\"><name>one</name></item><item id=\"2\"><name>two</city></item></feed>";
+    CHECK(extract(bind, mismatched, records, 4, &count) == XML_STATUS_SYNTAX);
+    CHECK(count == 1 && records[0].id == 1);
+
+    const char* gb = "<?xml version=\"1.0\" encoding=\"GBK\"?><feed><item id=\"3\"><name>\xD6\xD0</name>"
+        "<address zip=\"\xCE\xC4\"><city>\xB1\xB1\xBE\xA9</city></address></item></feed>";
+    CHECK(extract(bind, gb, records, 4, &count) == XML_STATUS_SUCCEED);
+    CHECK(count == 1 && records[0].id == 3 && strcmp(records[0].name, "\xE4\xB8\xAD") == 0);
+    CHECK(strcmp(records[0].city, "\xE5\x8C\x97\xE4\xBA\xAC") == 0 && strcmp(records[0].zip, "\xE6\x96\x87") == 0);
+
+    const char* latin1 = "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?><feed><item id=\"1\"/></feed>";
+    CHECK(extract(bind, latin1, records, 4, &count) == XML_STATUS_ENCODING && count == 0);
+    xml_bind_free(bind);
+}
+
+static const char* serialize_mode(xml_handle_t xml, int mode)
+{
+    int size = 0;
+    const char* out = xml_serialize_ex(xml, mode, &size);
+
+    return out && size == (int)strlen(out) ? out : "";
+}
+
+// canonical: namespace declarations by prefix, then attributes by namespace uri and local name, no namespace first
+static void test_serialize_canonical(void)
+{
+    xml_handle_t xml = parse("<?xml version=\"1.0\"?><r xmlns:z=\"urn:a\" xmlns:b=\"urn:z\" b:k=\"1\" z:k=\"2\" c=\"3\" a=\"4\"/>", 0);
+    CHECK(strcmp(serialize_mode(xml, XML_SERIALIZE_CANONICAL),
+        "<r xmlns:b=\"urn:z\" xmlns:z=\"urn:a\" a=\"4\" c=\"3\" z:k=\"2\" b:k=\"1\"></r>") == 0);
+    xml_free_handle(xml);
+
+    // references are decoded and escaped one way, text is normalized, CDATA becomes text, empty elements get an end tag
+    xml = parse("<r><q v=\"&apos;x&quot;&#9;&#10;&lt;&gt;&amp;&#x41;\" w=\"&#13;\"/><e/><t>  a&#38;b\t&#x3C;  </t>"
+        "<u>&custom;&#0;</u><s><![CDATA[<&>]]></s></r>", 0);
+    CHECK(strcmp(serialize_mode(xml, XML_SERIALIZE_CANONICAL),
+        "<r><q v=\"'x&quot;&#x9;&#xA;&lt;>&amp;A\" w=\"&#xD;\"></q><e></e><t>a&amp;b &lt;</t>"
+        "<u>&custom;&#0;</u><s>&lt;&amp;&gt;</s></r>") == 0);
+    xml_free_handle(xml);
+
+    // the same character written three ways is one canonical form
+    const char* forms[] = { "<r a=\"&amp;\">&amp;</r>", "<r a=\"&#38;\">&#38;</r>", "<r a=\"&#x26;\">&#x26;</r>" };
+    int i = 0;
+    for (i=0; i<3; i++) {
+        xml = parse(forms[i], 0);
+        CHECK(strcmp(serialize_mode(xml, XML_SERIALIZE_CANONICAL), "<r a=\"&amp;\">&amp;</r>") == 0);
+        xml_free_handle(xml);
+    }
+
+    // a reference across the 256th byte of a text segment is decoded whole
+    char doc[600];
+    char expected[600];
+    int n = snprintf(doc, sizeof(doc), "<r>");
+    int e = snprintf(expected, sizeof(expected), "<r>");
+    for (i=0; i<250; i++) {
+        doc[n++] = 'x';
+        expected[e++] = 'x';
+    }
+    snprintf(doc + n, sizeof(doc) - n, "&#x3C;&#60;&lt;</r>");
+    snprintf(expected + e, sizeof(expected) - e, "&lt;&lt;&lt;</r>");
+    xml = parse(doc, 0);
+    CHECK(strcmp(serialize_mode(xml, XML_SERIALIZE_CANONICAL), expected) == 0);
+    // compact output keeps them as written
+    CHECK(strstr(serialize_mode(xml, XML_SERIALIZE_COMPACT), "&#x3C;&#60;&lt;</r>") != NULL);
+    xml_free_handle(xml);
+}
+
+// indent: one element per line, blank text dropped, mixed content on lines of its own
+static void test_serialize_indent(void)
+{
+    xml_handle_t xml = parse("<r a=\"1\">\n  <e/>\n   <t>x &amp; y</t><w>x<y/></w>\n</r>", 0);
+    CHECK(strcmp(serialize_mode(xml, XML_SERIALIZE_INDENT),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<r a=\"1\">\n"
+        "  <e></e>\n"
+        "  <t>x &amp; y</t>\n"
+        "  <w>\n"
+        "    x\n"
+        "    <y></y>\n"
+        "  </w>\n"
+        "</r>\n") == 0);
+    // the compact form adds no whitespace
+    CHECK(strcmp(body(xml), "<r a=\"1\"><e></e><t>x &amp; y</t><w>x<y></y></w></r>") == 0);
+    xml_free_handle(xml);
+}
+
+// an edit deep in the tree writes its path again, every untouched sibling on the way is copied from the input
+static void test_source_reuse(int options)
+{
+    const char* doc = "<r><s1 k = 'v' ><!-- c --><x/></s1><a id=\"1\"><p>t&#65;</p><b><c q=\"z\">old</c><c2 /></b>"
+        "<n>&amp;</n></a><s2/></r>";
+    xml_handle_t xml = parse(doc, options);
+    CHECK(strcmp(body(xml), doc) == 0);
+
+    xml_element_t a = element_get_child(xml_get_element(xml), NULL, "a");
+    xml_element_t c = element_get_child(element_get_child(a, NULL, "b"), NULL, "c");
+    CHECK(element_set_text(c, XML_VALUE_TYPE_TEXT, "new<") == XML_STATUS_SUCCEED);
+    CHECK(strcmp(body(xml), "<r><s1 k = 'v' ><!-- c --><x/></s1><a id=\"1\"><p>t&#65;</p><b><c q=\"z\">new&lt;</c><c2 /></b>"
+        "<n>&amp;</n></a><s2/></r>") == 0);
+
+    // a second edit on another branch leaves the first one and the rest as they are
+    CHECK(element_set_attribute(element_get_child(a, NULL, "p"), "m", XML_VALUE_TYPE_TEXT, "2") == XML_STATUS_SUCCEED);
+    CHECK(strcmp(body(xml), "<r><s1 k = 'v' ><!-- c --><x/></s1><a id=\"1\"><p m=\"2\">t&#65;</p><b><c q=\"z\">new&lt;</c><c2 /></b>"
+        "<n>&amp;</n></a><s2/></r>") == 0);
+    xml_free_handle(xml);
+}
+
+// log callback for the tests, counts the calls and keeps the last record
+static int logged = 0;
+static xml_error_t last_logged;
+
+static void keep_log(void* context, const xml_error_t* error)
+{
+    (void)context;
+    logged++;
+    last_logged = *error;
+}
+
+// the error record and the log agree on where input failed, whichever chunk the offending token came in
+static void test_error_details(void)
+{
+    const char* one[] = { "<r>\n  <a>\n    <b>x</c>\n</a></r>" };
+    xml_handle_t xml = xml_malloc_handle();
+    logged = 0;
+    xml_set_log(xml, keep_log, NULL);
+    CHECK(input_chunks(xml, one, 1) == XML_STATUS_SYNTAX);
+    xml_error_t error;
+    CHECK(xml_get_error(xml, &error) == XML_STATUS_SYNTAX);
+    CHECK(error.offset == 18 && error.line == 3 && error.column == 9);
+    CHECK(strcmp(error.expected, "</b>") == 0 && strcmp(error.found, "</c>") == 0);
+    CHECK(strcmp(error.path, "r/a/b") == 0);
+    CHECK(logged == 1 && memcmp(&last_logged, &error, sizeof(xml_error_t)) == 0);
+    // refused input is not logged again
+    CHECK(xml_input_raw(xml, "<z/>", 4) == XML_STATUS_SYNTAX);
+    CHECK(logged == 1);
+    xml_free_handle(xml);
+
+    // offsets and lines count every chunk before the one that fails
+    const char* later[] = { "<r>\n<a>1</a>\n", "<b>2</b>\n<c>3</c>\n<d x=\"1\">", "<e>4</f></d></r>" };
+    xml = xml_malloc_handle();
+    logged = 0;
+    xml_set_log(xml, keep_log, NULL);
+    CHECK(input_chunks(xml, later, 3) == XML_STATUS_SYNTAX);
+    CHECK(xml_get_error(xml, &error) == XML_STATUS_SYNTAX);
+    CHECK(error.offset == 44 && error.line == 5 && error.column == 14);
+    CHECK(strcmp(error.expected, "</e>") == 0 && strcmp(error.found, "</f>") == 0);
+    CHECK(strcmp(error.path, "r/d/e") == 0);
+    CHECK(logged == 1 && last_logged.offset == 44 && last_logged.line == 5);
+    xml_free_handle(xml);
+
+    // a token begun in the chunk before is reported where it starts
+    const char* split[] = { "<r>\n<a>x</", "b></r>" };
+    xml = xml_malloc_handle();
+    CHECK(input_chunks(xml, split, 2) == XML_STATUS_SYNTAX);
+    CHECK(xml_get_error(xml, &error) == XML_STATUS_SYNTAX);
+    CHECK(error.offset == 8 && error.line == 2 && error.column == 5);
+    CHECK(strcmp(error.found, "</b>") == 0 && strcmp(error.path, "r/a") == 0);
+    xml_free_handle(xml);
+
+    // nothing is logged for a good document, and the record is empty
+    const char* good[] = { "<r><a>1</a>", "</r>" };
+    xml = xml_malloc_handle();
+    logged = 0;
+    xml_set_log(xml, keep_log, NULL);
+    CHECK(input_chunks(xml, good, 2) == XML_STATUS_SUCCEED);
+    CHECK(xml_get_error(xml, &error) == XML_STATUS_SUCCEED && error.line == 0 && error.found[0] == '\0');
+    CHECK(logged == 0);
+    xml_free_handle(xml);
+}
+
+#ifdef XML_ENABLE_ZLIB
+// a gzip member of data in a temporary file, cut drops bytes from its end, extra appends raw bytes
+static int gzip_file(const char* data, size_t size, size_t cut, const char* extra, size_t* compressed)
+{
+    z_stream stream;
+    memset(&stream, 0x0, sizeof(z_stream));
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    size_t capacity = deflateBound(&stream, size);
+    char* out = malloc(capacity);
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = size;
+    stream.next_out = (Bytef*)out;
+    stream.avail_out = capacity;
+    deflate(&stream, Z_FINISH);
+    size_t length = stream.total_out - cut;
+    deflateEnd(&stream);
+
+    FILE* file = tmpfile();
+    fwrite(out, 1, length, file);
+    if (extra) {
+        fwrite(extra, 1, strlen(extra), file);
+    }
+    fflush(file);
+    free(out);
+    *compressed = length;
+    int fd = dup(fileno(file));
+    fclose(file);
+    lseek(fd, 0, SEEK_SET);
+
+    return fd;
+}
+
+static void test_gzip(void)
+{
+    // several inflated buffers, so the parser and the producer take turns
+    size_t capacity = 4*1024*1024;
+    char* doc = malloc(capacity);
+    size_t size = snprintf(doc, capacity, "<list>");
+    int items = 0;
+    while (size < 3*1024*1024) {
+        size += snprintf(doc + size, capacity - size, "<item id=\"%d\">value %d</item>", items, items);
+        items++;
+    }
+    size += snprintf(doc + size, capacity - size, "</list>");
+
+    size_t compressed = 0;
+    int fd = gzip_file(doc, size, 0, NULL, &compressed);
+    xml_handle_t xml = xml_malloc_handle();
+    CHECK(xml_input_gzip(xml, fd) == XML_STATUS_SUCCEED);
+    close(fd);
+    xml_element_t list = xml_get_element(xml);
+    CHECK(list && element_child_count(list) == items);
+    xml_element_t last = list ? element_child_at(list, items - 1) : NULL;
+    char expected[32];
+    snprintf(expected, sizeof(expected), "value %d", items - 1);
+    CHECK(last && strcmp(element_get_text(last), expected) == 0);
+    xml_free_handle(xml);
+
+    // cut short: the stream ends inside the deflate data
+    fd = gzip_file(doc, size, 16, NULL, &compressed);
+    xml = xml_malloc_handle();
+    logged = 0;
+    xml_set_log(xml, keep_log, NULL);
+    xml_error_t error;
+    CHECK(xml_input_gzip(xml, fd) == XML_STATUS_FAULT);
+    close(fd);
+    CHECK(xml_get_error(xml, &error) == XML_STATUS_FAULT);
+    CHECK(error.offset == compressed);
+    CHECK(strcmp(error.found, "unexpected end of stream") == 0);
+    CHECK(logged == 1);
+    CHECK(xml_input_raw(xml, "", 0) == XML_STATUS_FAULT);
+    xml_free_handle(xml);
+
+    // a whole document followed by bytes that are not a gzip member
+    const char* small = "<a><b>1</b></a>";
+    fd = gzip_file(small, strlen(small), 0, "garbage!", &compressed);
+    xml = xml_malloc_handle();
+    CHECK(xml_input_gzip(xml, fd) == XML_STATUS_FAULT);
+    close(fd);
+    CHECK(xml_get_error(xml, &error) == XML_STATUS_FAULT);
+    CHECK(error.offset >= compressed && error.offset <= compressed + 8);
+    CHECK(error.found[0] != '\0');
+    xml_free_handle(xml);
+
+    // a parse error inside the stream keeps the parser's error
+    const char* bad = "<a><b>1</c></a>";
+    fd = gzip_file(bad, strlen(bad), 0, NULL, &compressed);
+    xml = xml_malloc_handle();
+    CHECK(xml_input_gzip(xml, fd) == XML_STATUS_SYNTAX);
+    close(fd);
+    CHECK(xml_get_error(xml, &error) == XML_STATUS_SYNTAX);
+    CHECK(strcmp(error.expected, "</b>") == 0);
+    xml_free_handle(xml);
+
+    free(doc);
+}
+#endif
+
+int main()
+{
+    test_mutation(0);
+    test_mutation(XML_OPTION_LAZY);
+    test_mutation(XML_OPTION_KEEP_SOURCE);
+    test_set_text(0);
+    test_set_text(XML_OPTION_LAZY);
+    test_mutation_namespaces(0);
+    test_mutation_namespaces(XML_OPTION_LAZY);
+    test_add();
+    test_lazy_equal();
+    test_lazy_budget();
+    test_lazy_limits();
+    test_child_index(0);
+    test_child_index(XML_OPTION_LAZY);
+    test_clone_namespaces(0);
+    test_clone_namespaces(XML_OPTION_LAZY);
+    test_clone_errors();
+    test_clone_lazy();
+    test_limit_tree();
+    test_failed_input();
+    test_snapshot_round_trip();
+    test_snapshot_corrupt();
+    test_lazy_edit_budget();
+    test_lazy_stats(0);
+    test_lazy_stats(XML_OPTION_LAZY);
+    test_clone_atoms();
+    test_clone_budget();
+    test_utf8_validation();
+    test_gb_round_trip();
+    test_bind();
+    test_serialize_canonical();
+    test_serialize_indent();
+    test_source_reuse(XML_OPTION_KEEP_SOURCE);
+    test_source_reuse(XML_OPTION_LAZY);
+    test_error_details();
+#ifdef XML_ENABLE_ZLIB
+    test_gzip();
+#endif
+
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "../xml.hpp"
+
+// behavioral checks of xml.hpp, every failed check is printed, the exit status counts them
+// build: gcc -c xml.c && g++ -std=c++17 -o xml_test_hpp tests/test_xml.cpp xml.o
+// run:   ./xml_test_hpp
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    checks++; \
+    if (!(condition)) { \
+        failures++; \
+        printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+    } \
+} while (0)
+
+static void test_parse_status()
+{
+    int status = -1;
+    xml::document good = xml::document::parse("<r><a>1</a></r>", 0, &status);
+    CHECK(status == XML_STATUS_SUCCEED);
+    CHECK(good && good.root() && good.root().name() == "r");
+
+    // the elements before the failure stay readable, the status and error say why it stopped
+    xml::document bad = xml::document::parse("<r><a>1</a><b>2</c></r>", 0, &status);
+    CHECK(status == XML_STATUS_SYNTAX);
+    CHECK(bad.error().status == XML_STATUS_SYNTAX && std::strcmp(bad.error().found, "</c>") == 0);
+    CHECK(bad.root().child("a").get<int>() == 1);
+
+    // without status it is the same parse
+    xml::document plain = xml::document::parse("<r/>");
+    CHECK(plain.root().name() == "r" && plain.error().status == XML_STATUS_SUCCEED);
+
+    // more input may follow a document that stops inside its element
+    xml::document open = xml::document::parse("<r><a>", 0, &status);
+    CHECK(status == XML_STATUS_SUCCEED);
+    CHECK(open.input("x</a></r>") == XML_STATUS_SUCCEED);
+    CHECK(open.root().child("a").text() == "x");
+}
+
+static void test_navigation(int options)
+{
+    xml::document d = xml::document::parse(
+        "<r xmlns:p=\"urn:p\" n=\"42\"><a>1</a>t<b k=\"true\">x</b><a>2</a><p:a>3</p:a><a>+4</a><c/></r>", options);
+    xml::element r = d.root();
+    CHECK(r.attribute<int>("n", 0) == 42);
+    CHECK(r.attribute("missing").empty() && r.attribute<int>("missing", -1) == -1);
+
+    std::string names;
+    for (xml::element e : r.children()) {
+        names += std::string(e.name()) + ",";
+    }
+    CHECK(names == "a,b,a,a,a,c,");
+
+    int nodes = 0, texts = 0;
+    for (xml::element e : r.nodes()) {
+        nodes++;
+        texts += e.is_text();
+    }
+    CHECK(nodes == 7 && texts == 1);
+
+    // named children follow the child index, no prefix matches any, a prefix as written only that one
+    int sum = 0, count = 0;
+    for (xml::element a : r.children("a")) {
+        sum += a.get<int>();
+        count++;
+    }
+    CHECK(count == 4 && sum == 10);
+    count = 0;
+    for (xml::element a : r.children("a", "p")) {
+        CHECK(a.get<int>() == 3 && a.ns_id() == d.ns_id("urn:p"));
+        count++;
+    }
+    CHECK(count == 1);
+    CHECK(r.children("none").empty());
+
+    xml::element b = r.child("b");
+    CHECK(b.attribute<bool>("k", false) && b.text() == "x" && b.get<int>(-1) == -1);
+    std::string attributes;
+    for (xml::attribute a : b.attributes()) {
+        attributes += std::string(a.name()) + "=" + std::string(a.value());
+    }
+    CHECK(attributes == "k=true");
+    CHECK(r.child("c") && r.child("c").text().empty() && !r.child("none"));
+    CHECK(d.get<int>("a") == 1 && d.text("b") == "x");
+    CHECK(d.find_ns(d.ns_id("urn:p"), d.name_id("a")).get<int>() == 3);
+}
+
+static void test_parse_value()
+{
+    CHECK(xml::parse_value<int>(" 7 ", 0) == 7);
+    CHECK(xml::parse_value<int>("7x", -1) == -1);
+    CHECK(xml::parse_value<int>("", -1) == -1);
+    CHECK(xml::parse_value<int>(nullptr, -1) == -1);
+    CHECK(xml::parse_value<double>("-2.5", 0) == -2.5);
+    CHECK(xml::parse_value<unsigned>("+3", 0) == 3);
+    CHECK(xml::parse_value<bool>("0", true) == false && xml::parse_value<bool>("yes", true) == true);
+    CHECK(xml::parse_value<std::string_view>(nullptr, "none") == "none");
+}
+
+// a moved-from document owns nothing, a clone owns its own copy
+static void test_ownership()
+{
+    xml::document d = xml::document::parse("<r><a>1</a></r>");
+    xml::document copy = d.clone();
+    xml::document moved = std::move(d);
+    CHECK(!d && moved && moved.root().child("a").get<int>() == 1);
+    CHECK(copy && copy.root() != moved.root() && copy.serialize() == moved.serialize());
+    CHECK(copy.serialize(XML_SERIALIZE_CANONICAL) == "<r><a>1</a></r>");
+
+    xml::document other;
+    other = std::move(moved);
+    CHECK(!moved && other.root().name() == "r");
+    xml_handle_t handle = other.release();
+    CHECK(!other && handle != nullptr);
+    xml::document adopted(handle);
+    CHECK(adopted.root().name() == "r");
+}
+
+int main()
+{
+    test_parse_status();
+    test_navigation(0);
+    test_navigation(XML_OPTION_LAZY);
+    test_parse_value();
+    test_ownership();
+
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# generate gb18030.h from the codec shipped with python
+# run: python3 tools/gb18030_table.py > gb18030.h
+
+import sys
+
+def trail_bytes():
+    return list(range(0x40, 0x7F)) + list(range(0x80, 0xFF))
+
+def two_byte_table():
+    table = []
+    for lead in range(0x81, 0xFF):
+        for trail in trail_bytes():
+            try:
+                table.append(ord(bytes([lead, trail]).decode('gb18030')))
+            except UnicodeDecodeError:
+                table.append(0)
+    return table
+
+def four_byte_ranges():
+    ranges = []
+    previous = None
+    for linear in range(39420):
+        b4 = linear % 10
+        b3 = linear // 10 % 126
+        b2 = linear // 1260 % 10
+        b1 = linear // 12600
+        code = ord(bytes([0x81 + b1, 0x30 + b2, 0x81 + b3, 0x30 + b4]).decode('gb18030'))
+        if previous is None or previous + 1 != code:
+            ranges.append((linear, code))
+        previous = code
+    return ranges
+
+def main():
+    out = sys.stdout
+    out.write('// generated by tools/gb18030_table.py, do not edit\n\n')
+    out.write('#ifndef __GB18030_H__\n#define __GB18030_H__\n\n')
+    out.write('// two byte codes, lead 0x81-0xFE, trail 0x40-0x7E and 0x80-0xFE, 0 if unmapped\n')
+    table = two_byte_table()
+    out.write('static const unsigned short gb18030_two_byte[%d] = {\n' % len(table))
+    for i in range(0, len(table), 12):
+        out.write('    ' + ', '.join('0x%04X' % v for v in table[i:i+12]) + ',\n')
+    out.write('};\n\n')
+    out.write('// four byte codes below U+10000: from linear index on, code points go up one by one\n')
+    ranges = four_byte_ranges()
+    out.write('static const unsigned short gb18030_ranges[%d][2] = {\n' % len(ranges))
+    for i in range(0, len(ranges), 6):
+        out.write('    ' + ', '.join('{%5d, 0x%04X}' % r for r in ranges[i:i+6]) + ',\n')
+    out.write('};\n\n#endif\n')
+
+if __name__ == '__main__':
+    main()
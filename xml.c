@@ -1,11 +1,64 @@
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "xml.h"
+#include "gb18030.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// xml_input_gzip is compiled in with -DXML_ENABLE_ZLIB, link with -lz -lpthread
+#ifdef XML_ENABLE_ZLIB
+#include <zlib.h>
+#include <pthread.h>
+#endif
+
+// counters and timers compiled in with -DXML_ENABLE_STATS, otherwise STAT() drops its statement
+#ifdef XML_ENABLE_STATS
+#include <time.h>
+#define STAT(statement)     statement
+#else
+#define STAT(statement)
+#endif
 
 #define BUFFER_SIZE 10*1024
-#define STACK_SIZE  10
+#define STACK_SIZE  32      // depth kept inline, deeper documents grow the stack on the heap
+#define ARENA_BLOCK_SIZE    (64*1024)
+#define ARENA_BLOCK_MAX     (4*1024*1024)
+#define ARENA_ALIGN         sizeof(void*)
+#define FREE_LIST_MAX       512     // chunks up to this size are recycled by exact size class
+#define FREE_LIST_COUNT     (FREE_LIST_MAX / ARENA_ALIGN)
+#define UTF8_BLOCK          64      // bytes validated at once, an all ASCII block costs one vector test
+#define DECODE_SLICE        (64*1024)   // input transcoded per step, bounds the decode buffer
+#define GB18030_BMP_LINEAR  39420       // four byte codes below this linear index map into the BMP
+#define GB18030_SMP_LINEAR  189000      // linear index of 0x90308130, U+10000
+#define RING_BUFFERS        4               // inflated buffers in flight between the two threads
+#define RING_BUFFER_SIZE    (1024*1024)
+#define RING_READ_SIZE      (256*1024)      // compressed bytes per read
+
+// strings copied by xml_strdup2 instead of pointing into a parsed token, they are recycled whole
+#define OWN_NS      0x01
+#define OWN_NAME    0x02
+#define OWN_VALUE   0x04    // attribute value or text segment
+#define OWN_ATOM    0x08    // element name points into the atom table, never recycled
+
+#define SNAPSHOT_MAGIC      "XMLSNAP1"
+#define SNAPSHOT_VERSION    1
+#define SNAPSHOT_ORDER      0x01020304
+
+typedef enum
+{
+    ENCODING_UTF8 = 0,  // also every encoding that is passed through untouched
+    ENCODING_GB18030,   // GB2312 and GBK are subsets, input is transcoded to UTF-8
+} ENCODING;
 
 typedef struct header_t
 {
@@ -16,47 +69,383 @@ typedef struct header_t
 
 typedef struct attribute_t
 {
-    char* name;
+    char* name;     // qualified name, "prefix:local"
     char* value;
+    const char* local;
+    int   ns_id;    // namespace uri atom, 0 if none, -1 if the prefix is not bound
+    int   name_id;  // local name atom
+    int   owned;    // OWN_* bits
     struct attribute_t* next;
 } attribute_t;
 
+typedef enum
+{
+    ELEMENT_TYPE_ELEMENT = 0,
+    ELEMENT_TYPE_TEXT,      // text segment, a child node without name
+} ELEMENT_TYPE;
+
 typedef struct element_t
 {
-    char* ns;	//namespace
+    int   type;
+    char* ns;	//namespace prefix
     char* name;
-    char* text;
+    int   ns_id;    // namespace uri atom resolved from xmlns declarations in scope, 0 if none, -1 if the prefix is not bound
+    int   name_id;  // local name atom
+    char* text;     // element: first text segment, text node: the segment itself
     attribute_t* attributes;
     struct element_t* parent;
     struct element_t* children;
+    struct element_t* last;	// last child, keep append O(1)
     struct element_t* siblings;	// == next
+    struct element_t* prev;
+    struct gb_xml_t*  owner;    // handle whose arena holds the node
+    size_t src_begin;   // byte span [src_begin, src_end) in the input, src_end == 0 if none
+    size_t src_end;
+    int    dirty;       // changed after parse, the span can not be reused
+    int    owned;       // OWN_* bits
+    int    entry;       // index + 1 in the lazy index, 0 if the node has none
+    int    lazy;        // children not built yet, see lazy_expand
+    struct child_index_t* index;    // built on first indexed access, stale when the children change
 } element_t, *xml_element_t;
 
+// element children of one parent in an array, one heap chunk reused by every rebuild that fits
+typedef struct child_index_t
+{
+    size_t  size;           // bytes allocated
+    int     capacity;       // children that fit, power of 2
+    int     count;
+    int     stale;          // children changed, rebuilt on the next indexed access
+    element_t** children;   // document order, text nodes left out
+    int*    next_named;     // position of the next child with the same local name, -1 after the last
+    element_t** keys;       // child -> position, open addressing, 2 * capacity slots
+    int*    positions;
+    int*    last;           // (name id, position) pairs while next_named is chained, same slots
+    int     mask;
+    struct child_index_t* prev; // all indexes of the handle, freed with it
+    struct child_index_t* next;
+} child_index_t;
+
+// one element of the input seen with XML_OPTION_LAZY, in document order
+typedef struct lazy_entry_t
+{
+    size_t  begin;      // '<' of the start tag in the source
+    size_t  content;    // after the start tag
+    size_t  end;        // after the end tag, 0 while the element is open
+    int     parent;     // entry index, -1 for the document element
+    int     next;       // first entry after the subtree, 0 while the element is open
+    struct element_t* element;  // NULL until built, and again once removed
+} lazy_entry_t;
+
+// prefix used in a clone, not terminated, size 0 for none
+typedef struct prefix_t
+{
+    const char* name;
+    int     size;
+    int     declare;    // the copy needs an xmlns declaration for it
+    const char* uri;    // of that declaration, NULL undeclares the default namespace
+} prefix_t;
+
+// interned strings, namespace uris and local names compare as ids
+typedef struct atom_table_t
+{
+    const char** strings;   // id - 1 -> string
+    int     count;
+    int     capacity;
+    int*    slots;          // open addressing, holds id or 0
+    int     slot_count;     // power of 2
+} atom_table_t;
+
+typedef struct ns_binding_t
+{
+    const char* prefix;     // "" for default namespace
+    int     uri;
+    const struct element_t* owner;  // declaring element, binding goes out of scope with it
+} ns_binding_t;
+
+typedef struct block_t
+{
+    struct block_t* next;
+    size_t  size;
+    char    data[];
+} block_t;
+
+typedef struct free_chunk_t
+{
+    struct free_chunk_t* next;
+} free_chunk_t;
+
 typedef struct gb_xml_t
 {
-    char    buffer[BUFFER_SIZE];
-    int     buffer_used;
+    char    buffer[BUFFER_SIZE];    // first arena block, more are chained in blocks when it is full
+    char*   arena;          // current block
+    size_t  arena_size;
+    size_t  arena_used;
+    size_t  arena_retired;  // bytes used in previous blocks
+    block_t* blocks;
+    size_t  heap_bytes;     // taken from malloc, handle included
+    size_t  heap_peak;
+    size_t  heap_allocs;
+    xml_allocator_t allocator;  // the handle itself comes from it too
+    size_t  budget;         // cap on heap_bytes, 0 is none
+    free_chunk_t* free_lists[FREE_LIST_COUNT];  // recycled chunks, index is size / ARENA_ALIGN - 1
     void*   extend[2];
     int     status;
+    int     input_status;   // first failure of xml_input_raw, later input is refused with it
+    int     options;
 
     header_t*   header;
     element_t*  element;
+
+    atom_table_t    atoms;
+    ns_binding_t*   bindings;
+    int             binding_count;
+    int             binding_capacity;
+
+    int     token_size;     // bytes in the token being built at extend[0]
+    int     value_scanned;  // bytes of that token already looked at for an open attribute value
+    int     value_begin;    // 1 + offset of the attribute value still open in it, 0 if none
+    size_t  token_begin;    // input offsets of the current tag
+    size_t  token_end;
+    size_t  consumed;       // input bytes seen so far
+    int     utf8_skip;      // header declared another encoding, XML_OPTION_VALIDATE_UTF8 does not apply
+    int     utf8_need;      // continuation bytes still expected
+    unsigned char utf8_low; // allowed range of the next continuation byte
+    unsigned char utf8_high;
+    size_t  utf8_begin;     // input offset of the sequence being validated
+    size_t  utf8_error;     // input offset of the first invalid sequence, valid with XML_STATUS_ENCODING
+    size_t  lines;          // line breaks seen so far
+    size_t  line_begin;     // input offset where the current line starts
+    xml_error_t error;
+    xml_log_t   log;
+    void*   log_context;
+    xml_limits_t limits;    // 0 is no limit
+    size_t  received;       // bytes passed to xml_input_raw
+    size_t  nodes;          // elements and text nodes parsed
+    int     encoding;       // declared by the header
+    unsigned char pending[4];   // multibyte sequence cut by the end of the last chunk
+    int     pending_size;
+    size_t  encoded;        // input offset of the next byte to transcode
+    char*   decoded;        // transcoding output, fed to the tokenizer
+    size_t  decoded_capacity;
+    unsigned short* gb_reverse; // code point -> two byte code, built on the first serialize with XML_OPTION_KEEP_ENCODING
+    char*   source;         // copy of the input with XML_OPTION_KEEP_SOURCE or XML_OPTION_LAZY
+    size_t  source_size;
+    size_t  source_capacity;
+
+    char*   output;     // serializer result, reused by every xml_serialize call
+    size_t  output_size;
+    size_t  output_capacity;
+    char*   recode;     // output in the declared encoding is built here, then swapped with output
+    size_t  recode_capacity;
+
+    void*   mapping;    // snapshot image the tree lives in, see xml_load_snapshot
+    size_t  mapping_size;
+
+    lazy_entry_t*   lazy;   // structural index with XML_OPTION_LAZY
+    int     lazy_count;
+    int     lazy_capacity;
+    int*    lazy_open;      // entries of the open elements
+    int     lazy_depth;
+    int     lazy_open_capacity;
+    int     lazy_changed;   // elements added or moved, lookups walk the tree instead of the index
+    struct child_index_t* child_indexes;    // see get_child_index
+
+#ifdef XML_ENABLE_STATS
+    xml_stats_t stats;
+#endif
 } gb_xml_t, *xml_handle_t;
 
+// file header of a snapshot, positions are byte offsets from the start of the file
+// pointer fields in the records hold offsets the same way, 0 is NULL
+typedef struct snapshot_t
+{
+    char    magic[8];
+    unsigned int    version;
+    unsigned int    order;      // SNAPSHOT_ORDER, reads differently on the other byte order
+    unsigned int    pointer_size;
+    unsigned int    element_size;
+    unsigned int    attribute_size;
+    unsigned int    header_size;
+    unsigned long long  element_count;
+    unsigned long long  attribute_count;
+    unsigned long long  header_count;
+    unsigned long long  atom_count;
+    unsigned long long  elements;   // element_t records in document order
+    unsigned long long  attributes;
+    unsigned long long  headers;
+    unsigned long long  atoms;      // offset of each interned string, id - 1 is the index
+    unsigned long long  strings;    // NUL terminated strings up to image_size
+    unsigned long long  root;
+    unsigned long long  header;
+    unsigned long long  image_size;
+} snapshot_t;
+
+typedef struct bind_edge_t
+{
+    int     from;       // state, 0 before the document element
+    const char* name;   // qualified name as written
+    int     size;
+    int     to;         // 0 marks a free slot
+} bind_edge_t;
+
+typedef struct bind_field_t
+{
+    const char* attribute;  // NULL for element text
+    int     attribute_size;
+    int     type;
+    size_t  offset;
+    size_t  size;
+    int     next;       // next field of the same state, -1 ends
+} bind_field_t;
+
+typedef struct bind_t
+{
+    char*   names;      // copies of all paths, edges and fields point into it
+    bind_edge_t*    edges;  // (state, name) -> state, open addressing
+    int     edge_mask;
+    int*    fields_of;  // state -> first field or -1
+    int     state_count;
+    int     record;     // state of the record element
+    bind_field_t*   fields;
+    int     field_count;
+    int     depth;      // deepest state, the scan never tracks more open elements
+} bind_t, *xml_bind_t;
+
+#ifdef XML_ENABLE_ZLIB
+// ring of inflated buffers, the producer thread fills them in turn and the parser reads them in place
+typedef struct ring_t
+{
+    char*   buffers[RING_BUFFERS];
+    int     sizes[RING_BUFFERS];
+    char*   input;      // compressed bytes, only touched by the producer
+    int     fd;
+    int     head;       // next buffer to fill
+    int     tail;       // next buffer to parse
+    int     count;      // filled buffers
+    int     done;       // producer finished, status says how
+    int     stop;       // parser failed, producer gives up
+    int     status;
+    size_t  offset;     // compressed bytes consumed when the producer failed
+    char    reason[64]; // why it failed, the zlib message if there is one
+    pthread_mutex_t mutex;
+    pthread_cond_t  filled;
+    pthread_cond_t  drained;
+} ring_t;
+#endif
+
 typedef struct
 {
-    void*   data[STACK_SIZE];
+    void*   fixed[STACK_SIZE];
+    void**  data;
     int     header;
+    int     capacity;
 } stack_t;
 
+#ifdef XML_ENABLE_STATS
+static double stat_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void stat_lookup(xml_handle_t xml, unsigned long visited, double begin)
+{
+    if (xml) {
+        xml->stats.lookups++;
+        xml->stats.nodes_visited += visited;
+        xml->stats.last_lookup_visited = visited;
+        xml->stats.query_seconds += stat_now() - begin;
+    }
+}
+#endif
+
+static void* default_alloc(void* context, size_t size)
+{
+    (void)context;
+    return malloc(size);
+}
+
+static void* default_realloc(void* context, void* pointer, size_t old_size, size_t size)
+{
+    (void)context;
+    (void)old_size;
+    return realloc(pointer, size);
+}
+
+static void default_free(void* context, void* pointer, size_t size)
+{
+    (void)context;
+    (void)size;
+    free(pointer);
+}
+
+// every heap byte of a handle goes through here, so the budget and the counters see all of it
+static void* heap_alloc(xml_handle_t xml, size_t size)
+{
+    if (xml->budget && xml->heap_bytes + size > xml->budget) {
+        return NULL;
+    }
+    void* pointer = xml->allocator.alloc(xml->allocator.context, size);
+    if (pointer) {
+        xml->heap_bytes += size;
+        xml->heap_allocs++;
+        if (xml->heap_bytes > xml->heap_peak) {
+            xml->heap_peak = xml->heap_bytes;
+        }
+    }
+
+    return pointer;
+}
+
+static void* heap_realloc(xml_handle_t xml, void* pointer, size_t old_size, size_t size)
+{
+    if (xml->budget && size > old_size && xml->heap_bytes + size - old_size > xml->budget) {
+        return NULL;
+    }
+    void* result = xml->allocator.realloc(xml->allocator.context, pointer, old_size, size);
+    if (result) {
+        xml->heap_bytes += size - old_size;
+        xml->heap_allocs++;
+        if (xml->heap_bytes > xml->heap_peak) {
+            xml->heap_peak = xml->heap_bytes;
+        }
+    }
+
+    return result;
+}
+
+static void heap_free(xml_handle_t xml, void* pointer, size_t size)
+{
+    if (pointer) {
+        xml->heap_bytes -= size;
+        xml->allocator.free(xml->allocator.context, pointer, size);
+    }
+}
+
+// a new error replaces every field of the last one, nothing of it is left behind
+static void clear_error(xml_handle_t xml)
+{
+    memset(&xml->error, 0x0, sizeof(xml_error_t));
+}
+
+// an accessor ran out of memory after input, xml_get_error reports it like a failed input
+static int out_of_memory(xml_handle_t xml)
+{
+    clear_error(xml);
+    return xml->error.status = xml->status = XML_STATUS_NO_MEMORY;
+}
+
 static int init_stack(stack_t* stack)
 {
     if (stack == NULL) {
         return -1;
     }
 
-    memset(stack->data, 0x0, sizeof(stack->data));
+    memset(stack->fixed, 0x0, sizeof(stack->fixed));
+    stack->data = stack->fixed;
     stack->header = -1;
+    stack->capacity = STACK_SIZE;
 
     return 0;
 }
@@ -70,12 +459,30 @@ static void* pop_stack(stack_t* stack)
     return stack->data[stack->header--];
 }
 
-static int push_stack(stack_t* stack, void* item)
+static int push_stack(xml_handle_t xml, stack_t* stack, void* item)
 {
-    if (stack == NULL || stack->header + 1 >= STACK_SIZE || item == NULL) {
+    if (stack == NULL || item == NULL) {
         return -1;
     }
 
+    if (stack->header + 1 >= stack->capacity) {
+        int capacity = stack->capacity * 2;
+        void** data = NULL;
+        if (stack->data == stack->fixed) {
+            data = heap_alloc(xml, capacity * sizeof(void*));
+            if (data) {
+                memcpy(data, stack->fixed, sizeof(stack->fixed));
+            }
+        } else {
+            data = heap_realloc(xml, stack->data, stack->capacity * sizeof(void*), capacity * sizeof(void*));
+        }
+        if (data == NULL) {
+            return -1;
+        }
+        stack->data = data;
+        stack->capacity = capacity;
+    }
+
     stack->data[++stack->header] = item;
     return 0;
 }
@@ -89,903 +496,5272 @@ static void* read_stack(stack_t* stack)
     return stack->data[stack->header];
 }
 
-static void* xml_malloc(xml_handle_t xml, size_t size)
+static int new_block(xml_handle_t xml, size_t need)
+{
+    size_t size = xml->arena_size < ARENA_BLOCK_SIZE ? ARENA_BLOCK_SIZE : xml->arena_size;
+    if (size < ARENA_BLOCK_MAX) {
+        size *= 2;  // grow geometric so a large document needs few blocks
+    }
+    if (size < need) {
+        size = need;
+    }
+
+    block_t* block = heap_alloc(xml, sizeof(block_t) + size);
+    if (block == NULL) {
+        return -1;
+    }
+    block->next = xml->blocks;
+    block->size = size;
+    xml->blocks = block;
+    STAT(xml->stats.arena_blocks++;)
+
+    xml->arena_retired += xml->arena_used;
+    xml->arena = block->data;
+    xml->arena_size = size;
+    xml->arena_used = 0;
+
+    return 0;
+}
+
+static void* xml_alloc(xml_handle_t xml, size_t size, size_t align)
 {
     if (xml == NULL || size == 0) {
         return NULL;
     }
 
-    if (xml->buffer_used + size > sizeof(xml->buffer)) {
-        return NULL;
+    size_t chunk = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (chunk <= FREE_LIST_MAX && xml->free_lists[chunk / ARENA_ALIGN - 1]) {
+        free_chunk_t* free_chunk = xml->free_lists[chunk / ARENA_ALIGN - 1];
+        xml->free_lists[chunk / ARENA_ALIGN - 1] = free_chunk->next;
+        return free_chunk;
+    }
+
+    size_t offset = (xml->arena_used + align - 1) & ~(align - 1);
+    if (offset + size > xml->arena_size) {
+        if (new_block(xml, size) != 0) {
+            return NULL;
+        }
+        offset = 0;
     }
 
-    void* pointer = xml->buffer + xml->buffer_used;
-    xml->buffer_used += size;
+    void* pointer = xml->arena + offset;
+    xml->arena_used = offset + size;
     return pointer;
 }
 
-static char* xml_newstr(xml_handle_t xml)
+static void* xml_malloc(xml_handle_t xml, size_t size)
 {
-    if (xml == NULL) {
-        return NULL;
+    return xml_alloc(xml, size, ARENA_ALIGN);
+}
+
+// give [pointer, pointer + size) back to the arena: the last allocation of the block is undone,
+// anything else goes to the free lists in chunks of at most FREE_LIST_MAX
+static void xml_recycle(xml_handle_t xml, void* pointer, size_t size)
+{
+    if (xml == NULL || pointer == NULL) {
+        return;
     }
 
-    if (xml->buffer_used >= sizeof(xml->buffer)) {
-        return NULL;
+    char* end = (char*)pointer + size;
+    if ((char*)pointer >= xml->arena && end == xml->arena + xml->arena_used) {
+        xml->arena_used = (char*)pointer - xml->arena;
+        return;
     }
 
-    return xml->buffer + xml->buffer_used;
+    char* begin = (char*)(((size_t)pointer + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1));
+    while (end >= begin + ARENA_ALIGN) {
+        size_t chunk = (end - begin) & ~(ARENA_ALIGN - 1);
+        if (chunk > FREE_LIST_MAX) {
+            chunk = FREE_LIST_MAX;
+        }
+        free_chunk_t* free_chunk = (free_chunk_t*)begin;
+        free_chunk->next = xml->free_lists[chunk / ARENA_ALIGN - 1];
+        xml->free_lists[chunk / ARENA_ALIGN - 1] = free_chunk;
+        begin += chunk;
+    }
 }
 
-static char* xml_strinc(xml_handle_t xml, char* dst, char c)
+// a string inside a token only gives back its own bytes, an owned copy its whole rounded chunk
+static void xml_recycle_string(xml_handle_t xml, char* s, int owned)
 {
-    if (xml != NULL && dst != NULL) {
-        if (xml->buffer_used + 1 < sizeof(xml->buffer)) {
-            xml->buffer[xml->buffer_used++] = c;
-            return dst;
+    if (s) {
+        size_t size = strlen(s) + 1;
+        if (owned) {
+            size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
         }
+        xml_recycle(xml, s, size);
     }
-
-    return NULL;
 }
 
-static char* xml_strdup(xml_handle_t xml, const char* src)
+// start a token at the end of the arena, it grows with xml_strinc
+static char* xml_newstr(xml_handle_t xml)
 {
-    if (xml == NULL || src == NULL || strlen(src) == 0) {
+    if (xml == NULL) {
         return NULL;
     }
 
-    if (xml->buffer_used + strlen(src) > sizeof(xml->buffer)) {
+    xml->token_size = 0;
+    xml->value_scanned = 0;
+    xml->value_begin = 0;
+    return xml->arena + xml->arena_used;
+}
+
+// append c to the token, a token outgrowing its block moves to a new one, so use the returned pointer
+static char* xml_strinc(xml_handle_t xml, char* dst, char c)
+{
+    if (xml == NULL || dst == NULL) {
         return NULL;
     }
 
-    char* dst = xml->buffer + xml->buffer_used;
-    strncpy(dst, src, strlen(src));
-    xml->buffer_used += strlen(src);
+    if (xml->arena_used + 1 > xml->arena_size) {
+        size_t size = xml->arena + xml->arena_used - dst;
+        if (new_block(xml, size * 2 + 1) != 0) {
+            return NULL;
+        }
+        memcpy(xml->arena, dst, size);
+        xml->arena_used = size;
+        xml_recycle(xml, dst, size);    // the abandoned copy in the old block
+        dst = xml->arena;
+    }
+    xml->arena[xml->arena_used++] = c;
+    xml->token_size++;
+
     return dst;
 }
 
 static char* xml_strdup2(xml_handle_t xml, const char* src)
 {
-    char* dst = xml_strdup(xml, src);
-    if (dst == NULL) {
+    if (xml == NULL || src == NULL || strlen(src) == 0) {
         return NULL;
     }
 
-    if (xml->buffer_used + 1 > sizeof(xml->buffer)) {
+    // aligned and rounded, so xml_recycle_string can give the chunk back whole
+    size_t size = strlen(src) + 1;
+    size_t chunk = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    char* dst = xml_alloc(xml, chunk, ARENA_ALIGN);
+    if (dst == NULL) {
         return NULL;
     }
-    xml->buffer[xml->buffer_used++] = '\0';
+    memcpy(dst, src, size);
+    memset(dst + size, 0x0, chunk - size);
     return dst;
 }
 
-typedef enum
+// keep a copy of everything fed to the tokenizer, element spans point into it
+static int append_source(xml_handle_t xml, const char* raw, int size)
 {
-    NODE_UNKNOWN = -1,
-    NODE_HEADER = 0,
-    NODE_OPEN_TAG,
-    NODE_CLOSE_TAG,
-    NODE_SINGLE_TAG,    // <... />
-    NODE_TEXT,
-    NODE_BLANK,
-} XML_NODE_TYPE;
+    if (xml->source_size + size > xml->source_capacity) {
+        size_t capacity = xml->source_capacity ? xml->source_capacity : 64 * 1024;
+        while (xml->source_size + size > capacity) {
+            capacity *= 2;
+        }
+        char* source = heap_realloc(xml, xml->source, xml->source_capacity, capacity);
+        if (source == NULL) {
+            return XML_STATUS_NO_MEMORY;
+        }
+        xml->source = source;
+        xml->source_capacity = capacity;
+    }
 
-static int get_node_type(const char* node, int size)
+    memcpy(xml->source + xml->source_size, raw, size);
+    xml->source_size += size;
+
+    return XML_STATUS_SUCCEED;
+}
+
+// UTF8_BLOCK bytes without a high bit, the common case skips the state machine
+static int is_ascii_block(const char* s)
 {
-    if (node == NULL || size <= 0) {
-        return NODE_UNKNOWN;
-    }
-    if (node[0] == '<' && node[1] == '>') {
-        return NODE_UNKNOWN;
+#if defined(__SSE2__)
+    __m128i bits = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i*)s), _mm_loadu_si128((const __m128i*)(s + 16))),
+        _mm_or_si128(_mm_loadu_si128((const __m128i*)(s + 32)), _mm_loadu_si128((const __m128i*)(s + 48))));
+    return _mm_movemask_epi8(bits) == 0;
+#else
+    unsigned long long bits = 0;
+    int i = 0;
+    for (i=0; i<UTF8_BLOCK; i+=sizeof(bits)) {
+        unsigned long long word;
+        memcpy(&word, s + i, sizeof(word));
+        bits |= word;
     }
+    return (bits & 0x8080808080808080ULL) == 0;
+#endif
+}
 
-    //printf("\033[0;32;31m node=[%s] %s,%d \033[m\n", node, __FILE__, __LINE__);
-
-    if (node[0] == '<') {
-        if (node[1] == '/') {
-            if (node[size-1] == '>') {
-                return NODE_CLOSE_TAG;
-            } else {
-                return NODE_TEXT;
+// one byte of the UTF-8 state machine, overlong forms, surrogates and code points above U+10FFFF fail
+static int utf8_step(xml_handle_t xml, unsigned char c, size_t offset)
+{
+    if (xml->utf8_need == 0) {
+        if (c < 0x80) {
+            return 0;
+        }
+        xml->utf8_begin = offset;
+        xml->utf8_low = 0x80;
+        xml->utf8_high = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF) {
+            xml->utf8_need = 1;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            xml->utf8_need = 2;
+            if (c == 0xE0) {
+                xml->utf8_low = 0xA0;
+            } else if (c == 0xED) {
+                xml->utf8_high = 0x9F;
             }
-        } else if (node[1] == '?' && node[size-2] == '?' && node[size-1] == '>') {
-            return NODE_HEADER;
-        } else if (node[size-1] == '>') {
-            if (node[size-2] == '/') {    // <... />
-                return NODE_SINGLE_TAG;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            xml->utf8_need = 3;
+            if (c == 0xF0) {
+                xml->utf8_low = 0x90;
+            } else if (c == 0xF4) {
+                xml->utf8_high = 0x8F;
             }
-            return NODE_OPEN_TAG;
         } else {
-            return NODE_TEXT;
+            return -1;
         }
-    } else {
-        int i = 0;
-        for (i=0; i<size; i++) {
-            if (isspace(node[i]) == 0) {
-                return NODE_TEXT;
-            }
-        }
-        return NODE_BLANK;
+        return 0;
     }
+    if (c < xml->utf8_low || c > xml->utf8_high) {
+        return -1;
+    }
+    xml->utf8_need--;
+    xml->utf8_low = 0x80;
+    xml->utf8_high = 0xBF;
+
+    return 0;
 }
 
-static int add_child(element_t* parent, element_t* child)
+// validate raw[begin, begin + UTF8_BLOCK) ahead of the tokenizer while the bytes are in cache
+// return where the next block starts, size once an invalid byte is found and its index is in *invalid
+static int utf8_block(xml_handle_t xml, const char* raw, int size, int begin, int* invalid)
 {
-    if (parent == NULL || child == NULL) {
-        return -1;
+    int end = size - begin > UTF8_BLOCK ? begin + UTF8_BLOCK : size;
+    if (xml->utf8_need == 0 && end - begin == UTF8_BLOCK && is_ascii_block(raw + begin)) {
+        return end;
     }
-    element_t** temp = &parent->children;
-    while (*temp) {
-        if (*temp == child) {   // 防止重复添加
-            return 0;
+    int i = 0;
+    for (i=begin; i<end; i++) {
+        if (utf8_step(xml, raw[i], xml->consumed + i) != 0) {
+            // the sequence is reported from its lead byte, which may be this one
+            xml->utf8_error = xml->utf8_need ? xml->utf8_begin : xml->consumed + i;
+            *invalid = i;
+            return size;
         }
-        temp = &(*temp)->siblings;
     }
-    *temp = child;
 
-    return 0;
+    return end;
 }
 
-static int parse_header(xml_handle_t xml)
+static int utf8_encode(unsigned int code, char* out)
 {
-    if (xml->header != NULL) {
-        return xml->status = XML_STATUS_SYNTAX;
+    if (code < 0x80) {
+        out[0] = code;
+        return 1;
+    } else if (code < 0x800) {
+        out[0] = 0xC0 | (code >> 6);
+        out[1] = 0x80 | (code & 0x3F);
+        return 2;
+    } else if (code < 0x10000) {
+        out[0] = 0xE0 | (code >> 12);
+        out[1] = 0x80 | ((code >> 6) & 0x3F);
+        out[2] = 0x80 | (code & 0x3F);
+        return 3;
     }
+    out[0] = 0xF0 | (code >> 18);
+    out[1] = 0x80 | ((code >> 12) & 0x3F);
+    out[2] = 0x80 | ((code >> 6) & 0x3F);
+    out[3] = 0x80 | (code & 0x3F);
 
-    char* node = xml->extend[0];
-    if (node == NULL) {
-        return xml->status = XML_STATUS_FAULT;
+    return 4;
+}
+
+// return the length of the sequence at s, 0 if it needs more bytes, -1 if it is invalid
+static int gb18030_decode(const unsigned char* s, int size, unsigned int* code)
+{
+    if (s[0] < 0x80) {
+        *code = s[0];
+        return 1;
+    }
+    if (s[0] == 0x80 || s[0] == 0xFF) {
+        return -1;
+    }
+    if (size < 2) {
+        return 0;
+    }
+    if (s[1] >= 0x40 && s[1] <= 0xFE && s[1] != 0x7F) {
+        *code = gb18030_two_byte[(s[0] - 0x81) * 190 + s[1] - 0x40 - (s[1] > 0x7F)];
+        return *code ? 2 : -1;
+    }
+    if (s[1] < 0x30 || s[1] > 0x39) {
+        return -1;
+    }
+    if (size < 4) {
+        return size == 3 && (s[2] < 0x81 || s[2] > 0xFE) ? -1 : 0;
+    }
+    if (s[2] < 0x81 || s[2] > 0xFE || s[3] < 0x30 || s[3] > 0x39) {
+        return -1;
     }
-    int size = strlen(node);
 
-    header_t* header = NULL;
-    int i = 0;
-    for (i=0; i<size; i++) {
-        const char c = node[i];
-        if (c == ' ') {
-            if (header == NULL) {
-                header_t** pheader = &xml->header;
-                while (*pheader) {
-                    pheader = &(*pheader)->next;
-                }
-                *pheader = xml_malloc(xml, sizeof(header_t));
-                if (*pheader == NULL) {
-                    return xml->status = XML_STATUS_NO_MEMORY;
-                }
-                header = *pheader;
+    unsigned int linear = (((s[0] - 0x81) * 10 + (s[1] - 0x30)) * 126 + (s[2] - 0x81)) * 10 + (s[3] - 0x30);
+    if (linear < GB18030_BMP_LINEAR) {
+        int low = 0;
+        int high = sizeof(gb18030_ranges) / sizeof(gb18030_ranges[0]) - 1;
+        while (low < high) {
+            int middle = (low + high + 1) / 2;
+            if (gb18030_ranges[middle][0] <= linear) {
+                low = middle;
             } else {
-                header->next = xml_malloc(xml, sizeof(header_t));
-                if (header->next == NULL) {
-                    return xml->status = XML_STATUS_NO_MEMORY;
-                }
-                header = header->next;
+                high = middle - 1;
             }
-            header->name = node + i + 1;  // +1 skip ' '
-        } else if (c == '=') {
-            node[i] = '\0';
-            header->value = node + i + 2; // +2 skip '=' and '"'
-        } else if (c == '"') {
-            node[i] = '\0';
-            // do nothing
-        } else {
+        }
+        *code = gb18030_ranges[low][1] + linear - gb18030_ranges[low][0];
+    } else if (linear >= GB18030_SMP_LINEAR && linear < GB18030_SMP_LINEAR + 0x100000) {
+        *code = 0x10000 + linear - GB18030_SMP_LINEAR;
+    } else {
+        return -1;
+    }
+
+    return 4;
+}
 
+// transcode in to out, which holds at least size * 3 / 2 + 4 bytes, return the bytes written or -1
+static int gb18030_to_utf8(xml_handle_t xml, const unsigned char* in, int size, char* out)
+{
+    char* o = out;
+    unsigned int code = 0;
+    int i = 0;
+    // a sequence cut by the previous chunk is completed one byte at a time
+    while (xml->pending_size > 0 && i < size) {
+        xml->pending[xml->pending_size++] = in[i++];
+        int length = gb18030_decode(xml->pending, xml->pending_size, &code);
+        if (length < 0) {
+            xml->utf8_error = xml->encoded + i - xml->pending_size;
+            return -1;
+        } else if (length > 0) {
+            o += utf8_encode(code, o);
+            xml->pending_size = 0;
         }
     }
 
-    return xml->status = XML_STATUS_SUCCEED;
+    int plain = i;  // blocks before this one were found mixed
+    while (i < size) {
+        if (in[i] < 0x80) {
+            if (i >= plain && size - i >= UTF8_BLOCK) {
+                if (is_ascii_block((const char*)in + i)) {
+                    memcpy(o, in + i, UTF8_BLOCK);
+                    o += UTF8_BLOCK;
+                    i += UTF8_BLOCK;
+                    continue;
+                }
+                plain = i + UTF8_BLOCK;
+            }
+            *o++ = in[i++];
+            continue;
+        }
+        int length = gb18030_decode(in + i, size - i, &code);
+        if (length < 0) {
+            xml->utf8_error = xml->encoded + i;
+            return -1;
+        } else if (length == 0) {
+            memcpy(xml->pending, in + i, size - i);
+            xml->pending_size = size - i;
+            break;
+        }
+        o += utf8_encode(code, o);
+        i += length;
+    }
+    xml->encoded += size;
+
+    return o - out;
 }
 
-static int parse_name(xml_handle_t xml, element_t* element)
+// code point to GB18030, out holds 4 bytes, return the length
+static int gb18030_encode(xml_handle_t xml, unsigned int code, unsigned char* out)
 {
-    if (xml == NULL || element == NULL) {
-        return XML_STATUS_FAULT;
+    if (code < 0x80) {
+        out[0] = code;
+        return 1;
+    }
+    if (code < 0x10000 && xml->gb_reverse[code]) {
+        out[0] = xml->gb_reverse[code] >> 8;
+        out[1] = xml->gb_reverse[code] & 0xFF;
+        return 2;
     }
 
-    char* node = xml->extend[0];
-    int size = strlen(node);
-    if (node == NULL || size == 0) {
-        return XML_STATUS_FAULT;
+    unsigned int linear = 0;
+    if (code < 0x10000) {
+        int low = 0;
+        int high = sizeof(gb18030_ranges) / sizeof(gb18030_ranges[0]) - 1;
+        while (low < high) {
+            int middle = (low + high + 1) / 2;
+            if (gb18030_ranges[middle][1] <= code) {
+                low = middle;
+            } else {
+                high = middle - 1;
+            }
+        }
+        linear = gb18030_ranges[low][0] + code - gb18030_ranges[low][1];
+    } else {
+        linear = GB18030_SMP_LINEAR + code - 0x10000;
     }
-    element->name = node + 1;   // +1 skip '<'
-    attribute_t* attribute = NULL;
-    int i = 0;
-    for (i=0; i<size; i++) {
-        if ( (node[i] == '/' && node[i+1] == '>') || node[i] == '>' ) {
-            node[i] = '\0';
-            break;
-        } else if (node[i] == ' ') {
-            node[i] = '\0';
-            if (node[i+1] != ' ' && node[i+1] != '/' && node[i+1] != '>') {
-                if (attribute == NULL) {
-                    attribute_t** pattribute = &element->attributes;
-                    while (*pattribute) {
-                        pattribute = &(*pattribute)->next;
-                    }
-                    *pattribute = xml_malloc(xml, sizeof(attribute_t));
-                    if (*pattribute == NULL) {
-                        return xml->status = XML_STATUS_NO_MEMORY;
-                    }
-                    attribute = *pattribute;
-                } else {
-                    attribute->next = xml_malloc(xml, sizeof(attribute_t));
-                    if (attribute->next == NULL) {
-                        return xml->status = XML_STATUS_NO_MEMORY;
-                    }
-                    attribute = attribute->next;
-                }
-                attribute->name = node + i + 1;  // +1 skip ' '
-            }
-        } else if (node[i] == '=') {
-            node[i] = '\0';
-            attribute->value = node + i + 2; // +2 skip '=' and '"'
-        } else if (node[i] == '"') {
-            node[i] = '\0';
-            // do nothing
-        } else {
-            // do nothing
+    out[3] = 0x30 + linear % 10;
+    linear /= 10;
+    out[2] = 0x81 + linear % 126;
+    linear /= 126;
+    out[1] = 0x30 + linear % 10;
+    out[0] = 0x81 + linear / 10;
+
+    return 4;
+}
+
+// rewrite the UTF-8 output in GB18030, the result takes the place of output, the declaration
+// in its first header_size bytes names GB18030 once a character GB2312 or GBK do not hold is written
+static int output_gb18030(xml_handle_t xml, size_t header_size)
+{
+    if (xml->gb_reverse == NULL) {
+        xml->gb_reverse = heap_alloc(xml, 0x10000 * sizeof(unsigned short));
+        if (xml->gb_reverse == NULL) {
+            return xml->status = XML_STATUS_NO_MEMORY;
+        }
+        memset(xml->gb_reverse, 0x0, 0x10000 * sizeof(unsigned short));
+        int i = 0;
+        for (i=sizeof(gb18030_two_byte)/sizeof(gb18030_two_byte[0])-1; i>=0; i--) {
+            int trail = i % 190 + 0x40;
+            xml->gb_reverse[gb18030_two_byte[i]] = (0x81 + i / 190) << 8 | (trail + (trail >= 0x7F));
+        }
+    }
+    const char* declared = "GB18030";
+    header_t* header = NULL;
+    for (header=xml->header; header; header=header->next) {
+        if (header->name && header->value && strcmp(header->name, "encoding") == 0) {
+            declared = header->value;
+        }
+    }
+    // GB2312 only has two byte codes with both bytes from A1, GBK has all of them, neither has four byte codes
+    const int gb2312 = strcasecmp(declared, "GB2312") == 0;
+    const int gbk = gb2312 || strcasecmp(declared, "GBK") == 0 || strcasecmp(declared, "CP936") == 0;
+    int beyond = 0;
+
+    // a two byte character may take four bytes, U+00A5 for one, the header may grow by a few
+    size_t capacity = xml->output_size * 2 + 8;
+    if (xml->recode_capacity < capacity) {
+        char* recode = heap_realloc(xml, xml->recode, xml->recode_capacity, capacity);
+        if (recode == NULL) {
+            return xml->status = XML_STATUS_NO_MEMORY;
         }
+        xml->recode = recode;
+        xml->recode_capacity = capacity;
     }
 
-    char* name = element->name;
-    int name_size = strlen(name);
-    for (i=0; i<name_size; i++) {
-        if (name[i] == ':') {
-            name[i] = '\0';
-            element->ns = name;
-            element->name = name + i + 1;   // +1 skip ':'
+    const unsigned char* s = (const unsigned char*)xml->output;
+    const unsigned char* end = s + xml->output_size;
+    const unsigned char* plain = s;
+    unsigned char* o = (unsigned char*)xml->recode;
+    while (s < end) {
+        if (s >= plain && end - s >= UTF8_BLOCK) {
+            if (is_ascii_block((const char*)s)) {
+                memcpy(o, s, UTF8_BLOCK);
+                o += UTF8_BLOCK;
+                s += UTF8_BLOCK;
+                continue;
+            }
+            plain = s + UTF8_BLOCK;
+        }
+        unsigned int code = *s;
+        int length = 1;
+        if (code >= 0xF0 && end - s >= 4) {
+            code = (code & 0x07) << 18 | (s[1] & 0x3F) << 12 | (s[2] & 0x3F) << 6 | (s[3] & 0x3F);
+            length = 4;
+        } else if (code >= 0xE0 && end - s >= 3) {
+            code = (code & 0x0F) << 12 | (s[1] & 0x3F) << 6 | (s[2] & 0x3F);
+            length = 3;
+        } else if (code >= 0xC0 && end - s >= 2) {
+            code = (code & 0x1F) << 6 | (s[1] & 0x3F);
+            length = 2;
+        } else if (code >= 0x80) {
+            code = '?';     // not UTF-8, came in through the mutation API
+        }
+        s += length;
+        int n = gb18030_encode(xml, code, o);
+        beyond |= (n == 4 && gbk) || (n == 2 && gb2312 && (o[0] < 0xA1 || o[1] < 0xA1));
+        o += n;
+    }
+    *o = '\0';
+
+    size_t i = 0;
+    for (i=0; beyond && i+10<header_size; i++) {
+        if (strncmp(xml->recode + i, "encoding=\"", 10) == 0) {
+            char* value = xml->recode + i + 10;
+            char* quote = memchr(value, '"', header_size - i - 10);
+            if (quote) {
+                memmove(value + 7, quote, (char*)o - quote + 1);
+                memcpy(value, "GB18030", 7);
+                o += 7 - (quote - value);
+            }
+            break;
         }
     }
 
-    return xml->status = XML_STATUS_SUCCEED;
+    char* output = xml->output;
+    capacity = xml->output_capacity;
+    xml->output = xml->recode;
+    xml->output_capacity = xml->recode_capacity;
+    xml->output_size = (char*)o - xml->recode;
+    xml->recode = output;
+    xml->recode_capacity = capacity;
+
+    return XML_STATUS_SUCCEED;
 }
 
-static int parse_node(xml_handle_t xml)
+// an edit invalidates the source span of the element and of all its ancestors
+static void mark_dirty(element_t* element)
 {
-    if (xml == NULL) {
-        return xml->status = XML_STATUS_FAULT;
+    while (element && element->dirty == 0) {
+        element->dirty = 1;
+        element = element->parent;
     }
+}
 
-    char* node = xml->extend[0];
-    stack_t* stack = xml->extend[1];
-    if (stack == NULL) {
-        stack = xml_malloc(xml, sizeof(stack_t));
-        if (stack == NULL) {
-            return xml->status = XML_STATUS_NO_MEMORY;
+#define XML_NS_URI  "http://www.w3.org/XML/1998/namespace"
+
+static unsigned int hash_string(const char* s, int size)
+{
+    unsigned int hash = 2166136261u;
+    int i = 0;
+    for (i=0; i<size; i++) {
+        hash = (hash ^ (unsigned char)s[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static int atom_rehash(xml_handle_t xml, int slot_count)
+{
+    atom_table_t* table = &xml->atoms;
+    int* slots = heap_alloc(xml, slot_count * sizeof(int));
+    if (slots == NULL) {
+        return -1;
+    }
+    memset(slots, 0x0, slot_count * sizeof(int));
+    int i = 0;
+    for (i=0; i<table->count; i++) {
+        const char* str = table->strings[i];
+        unsigned int slot = hash_string(str, strlen(str)) & (slot_count - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (slot_count - 1);
         }
-        init_stack(stack);
-        xml->extend[1] = stack;
+        slots[slot] = i + 1;
     }
+    heap_free(xml, table->slots, table->slot_count * sizeof(int));
+    table->slots = slots;
+    table->slot_count = slot_count;
 
-    int size = strlen(node);
-    int type = get_node_type(node, size);
+    return 0;
+}
 
-    if (type == NODE_HEADER) {
-        parse_header(xml);
-    } else if (type == NODE_OPEN_TAG || type == NODE_SINGLE_TAG) {
-        element_t* element = xml_malloc(xml, sizeof(element_t));
-        if (element == NULL) {
-            return xml->status = XML_STATUS_NO_MEMORY;
+// return atom id of s[0, size), insert a copy when insert is set, 0 if not found, -1 if no memory
+static int atom_find(xml_handle_t xml, const char* s, int size, int insert)
+{
+    atom_table_t* table = &xml->atoms;
+    if (s == NULL) {
+        return 0;
+    }
+
+    if (table->slot_count == 0 || (table->count + 1) * 2 > table->slot_count) {
+        if (insert == 0) {
+            if (table->slot_count == 0) {
+                return 0;
+            }
+        } else if (atom_rehash(xml, table->slot_count ? table->slot_count * 2 : 64) != 0) {
+            return -1;
         }
-        memset(element, 0x0, sizeof(element_t));
-        element_t* parent = read_stack(stack);
-        if (parent) {
-            add_child(parent, element);
-        } else {
-            xml->element = element;
+    }
+
+    unsigned int slot = hash_string(s, size) & (table->slot_count - 1);
+    while (table->slots[slot]) {
+        int id = table->slots[slot];
+        const char* str = table->strings[id - 1];
+        if (strncmp(str, s, size) == 0 && str[size] == '\0') {
+            return id;
         }
-        if (type == NODE_OPEN_TAG) {
-            if (push_stack(stack, element) != 0) {
-                return xml->status = XML_STATUS_SYNTAX;
-            }
+        slot = (slot + 1) & (table->slot_count - 1);
+    }
+
+    if (insert == 0) {
+        return 0;
+    }
+
+    if (table->count == table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 32;
+        const char** strings = heap_realloc(xml, table->strings, table->capacity * sizeof(char*), capacity * sizeof(char*));
+        if (strings == NULL) {
+            return -1;
         }
-        parse_name(xml, element);
-    } else if (type == NODE_CLOSE_TAG) {
-        element_t* element = read_stack(stack);
-        if (element == NULL || element->name == NULL || strlen(element->name) == 0) {
-            return xml->status = XML_STATUS_SYNTAX;
+        table->strings = strings;
+        table->capacity = capacity;
+    }
+    char* copy = xml_alloc(xml, size + 1, 1);
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, s, size);
+    copy[size] = '\0';
+    table->strings[table->count++] = copy;
+    table->slots[slot] = table->count;
+
+    return table->count;
+}
+
+static int atom_intern(xml_handle_t xml, const char* s)
+{
+    return atom_find(xml, s, s ? strlen(s) : 0, 1);
+}
+
+static int push_binding(xml_handle_t xml, const element_t* owner, const char* prefix, int uri)
+{
+    if (xml->binding_count == xml->binding_capacity) {
+        int capacity = xml->binding_capacity ? xml->binding_capacity * 2 : 16;
+        ns_binding_t* bindings = heap_realloc(xml, xml->bindings, xml->binding_capacity * sizeof(ns_binding_t), capacity * sizeof(ns_binding_t));
+        if (bindings == NULL) {
+            return -1;
         }
-        char temp[128] = {0};
-        if (element->ns) {
-            snprintf(temp, sizeof(temp), "</%s:%s>", element->ns, element->name);
-        } else {
-            snprintf(temp, sizeof(temp), "</%s>", element->name);
+        xml->bindings = bindings;
+        xml->binding_capacity = capacity;
+    }
+
+    ns_binding_t* binding = &xml->bindings[xml->binding_count++];
+    binding->prefix = prefix;
+    binding->uri = uri;
+    binding->owner = owner;
+
+    return 0;
+}
+
+static void pop_bindings(xml_handle_t xml, const element_t* owner)
+{
+    while (xml->binding_count > 0 && xml->bindings[xml->binding_count - 1].owner == owner) {
+        xml->binding_count--;
+    }
+}
+
+// namespace of prefix[0, size) from the innermost binding: the uri atom, 0 for no namespace,
+// -1 for a prefix nothing binds, so it never matches an element without one
+static int find_binding(xml_handle_t xml, const char* prefix, int size, int* ns_id)
+{
+    int i = 0;
+    for (i=xml->binding_count-1; i>=0; i--) {
+        const char* bound = xml->bindings[i].prefix;
+        if (strncmp(bound, prefix, size) == 0 && bound[size] == '\0') {
+            *ns_id = xml->bindings[i].uri > 0 || size == 0 ? xml->bindings[i].uri : -1;
+            return XML_STATUS_SUCCEED;
         }
-        if (strcmp(node, temp) != 0) {
-            printf("\033[0;32;31m%s != %s\033[m\n", temp, node);
-            return XML_STATUS_SYNTAX;
+    }
+
+    if (size == 3 && strncmp(prefix, "xml", 3) == 0) {
+        *ns_id = atom_intern(xml, XML_NS_URI);
+        return *ns_id < 0 ? XML_STATUS_NO_MEMORY : XML_STATUS_SUCCEED;
+    }
+
+    *ns_id = size == 0 ? 0 : -1;
+    return XML_STATUS_SUCCEED;
+}
+
+static int is_xmlns(const char* name)
+{
+    return name && strncmp(name, "xmlns", 5) == 0 && (name[5] == '\0' || name[5] == ':');
+}
+
+// value of the xmlns declaration of prefix[0, size) on element itself, "" undeclares, NULL if there is none
+static const char* own_uri(const element_t* element, const char* prefix, int size)
+{
+    attribute_t* attribute = element->attributes;
+    while (attribute) {
+        const char* declared = is_xmlns(attribute->name) ? attribute->name + (attribute->name[5] ? 6 : 5) : NULL;
+        if (declared && strncmp(declared, prefix, size) == 0 && declared[size] == '\0') {
+            return attribute->value ? attribute->value : "";
         }
-        pop_stack(stack);
-    } else if (type == NODE_TEXT) {
-        element_t* element = read_stack(stack);
-        if (element == NULL) {
-            return xml->status = XML_STATUS_SYNTAX;
+        attribute = attribute->next;
+    }
+
+    return NULL;
+}
+
+// value of the innermost xmlns declaration of prefix[0, size) from element up, "" undeclares, NULL if there is none
+static const char* declared_uri(const element_t* element, const char* prefix, int size)
+{
+    const element_t* scope = element;
+    while (scope) {
+        const char* uri = own_uri(scope, prefix, size);
+        if (uri) {
+            return uri;
         }
-        element->text = node;
-    } else if (type == NODE_BLANK) {
-        // discard
-        return xml->status = XML_STATUS_SUCCEED;
-    } else {
-        return xml->status = XML_STATUS_SYNTAX;
+        scope = scope->parent;
     }
-    
-    return xml->status = XML_STATUS_SUCCEED;
+
+    return NULL;
 }
 
-static element_t* get_element(element_t* root, const char* ns, const char* name)
+// find_binding for trees built by xml_add_* and for lazy elements, the declarations are looked up
+// in the xmlns attributes of element and its ancestors
+static int find_declaration(xml_handle_t xml, const element_t* element, const char* prefix, int size, int* ns_id)
 {
-    if (root == NULL) {
-        return NULL;
+    const char* uri = declared_uri(element, prefix, size);
+    if (uri == NULL && size == 3 && strncmp(prefix, "xml", 3) == 0) {
+        uri = XML_NS_URI;
+    }
+    if (uri == NULL || uri[0] == '\0') {
+        *ns_id = size == 0 ? 0 : -1;
+        return XML_STATUS_SUCCEED;
     }
 
-    if (root->name && strcmp(name, root->name) == 0) {
-        if (ns && strlen(ns)) {
-            if (root->ns && strcmp(ns, root->ns) == 0) {
-                return root;
+    *ns_id = atom_intern(xml, uri);
+    return *ns_id < 0 ? XML_STATUS_NO_MEMORY : XML_STATUS_SUCCEED;
+}
+
+// namespace of the element's own prefix, from the declarations in the tree
+static int resolve_element(xml_handle_t xml, element_t* element)
+{
+    const char* prefix = element->ns ? element->ns : "";
+    return find_declaration(xml, element, prefix, strlen(prefix), &element->ns_id);
+}
+
+// split attribute names into prefix and local name and give them namespace and name atoms
+static int resolve_attributes(xml_handle_t xml, element_t* element, int in_tree)
+{
+    attribute_t* attribute = element->attributes;
+    while (attribute) {
+        if (attribute->name == NULL) {
+            attribute = attribute->next;
+            continue;
+        }
+        const char* colon = strchr(attribute->name, ':');
+        attribute->local = colon ? colon + 1 : attribute->name;
+        attribute->ns_id = 0;
+        if (colon && !is_xmlns(attribute->name)) {
+            int size = colon - attribute->name;
+            int status = in_tree ? find_declaration(xml, element, attribute->name, size, &attribute->ns_id)
+                : find_binding(xml, attribute->name, size, &attribute->ns_id);
+            if (status != XML_STATUS_SUCCEED) {
+                return status;
             }
-        } else {
-            return root;
         }
+        attribute->name_id = atom_intern(xml, attribute->local);
+        if (attribute->name_id < 0) {
+            return XML_STATUS_NO_MEMORY;
+        }
+        attribute = attribute->next;
     }
 
-    element_t* child = NULL;
-    if ( (child = get_element(root->children, ns, name)) != NULL ) {
-        return child;
+    return XML_STATUS_SUCCEED;
+}
+
+// the declarations in scope of top changed: resolve it and its built descendants again,
+// lazy ones not built yet resolve against the new declarations when they are
+static int resolve_subtree(xml_handle_t xml, element_t* top)
+{
+    element_t* element = top;
+    while (element) {
+        if (element->type == ELEMENT_TYPE_ELEMENT) {
+            if (resolve_element(xml, element) != XML_STATUS_SUCCEED || resolve_attributes(xml, element, 1) != XML_STATUS_SUCCEED) {
+                return XML_STATUS_NO_MEMORY;
+            }
+        }
+        if (element->children) {
+            element = element->children;
+            continue;
+        }
+        while (element != top && element->siblings == NULL) {
+            element = element->parent;
+        }
+        element = element == top ? NULL : element->siblings;
     }
 
-    return get_element(root->siblings, ns, name);
+    return XML_STATUS_SUCCEED;
 }
 
-static element_t* get_child(element_t* parent, const char* child_ns, const char* child_name)
+// called once per start tag: push its xmlns declarations, then resolve element and attribute prefixes
+static int resolve_namespace(xml_handle_t xml, element_t* element)
 {
-    element_t* child = parent->children;
-    while (child) {
-        if (strcmp(child->name, child_name) == 0) {
-            if (child_ns && strlen(child_ns)) {
-                if (child->ns && strcmp(child->ns, child_ns) == 0) {
-                    return child;
+    attribute_t* attribute = element->attributes;
+    while (attribute) {
+        if (is_xmlns(attribute->name)) {
+            const char* prefix = attribute->name[5] ? attribute->name + 6 : "";
+            int uri = 0;
+            if (attribute->value && attribute->value[0]) {
+                uri = atom_intern(xml, attribute->value);
+                if (uri < 0) {
+                    return XML_STATUS_NO_MEMORY;
                 }
+            }
+            if (push_binding(xml, element, prefix, uri) != 0) {
+                return XML_STATUS_NO_MEMORY;
+            }
+        }
+        attribute = attribute->next;
+    }
+
+    const char* prefix = element->ns ? element->ns : "";
+    if (find_binding(xml, prefix, strlen(prefix), &element->ns_id) != XML_STATUS_SUCCEED) {
+        return XML_STATUS_NO_MEMORY;
+    }
+    element->name_id = atom_intern(xml, element->name);
+    if (element->name_id < 0) {
+        return XML_STATUS_NO_MEMORY;
+    }
+
+    return resolve_attributes(xml, element, 0);
+}
+
+typedef enum
+{
+    NODE_UNKNOWN = -1,
+    NODE_HEADER = 0,
+    NODE_OPEN_TAG,
+    NODE_CLOSE_TAG,
+    NODE_SINGLE_TAG,    // <... />
+    NODE_TEXT,
+    NODE_BLANK,
+    NODE_CDATA,         // <![CDATA[...]]>
+    NODE_SKIP,          // comment, doctype
+} XML_NODE_TYPE;
+
+// '>' inside a comment or CDATA section is content, the section ends with "-->" or "]]>"
+static int is_open_section(const char* node, int size)
+{
+    if (size < 4 || node[0] != '<' || node[1] != '!') {
+        return 0;
+    }
+    if (strncmp(node, "<!--", 4) == 0) {
+        return !(size >= 6 && node[size-1] == '-' && node[size-2] == '-');
+    }
+    if (size >= 9 && strncmp(node, "<![CDATA[", 9) == 0) {
+        return !(size >= 11 && node[size-1] == ']' && node[size-2] == ']');
+    }
+
+    return 0;
+}
+
+static int get_node_type(const char* node, int size)
+{
+    if (node == NULL || size <= 0) {
+        return NODE_UNKNOWN;
+    }
+    if (node[0] == '<' && node[1] == '>') {
+        return NODE_UNKNOWN;
+    }
+
+    //printf("\033[0;32;31m node=[%s] %s,%d \033[m\n", node, __FILE__, __LINE__);
+
+    if (node[0] == '<') {
+        if (node[1] == '!') {
+            if (size >= 12 && strncmp(node, "<![CDATA[", 9) == 0) {
+                return NODE_CDATA;
+            }
+            return NODE_SKIP;
+        } else if (node[1] == '/') {
+            if (node[size-1] == '>') {
+                return NODE_CLOSE_TAG;
             } else {
-                return child;
+                return NODE_TEXT;
+            }
+        } else if (node[1] == '?' && node[size-2] == '?' && node[size-1] == '>') {
+            return NODE_HEADER;
+        } else if (node[size-1] == '>') {
+            if (node[size-2] == '/') {    // <... />
+                return NODE_SINGLE_TAG;
+            }
+            return NODE_OPEN_TAG;
+        } else {
+            return NODE_TEXT;
+        }
+    } else {
+        int i = 0;
+        for (i=0; i<size; i++) {
+            if (isspace(node[i]) == 0) {
+                return NODE_TEXT;
             }
         }
+        return NODE_BLANK;
+    }
+}
+
+// the children changed, the index memory stays for the next build
+static void drop_child_index(element_t* parent)
+{
+    if (parent->index) {
+        parent->index->stale = 1;
+    }
+}
+
+static void free_child_index(element_t* parent)
+{
+    child_index_t* index = parent->index;
+    if (index) {
+        xml_handle_t xml = parent->owner;
+        if (index->prev) {
+            index->prev->next = index->next;
+        } else {
+            xml->child_indexes = index->next;
+        }
+        if (index->next) {
+            index->next->prev = index->prev;
+        }
+        heap_free(xml, index, index->size);
+        parent->index = NULL;
+    }
+}
+
+static void free_attribute(xml_handle_t xml, attribute_t* attribute)
+{
+    xml_recycle_string(xml, attribute->name, attribute->owned & OWN_NAME);
+    xml_recycle_string(xml, attribute->value, attribute->owned & OWN_VALUE);
+    xml_recycle(xml, attribute, sizeof(attribute_t));
+}
+
+// recycle a detached subtree, names, values and text included
+static void free_subtree(xml_handle_t xml, element_t* root)
+{
+    element_t* element = root;
+    while (element) {
+        element_t* next = NULL;
+        if (element->children) {
+            // free children first, come back here when the last one is done
+            next = element->children;
+            element->children = NULL;
+            element = next;
+            continue;
+        }
+
+        next = element == root ? NULL : (element->siblings ? element->siblings : element->parent);
+        if (element->entry && xml->lazy) {
+            xml->lazy[element->entry - 1].element = NULL;
+        }
+        free_child_index(element);
+        if (element->type == ELEMENT_TYPE_TEXT) {
+            xml_recycle_string(xml, element->text, element->owned & OWN_VALUE);
+        } else {
+            xml_recycle_string(xml, element->ns, element->owned & OWN_NS);
+            if ((element->owned & OWN_ATOM) == 0) {
+                xml_recycle_string(xml, element->name, element->owned & OWN_NAME);
+            }
+            attribute_t* attribute = element->attributes;
+            while (attribute) {
+                attribute_t* next_attribute = attribute->next;
+                free_attribute(xml, attribute);
+                attribute = next_attribute;
+            }
+        }
+        xml_recycle(xml, element, sizeof(element_t));
+        element = next;
+    }
+}
+
+static int add_child(element_t* parent, element_t* child)
+{
+    if (parent == NULL || child == NULL) {
+        return -1;
+    }
+    drop_child_index(parent);
+    if (parent->last == child) {   // 防止重复添加
+        return 0;
+    }
+    child->parent = parent;
+    child->prev = parent->last;
+    if (parent->last) {
+        parent->last->siblings = child;
+    } else {
+        parent->children = child;
+    }
+    parent->last = child;
+
+    return 0;
+}
+
+static int is_blank(const char* text)
+{
+    while (text && *text) {
+        if (isspace((unsigned char)*text) == 0) {
+            return 0;
+        }
+        text++;
+    }
+
+    return 1;
+}
+
+static int is_blank_span(const char* s, int size)
+{
+    int i = 0;
+    for (i=0; i<size; i++) {
+        if (!isspace((unsigned char)s[i])) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static const char* find_span(const char* s, const char* end, const char* pattern)
+{
+    size_t size = strlen(pattern);
+    while (s + size <= end) {
+        if (memcmp(s, pattern, size) == 0) {
+            return s;
+        }
+        s++;
+    }
+
+    return NULL;
+}
+
+static element_t* new_element(xml_handle_t xml, int type)
+{
+    element_t* element = xml_malloc(xml, sizeof(element_t));
+    if (element == NULL) {
+        return NULL;
+    }
+    memset(element, 0x0, sizeof(element_t));
+    element->type = type;
+    element->owner = xml;
+    STAT(xml->stats.nodes++;)
+
+    return element;
+}
+
+// text segments are children without name, so "<a>x<b/>y</a>" keeps both x and y in order
+static element_t* add_text(xml_handle_t xml, element_t* parent, char* text)
+{
+    if (parent == NULL || text == NULL) {
+        return NULL;
+    }
+
+    element_t* node = new_element(xml, ELEMENT_TYPE_TEXT);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->text = text;
+    add_child(parent, node);
+
+    // element->text is the first segment, but real text wins over leading blanks
+    if (parent->text == NULL || (is_blank(parent->text) && !is_blank(text))) {
+        parent->text = text;
+    }
+
+    return node;
+}
+
+// the limit goes to the error as what was expected
+static int limit_error(xml_handle_t xml, const char* limit, size_t value)
+{
+    clear_error(xml);
+    snprintf(xml->error.expected, sizeof(xml->error.expected), "%s %lu", limit, (unsigned long)value);
+
+    return xml->status = XML_STATUS_LIMIT;
+}
+
+static int is_close_tag(const char* node, const element_t* element)
+{
+    const char* s = node + 2;   // skip "</"
+    if (element->ns) {
+        size_t ns_size = strlen(element->ns);
+        if (strncmp(s, element->ns, ns_size) != 0 || s[ns_size] != ':') {
+            return 0;
+        }
+        s += ns_size + 1;
+    }
+    size_t name_size = strlen(element->name);
+
+    return strncmp(s, element->name, name_size) == 0 && s[name_size] == '>' && s[name_size + 1] == '\0';
+}
+
+static int parse_header(xml_handle_t xml)
+{
+    if (xml->header != NULL) {
+        return xml->status = XML_STATUS_SYNTAX;
+    }
+
+    char* node = xml->extend[0];
+    if (node == NULL) {
+        return xml->status = XML_STATUS_FAULT;
+    }
+    int size = strlen(node);
+
+    header_t* header = NULL;
+    int i = 0;
+    for (i=0; i<size; i++) {
+        const char c = node[i];
+        if (c == ' ') {
+            if (header == NULL) {
+                header_t** pheader = &xml->header;
+                while (*pheader) {
+                    pheader = &(*pheader)->next;
+                }
+                *pheader = xml_malloc(xml, sizeof(header_t));
+                if (*pheader == NULL) {
+                    return xml->status = XML_STATUS_NO_MEMORY;
+                }
+                header = *pheader;
+                memset(header, 0x0, sizeof(header_t));
+            } else {
+                header->next = xml_malloc(xml, sizeof(header_t));
+                if (header->next == NULL) {
+                    return xml->status = XML_STATUS_NO_MEMORY;
+                }
+                header = header->next;
+                memset(header, 0x0, sizeof(header_t));
+            }
+            header->name = node + i + 1;  // +1 skip ' '
+        } else if (c == '=' && header != NULL) {
+            node[i] = '\0';
+            header->value = i + 1 < size ? node + i + 2 : node + size; // +2 skip '=' and '"'
+        } else if (c == '"') {
+            node[i] = '\0';
+            // do nothing
+        } else {
+
+        }
+    }
+
+    // GB family input is transcoded to UTF-8, any other declared encoding is passed through unchecked
+    for (header=xml->header; header; header=header->next) {
+        if (header->name == NULL || header->value == NULL || strcmp(header->name, "encoding") != 0) {
+            continue;
+        }
+        if (strcasecmp(header->value, "GB2312") == 0 || strcasecmp(header->value, "GBK") == 0
+            || strcasecmp(header->value, "GB18030") == 0 || strcasecmp(header->value, "CP936") == 0) {
+            xml->encoding = ENCODING_GB18030;
+            xml->utf8_skip = 1;
+        } else if (strcasecmp(header->value, "UTF-8") != 0 && strcasecmp(header->value, "UTF8") != 0) {
+            xml->utf8_skip = 1;
+        }
+    }
+
+    return xml->status = XML_STATUS_SUCCEED;
+}
+
+static int parse_name(xml_handle_t xml, element_t* element)
+{
+    if (xml == NULL || element == NULL) {
+        return XML_STATUS_FAULT;
+    }
+
+    char* node = xml->extend[0];
+    int size = node ? strlen(node) : 0;
+    if (size == 0) {
+        return XML_STATUS_FAULT;
+    }
+    element->name = node + 1;   // +1 skip '<'
+    attribute_t* attribute = NULL;
+    int attributes = 0;
+    int i = 0;
+    for (i=0; i<size; i++) {
+        if ( (node[i] == '/' && node[i+1] == '>') || node[i] == '>' ) {
+            node[i] = '\0';
+            break;
+        } else if (node[i] == ' ') {
+            node[i] = '\0';
+            if (node[i+1] != ' ' && node[i+1] != '/' && node[i+1] != '>') {
+                if (attribute == NULL) {
+                    attribute_t** pattribute = &element->attributes;
+                    while (*pattribute) {
+                        pattribute = &(*pattribute)->next;
+                    }
+                    *pattribute = xml_malloc(xml, sizeof(attribute_t));
+                    if (*pattribute == NULL) {
+                        return xml->status = XML_STATUS_NO_MEMORY;
+                    }
+                    attribute = *pattribute;
+                    memset(attribute, 0x0, sizeof(attribute_t));
+                    STAT(xml->stats.attributes++;)
+                } else {
+                    if (xml->limits.max_attributes && attributes >= xml->limits.max_attributes) {
+                        return limit_error(xml, "max_attributes", xml->limits.max_attributes);
+                    }
+                    attribute->next = xml_malloc(xml, sizeof(attribute_t));
+                    if (attribute->next == NULL) {
+                        return xml->status = XML_STATUS_NO_MEMORY;
+                    }
+                    attribute = attribute->next;
+                    memset(attribute, 0x0, sizeof(attribute_t));
+                    STAT(xml->stats.attributes++;)
+                }
+                attributes++;
+                attribute->name = node + i + 1;  // +1 skip ' '
+            }
+        } else if (node[i] == '=' && attribute != NULL) {
+            node[i] = '\0';
+            attribute->value = i + 1 < size ? node + i + 2 : node + size; // +2 skip '=' and '"'
+        } else if (node[i] == '"') {
+            node[i] = '\0';
+            // do nothing
+        } else {
+            // do nothing
+        }
+    }
+
+    char* name = element->name;
+    int name_size = strlen(name);
+    if (xml->limits.max_name_length || xml->limits.max_text_length) {
+        if (xml->limits.max_name_length && name_size > xml->limits.max_name_length) {
+            return limit_error(xml, "max_name_length", xml->limits.max_name_length);
+        }
+        for (attribute=element->attributes; attribute; attribute=attribute->next) {
+            if (xml->limits.max_name_length && (int)strlen(attribute->name) > xml->limits.max_name_length) {
+                return limit_error(xml, "max_name_length", xml->limits.max_name_length);
+            }
+            if (xml->limits.max_text_length && attribute->value && (int)strlen(attribute->value) > xml->limits.max_text_length) {
+                return limit_error(xml, "max_text_length", xml->limits.max_text_length);
+            }
+        }
+    }
+    for (i=0; i<name_size; i++) {
+        if (name[i] == ':') {
+            name[i] = '\0';
+            element->ns = name;
+            element->name = name + i + 1;   // +1 skip ':'
+        }
+    }
+
+    return xml->status = resolve_namespace(xml, element);
+}
+
+// end tag against the start tag name in the source, the element of entry has not been built
+static int is_close_entry(xml_handle_t xml, const char* node, const lazy_entry_t* entry)
+{
+    const char* name = xml->source + entry->begin + 1;  // +1 skip '<'
+    size_t size = strlen(node) - 3;     // without "</" and ">"
+    if (strncmp(name, node + 2, size) != 0) {
+        return 0;
+    }
+
+    return name[size] == '>' || name[size] == '/' || isspace((unsigned char)name[size]);
+}
+
+// bytes up to where parse_name would end the name or value at s
+static int segment_size(const char* s)
+{
+    const char* p = s;
+    while (*p && *p != ' ' && *p != '=' && *p != '"' && *p != '>' && !(*p == '/' && p[1] == '>')) {
+        p++;
+    }
+
+    return p - s;
+}
+
+// attribute names of a tag token, split as parse_name splits them, 0 after the last one
+static int next_attribute(const char* node, int size, int i)
+{
+    for (i=i+1; i<size; i++) {
+        if ((node[i] == '/' && node[i+1] == '>') || node[i] == '>') {
+            break;
+        }
+        if (node[i] == ' ' && node[i+1] != ' ' && node[i+1] != '/' && node[i+1] != '>') {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+// what parse_name does to a tag that is only indexed: check the per-tag limits, then intern the namespace uris,
+// the local name and the attribute names in its order, so ids are there before the element is built and
+// match those of an eager parse, the token is left as is
+static int index_tag(xml_handle_t xml, const char* node, int size)
+{
+    const xml_limits_t* limits = &xml->limits;
+    int name_size = segment_size(node + 1);
+    if (limits->max_name_length && name_size > limits->max_name_length) {
+        return limit_error(xml, "max_name_length", limits->max_name_length);
+    }
+
+    int fixed[32];  // attribute name offsets, a longer tag is scanned again for the rest
+    int count = 0;
+    int i = 0;
+    for (i=next_attribute(node, size, 0); i>0; i=next_attribute(node, size, i)) {
+        if (limits->max_attributes && count >= limits->max_attributes) {
+            return limit_error(xml, "max_attributes", limits->max_attributes);
+        }
+        if (count < (int)(sizeof(fixed) / sizeof(fixed[0]))) {
+            fixed[count] = i;
+        }
+        count++;
+        int attribute_size = segment_size(node + i);
+        if (limits->max_name_length && attribute_size > limits->max_name_length) {
+            return limit_error(xml, "max_name_length", limits->max_name_length);
+        }
+        int xmlns = strncmp(node + i, "xmlns", 5) == 0 && (attribute_size == 5 || node[i + 5] == ':');
+        if ((limits->max_text_length || xmlns) && node[i + attribute_size] == '=' && i + attribute_size + 2 < size) {
+            const char* value = node + i + attribute_size + 2;
+            int value_size = segment_size(value);
+            if (limits->max_text_length && value_size > limits->max_text_length) {
+                return limit_error(xml, "max_text_length", limits->max_text_length);
+            }
+            if (xmlns && value_size > 0 && atom_find(xml, value, value_size, 1) < 0) {
+                return xml->status = XML_STATUS_NO_MEMORY;
+            }
+        }
+    }
+
+    const char* local = node + 1;
+    for (i=0; i<name_size; i++) {
+        if (node[1 + i] == ':') {
+            local = node + 2 + i;
+        }
+    }
+    if (atom_find(xml, local, node + 1 + name_size - local, 1) < 0) {
+        return xml->status = XML_STATUS_NO_MEMORY;
+    }
+    int k = 0;
+    for (i=count ? fixed[0] : 0; k<count; k++) {
+        if (k >= (int)(sizeof(fixed) / sizeof(fixed[0]))) {
+            i = next_attribute(node, size, i);
+        } else {
+            i = fixed[k];
+        }
+        int attribute_size = segment_size(node + i);
+        const char* colon = memchr(node + i, ':', attribute_size);
+        const char* name = colon ? colon + 1 : node + i;
+        if (atom_find(xml, name, node + i + attribute_size - name, 1) < 0) {
+            return xml->status = XML_STATUS_NO_MEMORY;
+        }
+    }
+
+    return XML_STATUS_SUCCEED;
+}
+
+// XML_OPTION_LAZY: record where each element starts and ends instead of building it,
+// only the document element is built here, everything below it waits for lazy_expand
+static int index_node(xml_handle_t xml)
+{
+    char* node = xml->extend[0];
+    int size = strlen(node);
+    const char* arena = xml->arena;
+    size_t used = xml->arena_used;
+    int type = get_node_type(node, size);
+    int parent = xml->lazy_depth > 0 ? xml->lazy_open[xml->lazy_depth - 1] : -1;
+    if (xml->limits.max_nodes && xml->nodes >= xml->limits.max_nodes
+        && (type == NODE_OPEN_TAG || type == NODE_SINGLE_TAG || type == NODE_CDATA || type == NODE_TEXT)) {
+        return limit_error(xml, "max_nodes", xml->limits.max_nodes);
+    }
+
+    if (type == NODE_HEADER) {
+        return parse_header(xml);
+    } else if (type == NODE_OPEN_TAG || type == NODE_SINGLE_TAG) {
+        if (xml->limits.max_depth && xml->lazy_depth >= xml->limits.max_depth) {
+            return limit_error(xml, "max_depth", xml->limits.max_depth);
+        }
+        // the document element goes through parse_name below
+        if (parent >= 0 && index_tag(xml, node, size) != XML_STATUS_SUCCEED) {
+            return xml->status;
+        }
+        if (xml->lazy_count == xml->lazy_capacity) {
+            int capacity = xml->lazy_capacity ? xml->lazy_capacity * 2 : 1024;
+            lazy_entry_t* lazy = heap_realloc(xml, xml->lazy, xml->lazy_capacity * sizeof(lazy_entry_t), capacity * sizeof(lazy_entry_t));
+            if (lazy == NULL) {
+                return xml->status = XML_STATUS_NO_MEMORY;
+            }
+            xml->lazy = lazy;
+            xml->lazy_capacity = capacity;
+        }
+        int k = xml->lazy_count++;
+        lazy_entry_t* entry = &xml->lazy[k];
+        entry->begin = xml->token_begin;
+        entry->content = xml->token_end;
+        entry->end = type == NODE_SINGLE_TAG ? xml->token_end : 0;
+        entry->parent = parent;
+        entry->next = type == NODE_SINGLE_TAG ? k + 1 : 0;
+        entry->element = NULL;
+        xml->nodes++;
+
+        if (type == NODE_OPEN_TAG) {
+            if (xml->lazy_depth == xml->lazy_open_capacity) {
+                int capacity = xml->lazy_open_capacity ? xml->lazy_open_capacity * 2 : STACK_SIZE;
+                int* open = heap_realloc(xml, xml->lazy_open, xml->lazy_open_capacity * sizeof(int), capacity * sizeof(int));
+                if (open == NULL) {
+                    return xml->status = XML_STATUS_NO_MEMORY;
+                }
+                xml->lazy_open = open;
+                xml->lazy_open_capacity = capacity;
+            }
+            xml->lazy_open[xml->lazy_depth++] = k;
+        }
+
+        if (parent < 0) {
+            // the document element is built right away, every lookup starts there, its names stay in the token
+            element_t* element = new_element(xml, ELEMENT_TYPE_ELEMENT);
+            if (element == NULL) {
+                return xml->status = XML_STATUS_NO_MEMORY;
+            }
+            if (parse_name(xml, element) != XML_STATUS_SUCCEED) {
+                return xml->status;
+            }
+            // it has no ancestors, so nothing else ever resolves against its bindings
+            pop_bindings(xml, element);
+            element->src_begin = entry->begin;
+            element->src_end = entry->end;
+            element->entry = k + 1;
+            element->lazy = type == NODE_OPEN_TAG;
+            entry->element = element;
+            xml->element = element;
+            return xml->status = XML_STATUS_SUCCEED;
+        }
+    } else if (type == NODE_CLOSE_TAG) {
+        if (parent < 0) {
+            return xml->status = XML_STATUS_SYNTAX;
+        }
+        lazy_entry_t* entry = &xml->lazy[parent];
+        if (!is_close_entry(xml, node, entry)) {
+            const char* name = xml->source + entry->begin + 1;
+            int name_size = 0;
+            while (name[name_size] != '>' && name[name_size] != '/' && !isspace((unsigned char)name[name_size])) {
+                name_size++;
+            }
+            clear_error(xml);
+            snprintf(xml->error.expected, sizeof(xml->error.expected), "</%.*s>", name_size, name);
+            return xml->status = XML_STATUS_SYNTAX;
+        }
+        entry->end = xml->token_end;
+        entry->next = xml->lazy_count;
+        if (entry->element) {
+            entry->element->src_end = entry->end;
+        }
+        xml->lazy_depth--;
+    } else if (type == NODE_CDATA) {
+        if (parent < 0) {
+            return xml->status = XML_STATUS_SYNTAX;
+        }
+        if (xml->limits.max_text_length && size - 12 > xml->limits.max_text_length) {
+            return limit_error(xml, "max_text_length", xml->limits.max_text_length);
+        }
+        xml->nodes++;
+    } else if (type == NODE_TEXT || type == NODE_BLANK) {
+        if (type == NODE_TEXT && parent < 0) {
+            return xml->status = XML_STATUS_SYNTAX;
+        }
+        if (parent >= 0 && (type == NODE_TEXT || (xml->options & XML_OPTION_KEEP_BLANK))) {
+            xml->nodes++;
+        }
+    } else if (type != NODE_SKIP) {
+        return xml->status = XML_STATUS_SYNTAX;
+    }
+
+    // nothing points into the token, the next one takes its bytes, unless new atoms were copied after it
+    if (xml->arena == arena && xml->arena_used == used) {
+        xml->arena_used = node - xml->arena;
+    }
+
+    return xml->status = XML_STATUS_SUCCEED;
+}
+
+static int parse_node(xml_handle_t xml)
+{
+    if (xml == NULL) {
+        return XML_STATUS_FAULT;
+    }
+
+    // the source is kept from the first byte on, the index points into it
+    if ((xml->options & XML_OPTION_LAZY) && xml->source) {
+        return index_node(xml);
+    }
+
+    char* node = xml->extend[0];
+    stack_t* stack = xml->extend[1];
+    if (stack == NULL) {
+        stack = xml_malloc(xml, sizeof(stack_t));
+        if (stack == NULL) {
+            return xml->status = XML_STATUS_NO_MEMORY;
+        }
+        init_stack(stack);
+        xml->extend[1] = stack;
+    }
+
+    int size = strlen(node);
+    int type = get_node_type(node, size);
+    if (xml->limits.max_nodes && xml->nodes >= xml->limits.max_nodes
+        && (type == NODE_OPEN_TAG || type == NODE_SINGLE_TAG || type == NODE_CDATA || type == NODE_TEXT)) {
+        return limit_error(xml, "max_nodes", xml->limits.max_nodes);
+    }
+
+    if (type == NODE_HEADER) {
+        parse_header(xml);
+    } else if (type == NODE_OPEN_TAG || type == NODE_SINGLE_TAG) {
+        if (xml->limits.max_depth && stack->header + 1 >= xml->limits.max_depth) {
+            return limit_error(xml, "max_depth", xml->limits.max_depth);
+        }
+        element_t* element = new_element(xml, ELEMENT_TYPE_ELEMENT);
+        if (element == NULL) {
+            return xml->status = XML_STATUS_NO_MEMORY;
+        }
+        element->src_begin = xml->token_begin;
+        if (type == NODE_SINGLE_TAG) {
+            element->src_end = xml->token_end;
+        }
+        // linked only once its tag parsed, a rejected tag leaves no half built element in the tree
+        if (parse_name(xml, element) != XML_STATUS_SUCCEED) {
+            return xml->status;
+        }
+        element_t* parent = read_stack(stack);
+        if (parent) {
+            add_child(parent, element);
+        } else {
+            xml->element = element;
+        }
+        xml->nodes++;
+        if (type == NODE_OPEN_TAG) {
+            if (push_stack(xml, stack, element) != 0) {
+                return xml->status = XML_STATUS_NO_MEMORY;
+            }
+            STAT(if (stack->header + 1 > xml->stats.max_depth) xml->stats.max_depth = stack->header + 1;)
+        }
+        if (type == NODE_SINGLE_TAG) {
+            pop_bindings(xml, element);
+        }
+    } else if (type == NODE_CLOSE_TAG) {
+        element_t* element = read_stack(stack);
+        if (element == NULL || element->name == NULL || strlen(element->name) == 0) {
+            return xml->status = XML_STATUS_SYNTAX;
+        }
+        if (!is_close_tag(node, element)) {
+            clear_error(xml);
+            if (element->ns) {
+                snprintf(xml->error.expected, sizeof(xml->error.expected), "</%s:%s>", element->ns, element->name);
+            } else {
+                snprintf(xml->error.expected, sizeof(xml->error.expected), "</%s>", element->name);
+            }
+            return xml->status = XML_STATUS_SYNTAX;
+        }
+        pop_stack(stack);
+        pop_bindings(xml, element);
+        element->src_end = xml->token_end;
+    } else if (type == NODE_CDATA) {
+        element_t* element = read_stack(stack);
+        if (element == NULL) {
+            return xml->status = XML_STATUS_SYNTAX;
+        }
+        node[size - 3] = '\0';     // cut "]]>"
+        if (xml->limits.max_text_length && size - 12 > xml->limits.max_text_length) {
+            return limit_error(xml, "max_text_length", xml->limits.max_text_length);
+        }
+        if (node[9] != '\0' && add_text(xml, element, node + 9) == NULL) {
+            return xml->status = XML_STATUS_NO_MEMORY;
+        }
+        xml->nodes++;
+    } else if (type == NODE_SKIP) {
+        return xml->status = XML_STATUS_SUCCEED;
+    } else if (type == NODE_TEXT || type == NODE_BLANK) {
+        element_t* element = read_stack(stack);
+        if (type == NODE_BLANK && (element == NULL || (xml->options & XML_OPTION_KEEP_BLANK) == 0)) {
+            // discard
+            return xml->status = XML_STATUS_SUCCEED;
+        }
+        if (element == NULL) {
+            return xml->status = XML_STATUS_SYNTAX;
+        }
+        if (add_text(xml, element, node) == NULL) {
+            return xml->status = XML_STATUS_NO_MEMORY;
+        }
+        xml->nodes++;
+    } else {
+        return xml->status = XML_STATUS_SYNTAX;
+    }
+    
+    return xml->status = XML_STATUS_SUCCEED;
+}
+
+// build the element of entry k from its start tag in the source, as parse_node would have
+static element_t* lazy_element(xml_handle_t xml, int k, element_t* parent)
+{
+    lazy_entry_t* entry = &xml->lazy[k];
+    const char* tag = xml->source + entry->begin;
+    size_t size = entry->content - entry->begin;
+    char* node = xml_malloc(xml, size + 1);
+    element_t* element = new_element(xml, ELEMENT_TYPE_ELEMENT);
+    if (node == NULL || element == NULL) {
+        xml->status = XML_STATUS_NO_MEMORY;
+        return NULL;
+    }
+    // the tokenizer drops line breaks inside tags
+    size_t i = 0;
+    size_t n = 0;
+    for (i=0; i<size; i++) {
+        if (tag[i] != '\r' && tag[i] != '\n') {
+            node[n++] = tag[i];
+        }
+    }
+    node[n] = '\0';
+
+    void* token = xml->extend[0];
+    xml->extend[0] = node;
+    int status = parse_name(xml, element);
+    xml->extend[0] = token;
+    pop_bindings(xml, element);
+    if (status != XML_STATUS_SUCCEED) {
+        return NULL;
+    }
+
+    // the binding stack does not hold the ancestors here, resolve against their declarations,
+    // an element declaring nothing with the prefix of its parent is in the same namespace
+    add_child(parent, element);
+    int declares = 0;
+    attribute_t* attribute = NULL;
+    for (attribute=element->attributes; attribute; attribute=attribute->next) {
+        declares |= is_xmlns(attribute->name);
+    }
+    if (!declares && (element->ns == parent->ns || (element->ns && parent->ns && strcmp(element->ns, parent->ns) == 0))) {
+        element->ns_id = parent->ns_id;
+    } else if (resolve_element(xml, element) != XML_STATUS_SUCCEED) {
+        xml->status = XML_STATUS_NO_MEMORY;
+        return NULL;
+    }
+    if (resolve_attributes(xml, element, 1) != XML_STATUS_SUCCEED) {
+        xml->status = XML_STATUS_NO_MEMORY;
+        return NULL;
+    }
+    element->src_begin = entry->begin;
+    element->src_end = entry->end;
+    element->entry = k + 1;
+    element->lazy = entry->content < entry->end;
+    entry->element = element;
+
+    return element;
+}
+
+// text or CDATA content [s, s + size) as the tokenizer would have left it
+static int lazy_text(xml_handle_t xml, element_t* parent, const char* s, size_t size, int cdata)
+{
+    const int keep_blank = xml->options & XML_OPTION_KEEP_BLANK;
+    if (!cdata && !keep_blank && is_blank_span(s, size)) {
+        return XML_STATUS_SUCCEED;
+    }
+
+    char* text = xml_malloc(xml, size + 1);
+    if (text == NULL) {
+        return xml->status = XML_STATUS_NO_MEMORY;
+    }
+    size_t i = 0;
+    size_t n = 0;
+    for (i=0; i<size; i++) {
+        if (s[i] != '\r' && (s[i] != '\n' || keep_blank || cdata)) {
+            text[n++] = s[i];
+        }
+    }
+    text[n] = '\0';
+    if (n == 0) {
+        xml_recycle(xml, text, size + 1);
+        return XML_STATUS_SUCCEED;
+    }
+    if (add_text(xml, parent, text) == NULL) {
+        return xml->status = XML_STATUS_NO_MEMORY;
+    }
+
+    return XML_STATUS_SUCCEED;
+}
+
+// build the direct children of an element left unexpanded by XML_OPTION_LAZY: child elements come
+// from the index, the text between them is cut out of the source, comments are skipped
+static int lazy_expand(element_t* element)
+{
+    if (element == NULL || element->lazy == 0) {
+        return XML_STATUS_SUCCEED;
+    }
+
+    xml_handle_t xml = element->owner;
+    int k = element->entry - 1;
+    if (xml->lazy == NULL || xml->lazy[k].end == 0) {
+        return XML_STATUS_SUCCEED;  // still open, its children are not all in yet
+    }
+
+    const char* source = xml->source;
+    size_t end = xml->lazy[k].end;
+    size_t i = xml->lazy[k].content;
+    int child = k + 1;
+    int status = XML_STATUS_SUCCEED;
+    while (i < end && status == XML_STATUS_SUCCEED) {
+        if (child < xml->lazy_count && xml->lazy[child].begin == i) {
+            if (lazy_element(xml, child, element) == NULL) {
+                status = XML_STATUS_NO_MEMORY;
+                break;
+            }
+            i = xml->lazy[child].end;
+            child = xml->lazy[child].next;
+        } else if (source[i] == '<') {
+            if (source[i+1] == '/') {
+                break;  // its own end tag
+            }
+            int cdata = strncmp(source + i, "<![CDATA[", 9) == 0;
+            const char* close = strncmp(source + i, "<!--", 4) == 0 ? "-->" : (cdata ? "]]>" : ">");
+            const char* stop = find_span(source + i + 1, source + end, close);
+            if (stop == NULL) {
+                break;
+            }
+            if (cdata) {
+                status = lazy_text(xml, element, source + i + 9, stop - source - i - 9, 1);
+            }
+            i = stop - source + strlen(close);
+        } else {
+            size_t j = i;
+            while (j < end && source[j] != '<') {
+                j++;
+            }
+            status = lazy_text(xml, element, source + i, j - i, 0);
+            i = j;
+        }
+    }
+
+    if (status != XML_STATUS_SUCCEED) {
+        // all or nothing, the element stays unexpanded and a later access tries again
+        element_t* node = element->children;
+        while (node) {
+            element_t* next = node->siblings;
+            free_subtree(xml, node);
+            node = next;
+        }
+        drop_child_index(element);
+        element->children = element->last = NULL;
+        element->text = NULL;
+        return out_of_memory(xml);
+    }
+    element->lazy = 0;
+
+    return XML_STATUS_SUCCEED;
+}
+
+// element of entry k, built level by level from its closest built ancestor, NULL if it was removed
+static element_t* lazy_materialize(xml_handle_t xml, int k)
+{
+    while (xml->lazy[k].element == NULL) {
+        int j = k;
+        while (xml->lazy[j].parent >= 0 && xml->lazy[xml->lazy[j].parent].element == NULL) {
+            j = xml->lazy[j].parent;
+        }
+        element_t* parent = xml->lazy[j].parent >= 0 ? xml->lazy[xml->lazy[j].parent].element : NULL;
+        if (parent == NULL || parent->lazy == 0) {
+            return NULL;    // the parent has all its children, so this one is gone
+        }
+        if (lazy_expand(parent) != XML_STATUS_SUCCEED || parent->lazy) {
+            return NULL;
+        }
+    }
+
+    return xml->lazy[k].element;
+}
+
+// document order through the index: only names are compared in the source, just matches get built
+static element_t* lazy_find(element_t* root, const char* ns, const char* name, int ns_id, int name_id)
+{
+    STAT(double begin = stat_now(); unsigned long visited = 0;)
+
+    xml_handle_t xml = root->owner;
+    int k = root->entry - 1;
+    int last = xml->lazy[k].next ? xml->lazy[k].next : xml->lazy_count;
+    const char* local = name ? name : xml_get_atom(xml, name_id);
+    size_t local_size = local ? strlen(local) : 0;
+    element_t* found = NULL;
+    while (k < last && found == NULL) {
+        STAT(visited++;)
+        const char* s = xml->source + xml->lazy[k].begin + 1;   // +1 skip '<'
+        size_t size = 0;
+        while (s[size] != '>' && s[size] != '/' && !isspace((unsigned char)s[size])) {
+            size++;
+        }
+        const char* colon = memchr(s, ':', size);
+        if (colon) {
+            size -= colon + 1 - s;
+            s = colon + 1;
+        }
+        if (size == local_size && memcmp(s, local, size) == 0) {
+            element_t* element = lazy_materialize(xml, k);
+            if (element == NULL) {
+                k = xml->lazy[k].next ? xml->lazy[k].next : last;   // removed with its subtree
+                continue;
+            }
+            if (name == NULL) {
+                if (element->ns_id == ns_id) {
+                    found = element;
+                }
+            } else if (ns == NULL || strlen(ns) == 0 || (element->ns && strcmp(ns, element->ns) == 0)) {
+                found = element;
+            }
+        }
+        k++;
+    }
+
+    STAT(stat_lookup(xml, visited, begin);)
+    return found;
+}
+
+// next element or text node in document order, without leaving the subtree of top
+static element_t* next_preorder(const element_t* top, element_t* element)
+{
+    if (element->lazy) {
+        lazy_expand(element);
+    }
+    if (element->children) {
+        return element->children;
+    }
+    while (element && element != top) {
+        if (element->siblings) {
+            return element->siblings;
+        }
+        element = element->parent;
+    }
+
+    return NULL;
+}
+
+static element_t* get_element(element_t* root, const char* ns, const char* name)
+{
+    if (root && root->entry && root->owner->lazy && !root->owner->lazy_changed) {
+        return lazy_find(root, ns, name, 0, 0);
+    }
+
+    STAT(double begin = stat_now(); unsigned long visited = 0;)
+
+    // document order without recursion, a long sibling list must not grow the call stack
+    element_t* element = root;
+    while (element) {
+        STAT(visited++;)
+        if (element->name && strcmp(name, element->name) == 0) {
+            if (ns && strlen(ns)) {
+                if (element->ns && strcmp(ns, element->ns) == 0) {
+                    break;
+                }
+            } else {
+                break;
+            }
+        }
+        element = next_preorder(root, element);
+    }
+
+    STAT(if (root) stat_lookup(root->owner, visited, begin);)
+    return element;
+}
+
+static element_t* get_child(element_t* parent, const char* child_ns, const char* child_name)
+{
+    STAT(double begin = stat_now(); unsigned long visited = 0;)
+
+    lazy_expand(parent);
+    element_t* child = parent->children;
+    while (child) {
+        STAT(visited++;)
+        if (child->type == ELEMENT_TYPE_ELEMENT && strcmp(child->name, child_name) == 0) {
+            if (child_ns && strlen(child_ns)) {
+                if (child->ns && strcmp(child->ns, child_ns) == 0) {
+                    break;
+                }
+            } else {
+                break;
+            }
+        }
+
+        child = child->siblings;
+    }
+
+    STAT(stat_lookup(parent->owner, visited, begin);)
+    return child;
+}
+
+static element_t* get_element_ns(element_t* root, int ns_id, int name_id)
+{
+    if (root && root->entry && root->owner->lazy && !root->owner->lazy_changed) {
+        return lazy_find(root, NULL, NULL, ns_id, name_id);
+    }
+
+    STAT(double begin = stat_now(); unsigned long visited = 0;)
+
+    element_t* element = root;
+    while (element) {
+        STAT(visited++;)
+        if (element->name_id == name_id && element->ns_id == ns_id && element->type == ELEMENT_TYPE_ELEMENT) {
+            break;
+        }
+        element = next_preorder(root, element);
+    }
+
+    STAT(if (root) stat_lookup(root->owner, visited, begin);)
+    return element;
+}
+
+static int child_position(const child_index_t* index, const element_t* child)
+{
+    int slot = ((size_t)child >> 4) * 2654435761u & index->mask;
+    while (index->keys[slot]) {
+        if (index->keys[slot] == child) {
+            return index->positions[slot];
+        }
+        slot = (slot + 1) & index->mask;
+    }
+
+    return -1;
+}
+
+// element children of parent by position, chained by local name, built on first use
+static child_index_t* get_child_index(element_t* parent)
+{
+    if (parent->index && parent->index->stale == 0) {
+        return parent->index;
+    }
+    if (lazy_expand(parent) != XML_STATUS_SUCCEED) {
+        return NULL;
+    }
+
+    xml_handle_t xml = parent->owner;
+    int count = 0;
+    element_t* child = NULL;
+    for (child=parent->children; child; child=child->siblings) {
+        count += child->type == ELEMENT_TYPE_ELEMENT;
+    }
+
+    child_index_t* index = parent->index;
+    if (index == NULL || index->capacity < count) {
+        int capacity = 16;
+        while (capacity < count) {
+            capacity *= 2;
+        }
+        int slot_count = capacity * 2;
+        size_t size = sizeof(child_index_t) + capacity * (sizeof(element_t*) + sizeof(int))
+            + slot_count * (sizeof(element_t*) + 3 * sizeof(int));
+        index = heap_alloc(xml, size);
+        if (index == NULL) {
+            out_of_memory(xml);
+            return NULL;
+        }
+        free_child_index(parent);
+        memset(index, 0x0, sizeof(child_index_t));
+        char* p = (char*)(index + 1);
+        index->children = (element_t**)p;
+        p += capacity * sizeof(element_t*);
+        index->keys = (element_t**)p;
+        p += slot_count * sizeof(element_t*);
+        index->next_named = (int*)p;
+        p += capacity * sizeof(int);
+        index->positions = (int*)p;
+        p += slot_count * sizeof(int);
+        index->last = (int*)p;
+        index->size = size;
+        index->capacity = capacity;
+        index->mask = slot_count - 1;
+        index->next = xml->child_indexes;
+        if (index->next) {
+            index->next->prev = index;
+        }
+        xml->child_indexes = index;
+        parent->index = index;
+    }
+    index->count = count;
+    index->stale = 0;
+    memset(index->keys, 0x0, (index->mask + 1) * sizeof(element_t*));
+
+    int i = 0;
+    for (child=parent->children; child; child=child->siblings) {
+        if (child->type != ELEMENT_TYPE_ELEMENT) {
+            continue;
+        }
+        int slot = ((size_t)child >> 4) * 2654435761u & index->mask;
+        while (index->keys[slot]) {
+            slot = (slot + 1) & index->mask;
+        }
+        index->keys[slot] = child;
+        index->positions[slot] = i;
+        index->children[i++] = child;
+    }
+
+    int* last = index->last;
+    memset(last, 0x0, (index->mask + 1) * 2 * sizeof(int));
+    for (i=count-1; i>=0; i--) {
+        int name_id = index->children[i]->name_id;
+        int slot = (unsigned int)name_id * 2654435761u & index->mask;
+        while (last[slot * 2] && last[slot * 2] != name_id) {
+            slot = (slot + 1) & index->mask;
+        }
+        index->next_named[i] = last[slot * 2] ? last[slot * 2 + 1] : -1;
+        last[slot * 2] = name_id;
+        last[slot * 2 + 1] = i;
+    }
+
+    return index;
+}
+
+static attribute_t* get_attribute(element_t* element, const char* attribute_name)
+{
+    if (element == NULL || attribute_name == NULL || strlen(attribute_name) == 0) {
+        return NULL;
+    }
+
+    attribute_t* attributes = element->attributes;
+    while (attributes) {
+        if (attributes->name && strcmp(attributes->name, attribute_name) == 0) {
+            return attributes;
+        }
+        attributes = attributes->next;
+    }
+
+    return NULL;
+}
+
+static element_t* add_element(xml_handle_t xml, element_t* parent, const char* ns, const char* name, const char* text)
+{
+    if (name == NULL || strlen(name) == 0) {
+        return NULL;
+    }
+
+    element_t* element = new_element(xml, ELEMENT_TYPE_ELEMENT);
+    if (element == NULL) {
+        return NULL;
+    }
+    element->dirty = 1;
+    if (xml->element == NULL) {
+        xml->element = element;
+    }
+
+    if (ns && strlen(ns)) {
+        element->ns = xml_strdup2(xml, ns);
+    }
+    element->name = xml_strdup2(xml, name);
+    element->owned = OWN_NS | OWN_NAME;
+    if (text && strlen(text)) {
+        element_t* node = add_text(xml, element, xml_strdup2(xml, text));
+        if (node) {
+            node->owned = OWN_VALUE;
+        }
+    }
+    
+    if (parent) {
+        add_child(parent, element);
+        mark_dirty(parent);
+        xml->lazy_changed = 1;
+    }
+
+    element->name_id = atom_intern(xml, element->name);
+    if (element->name_id < 0 || resolve_element(xml, element) != XML_STATUS_SUCCEED) {
+        return NULL;
+    }
+
+    return element;
+}
+
+static attribute_t* add_attribute(xml_handle_t xml, element_t* element, const char* name, const char* value)
+{
+    if (element == NULL || name == NULL || strlen(name)==0 || value == NULL || strlen(value)==0) {
+        return NULL;
+    }
+
+    attribute_t** attribute = &element->attributes;
+    while (*attribute) {
+        attribute = &(*attribute)->next;
+    }
+    *attribute = xml_malloc(xml, sizeof(attribute_t));
+    if (*attribute == NULL) {
+        return NULL;
+    }
+    memset(*attribute, 0x0, sizeof(attribute_t));
+    STAT(xml->stats.attributes++;)
+    (*attribute)->name = xml_strdup2(xml, name);
+    (*attribute)->value = xml_strdup2(xml, value);
+    (*attribute)->owned = OWN_NAME | OWN_VALUE;
+    mark_dirty(element);
+
+    // a new declaration may bind prefixes anywhere below
+    int status = is_xmlns(name) ? resolve_subtree(xml, element) : resolve_attributes(xml, element, 1);
+    if (status != XML_STATUS_SUCCEED) {
+        return NULL;
+    }
+
+    return *attribute;
+}
+
+// element->text follows the first segment, real text wins over leading blanks
+static void update_text(element_t* element)
+{
+    element->text = NULL;
+    element_t* child = element->children;
+    while (child) {
+        if (child->type == ELEMENT_TYPE_TEXT) {
+            if (!is_blank(child->text)) {
+                element->text = child->text;
+                return;
+            }
+            if (element->text == NULL) {
+                element->text = child->text;
+            }
+        }
+        child = child->siblings;
+    }
+}
+
+static void unlink_node(element_t* node)
+{
+    element_t* parent = node->parent;
+    if (parent == NULL) {
+        if (node->owner && node->owner->element == node) {
+            node->owner->element = NULL;
+        }
+        return;
+    }
+
+    drop_child_index(parent);
+    if (node->prev) {
+        node->prev->siblings = node->siblings;
+    } else {
+        parent->children = node->siblings;
+    }
+    if (node->siblings) {
+        node->siblings->prev = node->prev;
+    } else {
+        parent->last = node->prev;
+    }
+    node->parent = node->prev = node->siblings = NULL;
+
+    mark_dirty(parent);
+    if (node->type == ELEMENT_TYPE_TEXT && parent->text == node->text) {
+        update_text(parent);
+    }
+}
+
+// link a detached node before ref, or as last child of parent when ref is NULL
+static int link_node(element_t* parent, element_t* ref, element_t* node)
+{
+    // a node can not move into its own subtree
+    const element_t* ancestor = parent;
+    while (ancestor) {
+        if (ancestor == node) {
+            return XML_STATUS_FAULT;
+        }
+        ancestor = ancestor->parent;
+    }
+    // the parsed children must be in before the new one is placed among them
+    if (lazy_expand(parent) != XML_STATUS_SUCCEED) {
+        return XML_STATUS_NO_MEMORY;
+    }
+
+    unlink_node(node);
+    if (ref == NULL) {
+        add_child(parent, node);
+    } else {
+        drop_child_index(parent);
+        node->parent = parent;
+        node->prev = ref->prev;
+        node->siblings = ref;
+        if (ref->prev) {
+            ref->prev->siblings = node;
+        } else {
+            parent->children = node;
+        }
+        ref->prev = node;
+    }
+    mark_dirty(parent);
+
+    if (node->type == ELEMENT_TYPE_TEXT) {
+        if (parent->text == NULL || is_blank(parent->text)) {
+            update_text(parent);
+        }
+    } else {
+        node->owner->lazy_changed = 1;
+        // prefixes in the moved subtree now resolve against the new ancestors
+        if (resolve_subtree(node->owner, node) != XML_STATUS_SUCCEED) {
+            return XML_STATUS_NO_MEMORY;
+        }
+    }
+
+    return XML_STATUS_SUCCEED;
+}
+
+static const char* format_value(XML_VALUE_TYPE type, const void* value, char* tmp, int size)
+{
+    if (value == NULL) {
+        return NULL;
+    }
+
+    if (type == XML_VALUE_TYPE_INT) {
+        snprintf(tmp, size, "%d", *((int*)value));
+        return tmp;
+    } else if (type == XML_VALUE_TYPE_FLOAT) {
+        snprintf(tmp, size, "%f", *((float*)value));
+        return tmp;
+    }
+
+    return value;
+}
+
+static int out_write(xml_handle_t xml, const char* data, size_t size)
+{
+    if (xml->output_size + size + 1 > xml->output_capacity) {
+        size_t capacity = xml->output_capacity ? xml->output_capacity : 4096;
+        while (xml->output_size + size + 1 > capacity) {
+            capacity *= 2;
+        }
+        char* output = heap_realloc(xml, xml->output, xml->output_capacity, capacity);
+        if (output == NULL) {
+            return xml->status = XML_STATUS_NO_MEMORY;
+        }
+        xml->output = output;
+        xml->output_capacity = capacity;
+    }
+
+    memcpy(xml->output + xml->output_size, data, size);
+    xml->output_size += size;
+    xml->output[xml->output_size] = '\0';
+
+    return XML_STATUS_SUCCEED;
+}
+
+static int out_puts(xml_handle_t xml, const char* s)
+{
+    if (s == NULL) {
+        return XML_STATUS_SUCCEED;
+    }
+
+    return out_write(xml, s, strlen(s));
+}
+
+static int out_indent(xml_handle_t xml, int depth)
+{
+    int ret = out_write(xml, "\n", 1);
+    while (ret == XML_STATUS_SUCCEED && depth-- > 0) {
+        ret = out_write(xml, "  ", 2);
+    }
+
+    return ret;
+}
+
+// "&name;" or "&#...;" is kept, parsed text stores references undecoded
+static int is_reference(const char* s)
+{
+    int i = 1;
+    if (s[i] == '#') {
+        i++;
+    }
+    while (isalnum((unsigned char)s[i])) {
+        i++;
+    }
+
+    return i > 1 && s[i] == ';';
+}
+
+// character a predefined or character reference at s stands for, UTF-8 encoded into out,
+// 0 for a named reference only a DTD could define
+static int decode_reference(const char* s, char* out)
+{
+    static const char* names[] = {"lt;", "gt;", "amp;", "quot;", "apos;"};
+    static const char codes[] = "<>&\"'";
+    if (s[1] != '#') {
+        int i = 0;
+        for (i=0; i<5; i++) {
+            if (strncmp(s + 1, names[i], strlen(names[i])) == 0) {
+                out[0] = codes[i];
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    int hex = s[2] == 'x';
+    unsigned long code = 0;
+    const char* p = s + 2 + hex;
+    for (; *p != ';' && code <= 0x10FFFF; p++) {
+        if (isdigit((unsigned char)*p)) {
+            code = code * (hex ? 16 : 10) + (*p - '0');
+        } else if (hex && isxdigit((unsigned char)*p)) {
+            code = code * 16 + (tolower((unsigned char)*p) - 'a' + 10);
+        } else {
+            return 0;
+        }
+    }
+    if (code == 0 || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF)) {
+        return 0;
+    }
+
+    return utf8_encode(code, out);
+}
+
+// runs of plain bytes are copied at once, only special characters break the run,
+// canonical output decodes references and escapes what they stand for, so every spelling of a character is written alike
+static int out_escape(xml_handle_t xml, const char* s, size_t size, int attribute, int mode)
+{
+    const char* run = s;
+    const char* end = s + size;
+    while (s < end) {
+        const char* entity = NULL;
+        const char c = *s;
+        const int reference = c == '&' && s + 1 < end && is_reference(s);
+        if (reference && mode == XML_SERIALIZE_CANONICAL) {
+            char decoded[4];
+            int n = decode_reference(s, decoded);
+            if (n > 0) {
+                if (out_write(xml, run, s - run) != XML_STATUS_SUCCEED || out_escape(xml, decoded, n, attribute, mode) != XML_STATUS_SUCCEED) {
+                    return xml->status;
+                }
+                s = strchr(s, ';') + 1;
+                run = s;
+                continue;
+            }
+        }
+        if (c == '<') {
+            entity = "&lt;";
+        } else if (c == '&' && !reference) {
+            entity = "&amp;";
+        } else if (c == '"' && attribute) {
+            entity = "&quot;";
+        } else if (mode == XML_SERIALIZE_CANONICAL) {
+            if (c == '>' && !attribute) {
+                entity = "&gt;";
+            } else if (c == '\r') {
+                entity = "&#xD;";
+            } else if (c == '\t' && attribute) {
+                entity = "&#x9;";
+            } else if (c == '\n' && attribute) {
+                entity = "&#xA;";
+            }
+        }
+        if (entity) {
+            if (out_write(xml, run, s - run) != XML_STATUS_SUCCEED || out_puts(xml, entity) != XML_STATUS_SUCCEED) {
+                return xml->status;
+            }
+            run = s + 1;
+        }
+        s++;
+    }
+
+    return out_write(xml, run, s - run);
+}
+
+static int out_text(xml_handle_t xml, const char* s, int attribute, int mode)
+{
+    if (s == NULL) {
+        return XML_STATUS_SUCCEED;
+    }
+
+    return out_escape(xml, s, strlen(s), attribute, mode);
+}
+
+// drop leading and trailing blanks, collapse inner runs to one space, words go out whole so no reference is cut
+static int out_normalized(xml_handle_t xml, const char* s, int mode)
+{
+    int words = 0;
+    while (*s) {
+        const char* word = s;
+        while (*s && !isspace((unsigned char)*s)) {
+            s++;
+        }
+        if (s > word) {
+            if ((words++ && out_write(xml, " ", 1) != XML_STATUS_SUCCEED) || out_escape(xml, word, s - word, 0, mode) != XML_STATUS_SUCCEED) {
+                return xml->status;
+            }
+        }
+        while (*s && isspace((unsigned char)*s)) {
+            s++;
+        }
+    }
+
+    return XML_STATUS_SUCCEED;
+}
+
+static int serialize_header(xml_handle_t xml, header_t* header)
+{
+    if (xml == NULL || header == NULL) {
+        return XML_STATUS_FAULT;
+    }
+    out_puts(xml, "<?xml");
+    header_t* temp_header = header;
+    while (temp_header) {
+        // "<?xml version="1.0" ?>" leaves an entry without value
+        if (temp_header->name && temp_header->value) {
+            out_puts(xml, " ");
+            out_puts(xml, temp_header->name);
+            out_puts(xml, "=\"");
+            // transcoded input is written as UTF-8 unless asked to keep its encoding
+            if (xml->encoding != ENCODING_UTF8 && (xml->options & XML_OPTION_KEEP_ENCODING) == 0 && strcmp(temp_header->name, "encoding") == 0) {
+                out_puts(xml, "UTF-8");
+            } else {
+                out_puts(xml, temp_header->value);
+            }
+            out_puts(xml, "\"");
+        }
+        temp_header = temp_header->next;
+    }
+
+    return out_puts(xml, "?>");
+}
+
+static int has_element_child(const element_t* element)
+{
+    const element_t* child = element->children;
+    while (child && child->type == ELEMENT_TYPE_TEXT) {
+        child = child->siblings;
+    }
+
+    return child != NULL;
+}
+
+// canonical order: default declaration, other declarations by prefix, then attributes by (uri, local name)
+static int compare_attribute(xml_handle_t xml, const attribute_t* a, const attribute_t* b)
+{
+    int a_xmlns = is_xmlns(a->name);
+    int b_xmlns = is_xmlns(b->name);
+    if (a_xmlns != b_xmlns) {
+        return b_xmlns - a_xmlns;
+    }
+    if (a_xmlns) {
+        return strcmp(a->name, b->name);
+    }
+
+    const char* a_uri = a->ns_id > 0 ? xml->atoms.strings[a->ns_id - 1] : "";
+    const char* b_uri = b->ns_id > 0 ? xml->atoms.strings[b->ns_id - 1] : "";
+    int ret = strcmp(a_uri, b_uri);
+    if (ret != 0) {
+        return ret;
+    }
+
+    return strcmp(a->local ? a->local : a->name, b->local ? b->local : b->name);
+}
+
+static int serialize_attributes(xml_handle_t xml, element_t* element, int mode)
+{
+    attribute_t* fixed[32];
+    attribute_t** sorted = fixed;
+    int count = 0;
+    attribute_t* attribute = element->attributes;
+
+    if (mode == XML_SERIALIZE_CANONICAL) {
+        for (attribute = element->attributes; attribute; attribute = attribute->next) {
+            count++;
+        }
+        if (count > (int)(sizeof(fixed) / sizeof(fixed[0]))) {
+            sorted = heap_alloc(xml, count * sizeof(attribute_t*));
+            if (sorted == NULL) {
+                return xml->status = XML_STATUS_NO_MEMORY;
+            }
+        }
+        // insertion sort, elements rarely carry more than a handful of attributes
+        int i = 0;
+        for (attribute = element->attributes; attribute; attribute = attribute->next) {
+            int j = i++;
+            while (j > 0 && compare_attribute(xml, sorted[j - 1], attribute) > 0) {
+                sorted[j] = sorted[j - 1];
+                j--;
+            }
+            sorted[j] = attribute;
+        }
+    }
+
+    int i = 0;
+    attribute = mode == XML_SERIALIZE_CANONICAL ? (count ? sorted[0] : NULL) : element->attributes;
+    while (attribute) {
+        if (attribute->name) {
+            out_puts(xml, " ");
+            out_puts(xml, attribute->name);
+            out_puts(xml, "=\"");
+            out_text(xml, attribute->value, 1, mode);
+            out_puts(xml, "\"");
+        }
+        if (mode == XML_SERIALIZE_CANONICAL) {
+            attribute = ++i < count ? sorted[i] : NULL;
+        } else {
+            attribute = attribute->next;
+        }
+    }
+
+    if (sorted != fixed) {
+        heap_free(xml, sorted, count * sizeof(attribute_t*));
+    }
+
+    return xml->status;
+}
+
+static int serialize_tag(xml_handle_t xml, element_t* element, int close)
+{
+    out_puts(xml, close ? "</" : "<");
+    if (element->ns) {
+        out_puts(xml, element->ns);
+        out_puts(xml, ":");
+    }
+    out_puts(xml, element->name);
+
+    return close ? out_puts(xml, ">") : XML_STATUS_SUCCEED;
+}
+
+// one streaming pass in document order, parent links replace recursion so deep or long documents are safe
+static int serialize_element(xml_handle_t xml, element_t* root, int mode)
+{
+    element_t* element = root;
+    int depth = 0;
+
+    xml->status = XML_STATUS_SUCCEED;
+    while (element && xml->status == XML_STATUS_SUCCEED) {
+        if (element->type == ELEMENT_TYPE_TEXT) {
+            if (mode == XML_SERIALIZE_COMPACT) {
+                out_text(xml, element->text, 0, mode);
+            } else if (!is_blank(element->text)) {
+                // mixed content gets its own line in indent mode, text only elements stay verbatim
+                if (mode == XML_SERIALIZE_INDENT && has_element_child(element->parent)) {
+                    out_indent(xml, depth);
+                    out_normalized(xml, element->text, mode);
+                } else if (mode == XML_SERIALIZE_CANONICAL) {
+                    out_normalized(xml, element->text, mode);
+                } else {
+                    out_text(xml, element->text, 0, mode);
+                }
+            }
+        } else if (mode == XML_SERIALIZE_COMPACT && xml->source && element->dirty == 0 && element->src_end > element->src_begin) {
+            // untouched subtree, copy its original bytes instead of walking it
+            out_write(xml, xml->source + element->src_begin, element->src_end - element->src_begin);
+        } else {
+            if (mode == XML_SERIALIZE_INDENT) {
+                out_indent(xml, depth);
+            }
+            serialize_tag(xml, element, 0);
+            serialize_attributes(xml, element, mode);
+            out_puts(xml, ">");
+            if (lazy_expand(element) != XML_STATUS_SUCCEED) {
+                break;
+            }
+            if (element->children) {
+                element = element->children;
+                depth++;
+                continue;
+            }
+            serialize_tag(xml, element, 1);
+        }
+
+        // climb up, closing every parent whose last child is done
+        while (element != root && element->siblings == NULL) {
+            element = element->parent;
+            depth--;
+            if (mode == XML_SERIALIZE_INDENT && has_element_child(element)) {
+                out_indent(xml, depth);
+            }
+            serialize_tag(xml, element, 1);
+        }
+        element = element == root ? NULL : element->siblings;
+    }
+
+    return xml->status;
+}
+
+typedef struct snapshot_slot_t
+{
+    const void* key;
+    size_t  offset;
+} snapshot_slot_t;
+
+// pointer -> image offset while saving, open addressing
+typedef struct snapshot_map_t
+{
+    snapshot_slot_t* slots;
+    size_t  mask;
+    size_t  strings;    // end of the string pool placed so far
+} snapshot_map_t;
+
+static size_t snapshot_find(const snapshot_map_t* map, const void* key)
+{
+    size_t slot = (size_t)(((unsigned long long)(size_t)key >> 3) * 0x9E3779B97F4A7C15ULL) & map->mask;
+    while (map->slots[slot].key && map->slots[slot].key != key) {
+        slot = (slot + 1) & map->mask;
+    }
+
+    return slot;
+}
+
+static void snapshot_record(snapshot_map_t* map, const void* key, size_t offset)
+{
+    size_t slot = snapshot_find(map, key);
+    map->slots[slot].key = key;
+    map->slots[slot].offset = offset;
+}
+
+// a string shared by several fields, like element text and its first segment, is stored once
+static void snapshot_string(snapshot_map_t* map, const char* s)
+{
+    if (s) {
+        size_t slot = snapshot_find(map, s);
+        if (map->slots[slot].key == NULL) {
+            map->slots[slot].key = s;
+            map->slots[slot].offset = map->strings;
+            map->strings += strlen(s) + 1;
+        }
+    }
+}
+
+static void* snapshot_offset(const snapshot_map_t* map, const void* key)
+{
+    return key ? (void*)map->slots[snapshot_find(map, key)].offset : NULL;
+}
+
+static void* snapshot_copy(const snapshot_map_t* map, char* image, const char* s)
+{
+    if (s == NULL) {
+        return NULL;
+    }
+    size_t offset = map->slots[snapshot_find(map, s)].offset;
+    memcpy(image + offset, s, strlen(s) + 1);
+
+    return (void*)offset;
+}
+
+// offset stored in field must hit a record of [begin, end) on a size boundary, 0 stays NULL
+static void* snapshot_pointer(char* image, const void* field, size_t begin, size_t end, size_t size, int* status)
+{
+    size_t offset = (size_t)field;
+    if (offset == 0) {
+        return NULL;
+    }
+    if (offset < begin || offset >= end || (offset - begin) % size != 0) {
+        *status = XML_STATUS_FAULT;
+        return NULL;
+    }
+
+    return image + offset;
+}
+
+// a loaded image is trusted no further than its offsets: ids must fall in the atom table, types must be known
+// and the links must form one tree, parents, siblings and last agreeing, so the preorder walks end
+static int snapshot_check(const snapshot_t* snapshot, element_t* root, header_t* header)
+{
+    long long atoms = (long long)snapshot->atom_count;
+    size_t elements = 0;
+    size_t attributes = 0;
+    if (root && (root->parent || root->siblings || root->prev)) {
+        return XML_STATUS_FAULT;
+    }
+    element_t* element = NULL;
+    for (element=root; element; element=next_preorder(NULL, element)) {
+        if (++elements > snapshot->element_count) {
+            return XML_STATUS_FAULT;
+        }
+        if (element->type == ELEMENT_TYPE_TEXT) {
+            if (element->text == NULL || element->children || element->attributes) {
+                return XML_STATUS_FAULT;
+            }
+        } else if (element->type != ELEMENT_TYPE_ELEMENT || element->name == NULL) {
+            return XML_STATUS_FAULT;
+        }
+        if (element->ns_id < -1 || element->ns_id > atoms || element->name_id < -1 || element->name_id > atoms) {
+            return XML_STATUS_FAULT;
+        }
+        attribute_t* attribute = NULL;
+        for (attribute=element->attributes; attribute; attribute=attribute->next) {
+            if (++attributes > snapshot->attribute_count || attribute->name == NULL
+                || attribute->ns_id < -1 || attribute->ns_id > atoms || attribute->name_id < -1 || attribute->name_id > atoms) {
+                return XML_STATUS_FAULT;
+            }
+        }
+        // every child is reached from its parent before the walk enters it
+        element_t* prev = NULL;
+        element_t* child = NULL;
+        size_t children = 0;
+        for (child=element->children; child; child=child->siblings) {
+            if (++children > snapshot->element_count || child->parent != element || child->prev != prev) {
+                return XML_STATUS_FAULT;
+            }
+            prev = child;
+        }
+        if (element->last != prev) {
+            return XML_STATUS_FAULT;
+        }
+    }
+    size_t headers = 0;
+    for (; header; header=header->next) {
+        if (++headers > snapshot->header_count || header->name == NULL) {
+            return XML_STATUS_FAULT;
+        }
+    }
+
+    return elements == snapshot->element_count && attributes == snapshot->attribute_count ? XML_STATUS_SUCCEED : XML_STATUS_FAULT;
+}
+
+static int snapshot_rebase(xml_handle_t xml, char* image, size_t size)
+{
+    snapshot_t* snapshot = (snapshot_t*)image;
+    if (memcmp(snapshot->magic, SNAPSHOT_MAGIC, sizeof(snapshot->magic)) != 0
+        || snapshot->version != SNAPSHOT_VERSION || snapshot->order != SNAPSHOT_ORDER
+        || snapshot->pointer_size != sizeof(void*) || snapshot->element_size != sizeof(element_t)
+        || snapshot->attribute_size != sizeof(attribute_t) || snapshot->header_size != sizeof(header_t)) {
+        return XML_STATUS_FAULT;
+    }
+    // counts are bounded by the file before any multiplication, then the sections must follow each other
+    if (snapshot->image_size != size || image[size - 1] != '\0'
+        || snapshot->element_count > size / sizeof(element_t) || snapshot->attribute_count > size / sizeof(attribute_t)
+        || snapshot->header_count > size / sizeof(header_t) || snapshot->atom_count > size / sizeof(unsigned long long)
+        || snapshot->elements != sizeof(snapshot_t)
+        || snapshot->attributes != snapshot->elements + snapshot->element_count * sizeof(element_t)
+        || snapshot->headers != snapshot->attributes + snapshot->attribute_count * sizeof(attribute_t)
+        || snapshot->atoms != snapshot->headers + snapshot->header_count * sizeof(header_t)
+        || snapshot->strings != snapshot->atoms + snapshot->atom_count * sizeof(unsigned long long)
+        || snapshot->strings > size) {
+        return XML_STATUS_FAULT;
+    }
+
+    int status = XML_STATUS_SUCCEED;
+    size_t strings = snapshot->strings;
+    size_t elements_end = snapshot->attributes;
+    size_t attributes_end = snapshot->headers;
+    size_t headers_end = snapshot->atoms;
+    element_t* element = (element_t*)(image + snapshot->elements);
+    size_t i = 0;
+    for (i=0; i<snapshot->element_count; i++, element++) {
+        element->ns = snapshot_pointer(image, element->ns, strings, size, 1, &status);
+        element->name = snapshot_pointer(image, element->name, strings, size, 1, &status);
+        element->text = snapshot_pointer(image, element->text, strings, size, 1, &status);
+        element->attributes = snapshot_pointer(image, element->attributes, snapshot->attributes, attributes_end, sizeof(attribute_t), &status);
+        element->parent = snapshot_pointer(image, element->parent, snapshot->elements, elements_end, sizeof(element_t), &status);
+        element->children = snapshot_pointer(image, element->children, snapshot->elements, elements_end, sizeof(element_t), &status);
+        element->last = snapshot_pointer(image, element->last, snapshot->elements, elements_end, sizeof(element_t), &status);
+        element->siblings = snapshot_pointer(image, element->siblings, snapshot->elements, elements_end, sizeof(element_t), &status);
+        element->prev = snapshot_pointer(image, element->prev, snapshot->elements, elements_end, sizeof(element_t), &status);
+        element->owner = xml;
+        // whatever the file holds in the fields that are not saved, they start out as after a parse without source
+        element->src_begin = element->src_end = 0;
+        element->dirty = element->owned = 0;
+        element->entry = element->lazy = 0;
+        element->index = NULL;
+    }
+    attribute_t* attribute = (attribute_t*)(image + snapshot->attributes);
+    for (i=0; i<snapshot->attribute_count; i++, attribute++) {
+        attribute->name = snapshot_pointer(image, attribute->name, strings, size, 1, &status);
+        attribute->value = snapshot_pointer(image, attribute->value, strings, size, 1, &status);
+        attribute->local = snapshot_pointer(image, attribute->local, strings, size, 1, &status);
+        attribute->next = snapshot_pointer(image, attribute->next, snapshot->attributes, attributes_end, sizeof(attribute_t), &status);
+        attribute->owned = 0;
+    }
+    header_t* header = (header_t*)(image + snapshot->headers);
+    for (i=0; i<snapshot->header_count; i++, header++) {
+        header->name = snapshot_pointer(image, header->name, strings, size, 1, &status);
+        header->value = snapshot_pointer(image, header->value, strings, size, 1, &status);
+        header->next = snapshot_pointer(image, header->next, snapshot->headers, headers_end, sizeof(header_t), &status);
+    }
+    xml->element = snapshot_pointer(image, (void*)(size_t)snapshot->root, snapshot->elements, elements_end, sizeof(element_t), &status);
+    xml->header = snapshot_pointer(image, (void*)(size_t)snapshot->header, snapshot->headers, headers_end, sizeof(header_t), &status);
+    if (status != XML_STATUS_SUCCEED) {
+        return status;
+    }
+    if (snapshot_check(snapshot, xml->element, xml->header) != XML_STATUS_SUCCEED) {
+        return XML_STATUS_FAULT;
+    }
+
+    // atom strings stay in the image, only the lookup table is rebuilt
+    atom_table_t* table = &xml->atoms;
+    if (snapshot->atom_count > 0) {
+        if (snapshot->atom_count > 0x10000000) {
+            return XML_STATUS_FAULT;
+        }
+        table->strings = heap_alloc(xml, snapshot->atom_count * sizeof(char*));
+        if (table->strings == NULL) {
+            return XML_STATUS_NO_MEMORY;
+        }
+        table->capacity = snapshot->atom_count;
+        const unsigned long long* atoms = (const unsigned long long*)(image + snapshot->atoms);
+        for (i=0; i<snapshot->atom_count; i++) {
+            table->strings[i] = snapshot_pointer(image, (void*)(size_t)atoms[i], strings, size, 1, &status);
+            if (table->strings[i] == NULL) {
+                return XML_STATUS_FAULT;
+            }
+        }
+        table->count = snapshot->atom_count;
+        int slot_count = 64;
+        while (slot_count < (table->count + 1) * 2) {
+            slot_count *= 2;
+        }
+        if (atom_rehash(xml, slot_count) != 0) {
+            return XML_STATUS_NO_MEMORY;
+        }
+    }
+
+    return XML_STATUS_SUCCEED;
+}
+
+static int bind_step(const bind_t* bind, int from, const char* name, int size)
+{
+    unsigned int slot = (hash_string(name, size) ^ (from * 0x9E3779B1u)) & bind->edge_mask;
+    while (bind->edges[slot].to) {
+        const bind_edge_t* edge = &bind->edges[slot];
+        if (edge->from == from && edge->size == size && memcmp(edge->name, name, size) == 0) {
+            return edge->to;
+        }
+        slot = (slot + 1) & bind->edge_mask;
+    }
+
+    return -1;
+}
+
+// follow path from state, adding the missing edges, return the last state
+static int bind_add_path(bind_t* bind, int state, char* path, int* depth)
+{
+    char* segment = path;
+    while (segment && *segment) {
+        char* end = strchr(segment, '/');
+        if (end) {
+            *end = '\0';
+        }
+        int size = strlen(segment);
+        if (size > 0) {
+            int to = bind_step(bind, state, segment, size);
+            if (to < 0) {
+                unsigned int slot = (hash_string(segment, size) ^ (state * 0x9E3779B1u)) & bind->edge_mask;
+                while (bind->edges[slot].to) {
+                    slot = (slot + 1) & bind->edge_mask;
+                }
+                to = bind->state_count++;
+                bind->edges[slot].from = state;
+                bind->edges[slot].name = segment;
+                bind->edges[slot].size = size;
+                bind->edges[slot].to = to;
+            }
+            state = to;
+            (*depth)++;
+        }
+        segment = end ? end + 1 : NULL;
+    }
+
+    return state;
+}
+
+static void bind_store(const bind_field_t* field, char* record, const char* value, int size)
+{
+    char* target = record + field->offset;
+    if (field->type == XML_VALUE_TYPE_TEXT) {
+        if (field->size == 0) {
+            return;
+        }
+        // line breaks are dropped like the tokenizer does, the rest is truncated to the field
+        size_t used = 0;
+        int i = 0;
+        for (i=0; i<size && used+1<field->size; i++) {
+            if (value[i] != '\r' && value[i] != '\n') {
+                target[used++] = value[i];
+            }
+        }
+        target[used] = '\0';
+    } else {
+        char temp[64];
+        int length = size < (int)sizeof(temp) - 1 ? size : (int)sizeof(temp) - 1;
+        memcpy(temp, value, length);
+        temp[length] = '\0';
+        if (field->type == XML_VALUE_TYPE_INT) {
+            int number = atoi(temp);
+            memcpy(target, &number, sizeof(int));
+        } else {
+            float number = atof(temp);
+            memcpy(target, &number, sizeof(float));
+        }
+    }
+}
+
+static void print_header(const header_t* header)
+{
+    if (header == NULL) {
+        return;
+    }
+
+    const header_t* tmp = header;
+    while (tmp) {
+        if (tmp->name) {
+            printf("hader_name:%s\n", tmp->name);
+        }
+        if (tmp->value) {
+            printf("header_value:%s\n", tmp->value);
+        }
+        tmp = tmp->next;
+    }
+
+    return;
+}
+
+static void print_element(element_t* element)
+{
+    while (element && element->type == ELEMENT_TYPE_TEXT) {
+        element = element->siblings;
+    }
+
+    if (element){
+        printf("\n");
+        if (element->ns)
+            printf("ns:\t\t[%s]\n", element->ns);
+        if (element->name)
+            printf("name:\t\t[%s]\n", element->name);
+        if (element->text)
+            printf("text:\t\t[%s]\n", element->text);
+        attribute_t* attribute = element->attributes;
+        while (attribute)
+        {
+            if (attribute->name)
+                printf("attribute_name:\t[%s]\n", attribute->name);
+            if (attribute->value)
+                printf("attribute_value:[%s]\n", attribute->value);
+            attribute = attribute->next;
+        }
+        printf("\n");
+    } else{
+        return;
+    }
+    lazy_expand(element);
+    print_element(element->children);
+    print_element(element->siblings);
+
+    return;
+}
+
+xml_handle_t xml_malloc_handle()
+{
+    return xml_malloc_handle_ex(NULL, 0);
+}
+
+xml_handle_t xml_malloc_handle_ex(const xml_allocator_t* allocator, size_t budget)
+{
+    xml_allocator_t hooks = {default_alloc, default_realloc, default_free, NULL};
+    if (allocator) {
+        if (allocator->alloc == NULL || allocator->realloc == NULL || allocator->free == NULL) {
+            return NULL;
+        }
+        hooks = *allocator;
+    }
+    if (budget && budget < sizeof(gb_xml_t)) {
+        return NULL;
+    }
+
+    xml_handle_t xml = hooks.alloc(hooks.context, sizeof(gb_xml_t));
+    if (xml) {
+        memset(xml, 0x0, sizeof(gb_xml_t));
+        xml->arena = xml->buffer;
+        xml->arena_size = sizeof(xml->buffer);
+        xml->heap_bytes = xml->heap_peak = sizeof(gb_xml_t);
+        xml->heap_allocs = 1;
+        xml->allocator = hooks;
+        xml->budget = budget;
+    }
+
+    return xml;
+}
+
+void xml_free_handle(xml_handle_t xml)
+{
+    if (xml) {
+        stack_t* stack = xml->extend[1];
+        if (stack && stack->data != stack->fixed) {
+            heap_free(xml, stack->data, stack->capacity * sizeof(void*));
+        }
+        heap_free(xml, xml->atoms.strings, xml->atoms.capacity * sizeof(char*));
+        heap_free(xml, xml->atoms.slots, xml->atoms.slot_count * sizeof(int));
+        heap_free(xml, xml->bindings, xml->binding_capacity * sizeof(ns_binding_t));
+        heap_free(xml, xml->output, xml->output_capacity);
+        heap_free(xml, xml->recode, xml->recode_capacity);
+        heap_free(xml, xml->decoded, xml->decoded_capacity);
+        heap_free(xml, xml->gb_reverse, 0x10000 * sizeof(unsigned short));
+        heap_free(xml, xml->source, xml->source_capacity);
+        heap_free(xml, xml->lazy, xml->lazy_capacity * sizeof(lazy_entry_t));
+        heap_free(xml, xml->lazy_open, xml->lazy_open_capacity * sizeof(int));
+        while (xml->child_indexes) {
+            child_index_t* next = xml->child_indexes->next;
+            heap_free(xml, xml->child_indexes, xml->child_indexes->size);
+            xml->child_indexes = next;
+        }
+        if (xml->mapping) {
+            munmap(xml->mapping, xml->mapping_size);
+        }
+        while (xml->blocks) {
+            block_t* next = xml->blocks->next;
+            heap_free(xml, xml->blocks, sizeof(block_t) + xml->blocks->size);
+            xml->blocks = next;
+        }
+        // the hooks live in the handle, keep them past its release
+        xml_allocator_t hooks = xml->allocator;
+        hooks.free(hooks.context, xml, sizeof(gb_xml_t));
+    }
+
+    return;
+}
+
+int xml_set_log(xml_handle_t xml, xml_log_t log, void* context)
+{
+    if (xml == NULL) {
+        return XML_STATUS_FAULT;
+    }
+
+    xml->log = log;
+    xml->log_context = context;
+
+    return XML_STATUS_SUCCEED;
+}
+
+int xml_set_limits(xml_handle_t xml, const xml_limits_t* limits)
+{
+    if (xml == NULL) {
+        return XML_STATUS_FAULT;
+    }
+
+    if (limits) {
+        xml->limits = *limits;
+    } else {
+        memset(&xml->limits, 0x0, sizeof(xml_limits_t));
+    }
+
+    return XML_STATUS_SUCCEED;
+}
+
+int xml_set_option(xml_handle_t xml, int option, int enable)
+{
+    if (xml == NULL) {
+        return XML_STATUS_FAULT;
+    }
+
+    if (enable) {
+        xml->options |= option;
+    } else {
+        xml->options &= ~option;
+    }
+
+    return XML_STATUS_SUCCEED;
+}
+
+// open elements from the document element down, the innermost ones are kept when path is too short
+static void error_path(xml_handle_t xml, char* path, size_t size)
+{
+    stack_t* stack = xml->extend[1];
+    const element_t* element = stack ? read_stack(stack) : NULL;
+    size_t begin = size - 1;
+    path[begin] = '\0';
+    for (; element && element->name; element=element->parent) {
+        size_t name_size = strlen(element->name);
+        size_t ns_size = element->ns ? strlen(element->ns) + 1 : 0;
+        size_t separator = begin < size - 1 ? 1 : 0;
+        if (name_size + ns_size + separator > begin) {
+            break;
+        }
+        begin -= separator;
+        if (separator) {
+            path[begin] = '/';
+        }
+        begin -= name_size;
+        memcpy(path + begin, element->name, name_size);
+        if (ns_size) {
+            path[--begin] = ':';
+            begin -= ns_size - 1;
+            memcpy(path + begin, element->ns, ns_size - 1);
+        }
+    }
+    memmove(path, path + begin, size - begin);
+}
+
+// input stopped at raw[i] with status, fill xml->error and tell the log
+// raw is NULL if the position is not known, line_begin is where the line ran at the start of raw
+static int scan_error(xml_handle_t xml, int status, const char* raw, int i, size_t line_begin)
+{
+    // expected is the one field parse_node may have filled for this error, the rest starts over
+    xml_error_t* error = &xml->error;
+    char expected[sizeof(error->expected)];
+    memcpy(expected, error->expected, sizeof(expected));
+    clear_error(xml);
+    memcpy(error->expected, expected, sizeof(expected));
+    error->status = xml->status = status;
+
+    const char* node = xml->extend[0];
+    if (status == XML_STATUS_ENCODING) {
+        error->offset = xml->utf8_error;
+        snprintf(error->expected, sizeof(error->expected), "%s", xml->encoding == ENCODING_UTF8 ? "UTF-8" : "GB18030");
+        if (raw) {
+            snprintf(error->found, sizeof(error->found), "0x%02X", (unsigned char)raw[i]);
+        }
+    } else if (node && xml->token_size > 0) {
+        // a text token starts where the tag before it ended
+        error->offset = node[0] == '<' ? xml->token_begin : xml->token_end;
+        snprintf(error->found, sizeof(error->found), "%.*s", xml->token_size, node);
+    } else {
+        error->offset = xml->consumed + i;
+    }
+    error_path(xml, error->path, sizeof(error->path));
+
+    if (raw) {
+        // count back from the scan position, offsets before this chunk only get a line
+        size_t chunk = xml->consumed;
+        size_t from = error->offset > chunk ? error->offset - chunk : 0;
+        if (from > (size_t)i) {
+            from = i;   // a token left over from a failed call, not in this chunk
+        }
+        size_t begin = line_begin;
+        int line = xml->lines + 1;
+        int j = 0;
+        for (j=from; j<i; j++) {
+            line -= raw[j] == '\n';
+        }
+        for (j=(int)from-1; j>=0 && error->offset >= chunk; j--) {
+            if (raw[j] == '\n') {
+                begin = chunk + j + 1;
+                break;
+            }
+        }
+        error->line = line;
+        error->column = begin <= error->offset ? error->offset - begin + 1 : 0;
+    }
+
+    if (xml->log) {
+        xml->log(xml->log_context, error);
+    }
+
+    return status;
+}
+
+// longest tag the limits allow, with room for quotes, '=' and some blanks between attributes
+static int tag_size_limit(const xml_limits_t* limits)
+{
+    if (limits->max_name_length == 0 || limits->max_text_length == 0 || limits->max_attributes == 0) {
+        return INT_MAX;
+    }
+    size_t attribute = (size_t)limits->max_name_length + limits->max_text_length + 16;
+    size_t size = (size_t)limits->max_name_length + 16 + attribute * limits->max_attributes;
+    if (size < (size_t)limits->max_text_length + 16) {
+        size = (size_t)limits->max_text_length + 16;  // CDATA section
+    }
+
+    return size < INT_MAX ? (int)size : INT_MAX;
+}
+
+// the tag token is checked against max_text_length as it grows: the attribute value or CDATA section
+// still open must stay within it, returns the token size at which to look again, -1 once it does not
+static int next_value_check(xml_handle_t xml, const char* node, int text_limit, int tag_limit)
+{
+    int size = xml->token_size;
+    long long next = tag_limit;
+    if (node[1] == '!') {
+        if (size < 9) {
+            next = 9;
+        } else if (strncmp(node, "<![CDATA[", 9) == 0) {
+            next = 11 + (long long)text_limit;  // the content, maybe followed by "]]"
+        }
+    } else {
+        // the scan picks up where the last check stopped, a long tag is read once
+        int i = 0;
+        for (i=xml->value_scanned; i<size; i++) {
+            if (node[i] == '"') {
+                xml->value_begin = xml->value_begin ? 0 : i + 1;
+            }
+        }
+        xml->value_scanned = size;
+        int open = xml->value_begin ? size - xml->value_begin : 0;
+        next = size + (long long)text_limit - open;
+    }
+    if (next < size) {
+        return -1;
+    }
+
+    return next < tag_limit ? (int)next : tag_limit;
+}
+
+// the document element has been closed, only comments and blanks may follow
+static int document_closed(xml_handle_t xml)
+{
+    if (xml->options & XML_OPTION_LAZY) {
+        return xml->lazy_count > 0 && xml->lazy_depth == 0;
+    }
+
+    return xml->element && read_stack(xml->extend[1]) == NULL;
+}
+
+// tokenize UTF-8 or passed through input, stop early after a header that switches the encoding
+static int scan_input(xml_handle_t xml, const char* raw, int size, int* used)
+{
+    // spans are only usable if the source is complete, so keeping it must start with the first byte
+    if ((xml->options & (XML_OPTION_KEEP_SOURCE | XML_OPTION_LAZY)) && xml->source_size == xml->consumed) {
+        if (append_source(xml, raw, size) != XML_STATUS_SUCCEED) {
+            return out_of_memory(xml);
+        }
+    }
+
+    STAT(double input_begin = stat_now(); double build_begin = 0;)
+    STAT(xml->stats.bytes_consumed += size;)
+
+    char* node = xml->extend[0];
+    if (node == NULL) {
+        xml->extend[0] = node = xml_newstr(xml);
+    }
+
+    const int encoding = xml->encoding;
+    const size_t line_begin = xml->line_begin;
+    // a token can not outgrow its limit, the exact checks run once it is complete
+    const int text_limit = xml->limits.max_text_length ? xml->limits.max_text_length : INT_MAX;
+    const int tag_limit = tag_size_limit(&xml->limits);
+    // values are looked at when the tag could first hold one too long, even without the other limits
+    const int tag_check = text_limit < tag_limit ? text_limit : tag_limit;
+    int limit = xml->token_size > 0 && node[0] == '<' ? tag_check : text_limit;
+    int in_tag = xml->token_size > 0 && node[0] == '<';
+    // validation runs a block ahead of the tokenizer, the error counts once the tokenizer reaches it,
+    // so a header declaring another encoding still turns it off in time
+    int check = (xml->options & XML_OPTION_VALIDATE_UTF8) && !xml->utf8_skip ? 0 : size;
+    int invalid = size;
+    int i = 0;
+    for (i=0; i<size; i++) {
+        if (i == check) {
+            check = utf8_block(xml, raw, size, i, &invalid);
+        }
+        if (i == invalid && !xml->utf8_skip) {
+            return scan_error(xml, XML_STATUS_ENCODING, raw, i, line_begin);
+        }
+        const char c = raw[i];
+        if (c == '<' && (xml->token_size == 0 || node[1] != '!' || !is_open_section(node, xml->token_size))) {
+            if (xml->token_size > 0) {
+                node = xml_strinc(xml, node, '\0');
+                if (node == NULL) {
+                    return scan_error(xml, XML_STATUS_NO_MEMORY, raw, i, line_begin);
+                }
+                xml->extend[0] = node;
+                STAT(build_begin = stat_now();)
+                if (parse_node(xml) != XML_STATUS_SUCCEED) {
+                    return scan_error(xml, xml->status, raw, i, line_begin);
+                }
+                STAT(xml->stats.build_seconds += stat_now() - build_begin;)
+                xml->extend[0] = node = xml_newstr(xml);
+            }
+            xml->token_begin = xml->consumed + i;
+            limit = tag_check;
+            in_tag = 1;
+            node = xml_strinc(xml, node, c);
+        } else if (c == '>' && xml->token_size > 0 && node[0] == '<' && !is_open_section(node, xml->token_size)) {   // a bare '>' in text is just text
+            node = xml_strinc(xml, node, c);
+            if (node) {
+                node = xml_strinc(xml, node, '\0');
+            }
+            if (node == NULL) {
+                return scan_error(xml, XML_STATUS_NO_MEMORY, raw, i, line_begin);
+            }
+            xml->extend[0] = node;
+            xml->token_end = xml->consumed + i + 1;
+            STAT(build_begin = stat_now();)
+            if (parse_node(xml) != XML_STATUS_SUCCEED) {
+                return scan_error(xml, xml->status, raw, i, line_begin);
+            }
+            STAT(xml->stats.build_seconds += stat_now() - build_begin;)
+            xml->extend[0] = node = xml_newstr(xml);
+            limit = text_limit;
+            in_tag = 0;
+            if (xml->encoding != encoding && used) {
+                // the rest of the chunk is kept once transcoded
+                if (xml->source_size > xml->consumed + i + 1) {
+                    xml->source_size = xml->consumed + i + 1;
+                }
+                size = i + 1;
+                xml->encoded = xml->consumed + size;
+                break;
+            }
+            continue;
+        } else if (c == '\r' || c == '\n') {
+            // line breaks survive inside CDATA sections, and inside text when blanks are kept
+            if (c == '\n') {
+                // only counted here, line and column of an error are worked out when it happens
+                xml->lines++;
+                xml->line_begin = xml->consumed + i + 1;
+                if ((xml->options & XML_OPTION_KEEP_BLANK) && (xml->token_size == 0 || node[0] != '<' || node[1] == '!')) {
+                    node = xml_strinc(xml, node, c);
+                } else if (xml->token_size >= 9 && strncmp(node, "<![CDATA[", 9) == 0 && is_open_section(node, xml->token_size)) {
+                    node = xml_strinc(xml, node, c);
+                }
+            }
+        } else {
+            node = xml_strinc(xml, node, c);
+        }
+        if (node == NULL) {
+            return scan_error(xml, XML_STATUS_NO_MEMORY, raw, i, line_begin);
+        }
+        xml->extend[0] = node;
+        if (xml->token_size > limit && in_tag && limit < tag_limit) {
+            limit = next_value_check(xml, node, text_limit, tag_limit);
+            if (limit < 0) {
+                limit_error(xml, "max_text_length", text_limit);
+                return scan_error(xml, XML_STATUS_LIMIT, raw, i, line_begin);
+            }
+        }
+        if (xml->token_size > limit) {
+            limit_error(xml, in_tag ? "max_tag_bytes" : "max_text_length", limit);
+            return scan_error(xml, XML_STATUS_LIMIT, raw, i, line_begin);
+        }
+    }
+    // a sequence cut by the end of the chunk is completed by the next one, unless the document is over
+    if (xml->utf8_need && check >= size && invalid == size && !xml->utf8_skip && (xml->options & XML_OPTION_VALIDATE_UTF8) && document_closed(xml)) {
+        xml->utf8_error = xml->utf8_begin;
+        return scan_error(xml, XML_STATUS_ENCODING, raw, xml->utf8_begin >= xml->consumed ? xml->utf8_begin - xml->consumed : 0, line_begin);
+    }
+    xml->consumed += size;
+    STAT(xml->stats.input_seconds += stat_now() - input_begin;)
+    if (used) {
+        *used = size;
+    }
+
+    return xml->status = XML_STATUS_SUCCEED;
+}
+
+static int input_gb18030(xml_handle_t xml, const char* raw, int size)
+{
+    while (size > 0) {
+        int slice = size < DECODE_SLICE ? size : DECODE_SLICE;
+        size_t capacity = (size_t)(slice + xml->pending_size) * 3 / 2 + 4;
+        if (xml->decoded_capacity < capacity) {
+            char* decoded = heap_realloc(xml, xml->decoded, xml->decoded_capacity, capacity);
+            if (decoded == NULL) {
+                return out_of_memory(xml);
+            }
+            xml->decoded = decoded;
+            xml->decoded_capacity = capacity;
+        }
+        int decoded = gb18030_to_utf8(xml, (const unsigned char*)raw, slice, xml->decoded);
+        if (decoded < 0) {
+            return scan_error(xml, XML_STATUS_ENCODING, NULL, 0, 0);
+        }
+        if (decoded > 0 && scan_input(xml, xml->decoded, decoded, NULL) != XML_STATUS_SUCCEED) {
+            return xml->status;
+        }
+        raw += slice;
+        size -= slice;
+    }
+
+    return xml->status = XML_STATUS_SUCCEED;
+}
+
+int xml_input_raw(xml_handle_t xml, const char* raw, int size)
+{
+    if (xml == NULL) {
+        return XML_STATUS_FAULT;
+    }
+    // raw is not NUL terminated, only size bytes may be read
+    if (raw == NULL || size <= 0) {
+        return xml->status = XML_STATUS_FAULT;
+    }
+    // the tokenizer stopped inside the failed chunk, nothing after it can be parsed,
+    // kept apart from xml->status which serialize and the mutators reset
+    if (xml->input_status != XML_STATUS_SUCCEED) {
+        return xml->status = xml->input_status;
+    }
+    if (xml->limits.max_document_bytes && xml->received + size > xml->limits.max_document_bytes) {
+        limit_error(xml, "max_document_bytes", xml->limits.max_document_bytes);
+        return xml->input_status = scan_error(xml, XML_STATUS_LIMIT, NULL, 0, 0);
+    }
+    xml->received += size;
+    clear_error(xml);
+
+    // the header comes first in UTF-8 compatible bytes, what follows it may need transcoding
+    int status = XML_STATUS_SUCCEED;
+    while (size > 0 && xml->encoding == ENCODING_UTF8 && status == XML_STATUS_SUCCEED) {
+        int used = 0;
+        status = scan_input(xml, raw, size, &used);
+        raw += used;
+        size -= used;
+    }
+    if (status == XML_STATUS_SUCCEED && size > 0) {
+        status = input_gb18030(xml, raw, size);
+    }
+
+    return xml->status = xml->input_status = status;
+}
+
+#ifdef XML_ENABLE_ZLIB
+// producer: inflate fd into the free buffers of the ring until the stream ends
+static void* inflate_input(void* argument)
+{
+    ring_t* ring = argument;
+    z_stream stream;
+    memset(&stream, 0x0, sizeof(z_stream));
+    int status = XML_STATUS_SUCCEED;
+    const char* reason = NULL;
+    size_t read_total = 0;
+    int end = 0;
+    // 15 + 32: gzip or zlib header, detected from the first bytes
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+        status = XML_STATUS_NO_MEMORY;
+        reason = "inflate init failed";
+    }
+
+    while (status == XML_STATUS_SUCCEED && !end) {
+        pthread_mutex_lock(&ring->mutex);
+        while (ring->count == RING_BUFFERS && !ring->stop) {
+            pthread_cond_wait(&ring->drained, &ring->mutex);
+        }
+        int stop = ring->stop;
+        pthread_mutex_unlock(&ring->mutex);
+        if (stop) {
+            break;
+        }
+
+        // the buffer at head is free, nobody else touches it until it is counted
+        stream.next_out = (Bytef*)ring->buffers[ring->head];
+        stream.avail_out = RING_BUFFER_SIZE;
+        while (stream.avail_out > 0 && !end) {
+            if (stream.avail_in == 0) {
+                ssize_t size = read(ring->fd, ring->input, RING_READ_SIZE);
+                if (size <= 0) {
+                    status = XML_STATUS_FAULT;
+                    reason = size < 0 ? "read error" : "unexpected end of stream";
+                    break;
+                }
+                read_total += size;
+                stream.next_in = (Bytef*)ring->input;
+                stream.avail_in = size;
+            }
+            int z = inflate(&stream, Z_NO_FLUSH);
+            if (z == Z_STREAM_END) {
+                // "cat a.gz b.gz" is one valid gzip file, a member may follow
+                if (stream.avail_in == 0) {
+                    ssize_t size = read(ring->fd, ring->input, RING_READ_SIZE);
+                    if (size < 0) {
+                        status = XML_STATUS_FAULT;
+                        reason = "read error";
+                        break;
+                    }
+                    read_total += size;
+                    stream.next_in = (Bytef*)ring->input;
+                    stream.avail_in = size;
+                }
+                if (stream.avail_in == 0) {
+                    end = 1;
+                } else if (inflateReset(&stream) != Z_OK) {
+                    status = XML_STATUS_FAULT;
+                    reason = "inflate reset failed";
+                }
+            } else if (z != Z_OK && z != Z_BUF_ERROR) {
+                // trailing garbage fails here too, as the header of a next member
+                status = z == Z_MEM_ERROR ? XML_STATUS_NO_MEMORY : XML_STATUS_FAULT;
+                reason = stream.msg ? stream.msg : zError(z);
+                break;
+            }
+        }
+
+        int size = RING_BUFFER_SIZE - stream.avail_out;
+        pthread_mutex_lock(&ring->mutex);
+        if (size > 0 && status == XML_STATUS_SUCCEED) {
+            ring->sizes[ring->head] = size;
+            ring->head = (ring->head + 1) % RING_BUFFERS;
+            ring->count++;
+            pthread_cond_signal(&ring->filled);
+        }
+        pthread_mutex_unlock(&ring->mutex);
+    }
+    if (reason) {
+        ring->offset = read_total - stream.avail_in;
+        snprintf(ring->reason, sizeof(ring->reason), "%s", reason);
+    }
+    inflateEnd(&stream);
+
+    pthread_mutex_lock(&ring->mutex);
+    ring->status = status;
+    ring->done = 1;
+    pthread_cond_signal(&ring->filled);
+    pthread_mutex_unlock(&ring->mutex);
+
+    return NULL;
+}
+#endif
+
+int xml_input_gzip(xml_handle_t xml, int fd)
+{
+    if (xml == NULL) {
+        return XML_STATUS_FAULT;
+    }
+    if (fd < 0) {
+        return xml->status = XML_STATUS_FAULT;
+    }
+    if (xml->input_status != XML_STATUS_SUCCEED) {
+        return xml->status = xml->input_status;
+    }
+
+#ifdef XML_ENABLE_ZLIB
+    // one allocation for the ring and the read buffer, the tree never points into it
+    size_t size = (size_t)RING_BUFFERS * RING_BUFFER_SIZE + RING_READ_SIZE;
+    char* memory = heap_alloc(xml, size);
+    if (memory == NULL) {
+        return xml->status = XML_STATUS_NO_MEMORY;
+    }
+    ring_t ring;
+    memset(&ring, 0x0, sizeof(ring_t));
+    int i = 0;
+    for (i=0; i<RING_BUFFERS; i++) {
+        ring.buffers[i] = memory + (size_t)i * RING_BUFFER_SIZE;
+    }
+    ring.input = memory + (size_t)RING_BUFFERS * RING_BUFFER_SIZE;
+    ring.fd = fd;
+    pthread_mutex_init(&ring.mutex, NULL);
+    pthread_cond_init(&ring.filled, NULL);
+    pthread_cond_init(&ring.drained, NULL);
+
+    pthread_t producer;
+    if (pthread_create(&producer, NULL, inflate_input, &ring) != 0) {
+        pthread_mutex_destroy(&ring.mutex);
+        pthread_cond_destroy(&ring.filled);
+        pthread_cond_destroy(&ring.drained);
+        heap_free(xml, memory, size);
+        return xml->status = XML_STATUS_NO_MEMORY;
+    }
+
+    int status = XML_STATUS_SUCCEED;
+    int inflated = 1;
+    for (;;) {
+        pthread_mutex_lock(&ring.mutex);
+        while (ring.count == 0 && !ring.done) {
+            pthread_cond_wait(&ring.filled, &ring.mutex);
+        }
+        if (ring.count == 0) {
+            status = ring.status;
+            inflated = status == XML_STATUS_SUCCEED;
+            pthread_mutex_unlock(&ring.mutex);
+            break;
+        }
+        int tail = ring.tail;
+        pthread_mutex_unlock(&ring.mutex);
+
+        // parsed in place while the producer inflates into the other buffers
+        status = xml_input_raw(xml, ring.buffers[tail], ring.sizes[tail]);
+
+        pthread_mutex_lock(&ring.mutex);
+        ring.tail = (tail + 1) % RING_BUFFERS;
+        ring.count--;
+        ring.stop = status != XML_STATUS_SUCCEED;
+        pthread_cond_signal(&ring.drained);
+        pthread_mutex_unlock(&ring.mutex);
+        if (status != XML_STATUS_SUCCEED) {
+            break;
+        }
+    }
+
+    pthread_join(producer, NULL);
+    pthread_mutex_destroy(&ring.mutex);
+    pthread_cond_destroy(&ring.filled);
+    pthread_cond_destroy(&ring.drained);
+    heap_free(xml, memory, size);
+
+    if (!inflated) {
+        // the parser saw nothing wrong, the error is the compressed stream's
+        clear_error(xml);
+        xml->error.status = status;
+        xml->error.offset = ring.offset;
+        snprintf(xml->error.found, sizeof(xml->error.found), "%s", ring.reason);
+        if (xml->log) {
+            xml->log(xml->log_context, &xml->error);
+        }
+        xml->input_status = status;
+    }
+
+    return xml->status = status;
+#else
+    return xml->status = XML_STATUS_FAULT;
+#endif
+}
+
+int xml_get_error(xml_handle_t xml, xml_error_t* error)
+{
+    if (xml == NULL || error == NULL) {
+        return XML_STATUS_FAULT;
+    }
+
+    if (xml->error.status == XML_STATUS_SUCCEED) {
+        memset(error, 0x0, sizeof(xml_error_t));
+        return XML_STATUS_SUCCEED;
+    }
+    *error = xml->error;
+
+    return error->status;
+}
+
+const char* xml_get_text(xml_handle_t xml, const char* element_ns, const char* element_name)
+{
+    if (xml == NULL || element_name == NULL || strlen(element_name) == 0){
+        return NULL;
+    }
+
+    element_t* element = get_element(xml->element, element_ns, element_name);
+    if (element) {
+        lazy_expand(element);
+        return element->text;
+    } else {
+        return NULL;
+    }
+}
+
+int xml_get_int(xml_handle_t xml, const char* element_ns, const char* element_name)
+{
+    const char* text = xml_get_text(xml, element_ns, element_name);
+    if (text) {
+        return atoi(text);
+    } else {
+        return -1;
+    }
+}
+
+float xml_get_float(xml_handle_t xml, const char* element_ns, const char* element_name)
+{
+    const char* text = xml_get_text(xml, element_ns, element_name);
+    if (text) {
+        return atof(text);
+    } else {
+        return 0.0;
+    }
+}
+
+const char* xml_get_attribute_text(xml_handle_t xml, const char* element_ns, const char* element_name, const char* attribute_name)
+{
+    if (xml == NULL || element_name == NULL || strlen(element_name) == 0 || attribute_name == NULL || strlen(attribute_name) == 0) {
+        return NULL;
+    }
+
+    element_t* element = get_element(xml->element, element_ns, element_name);
+    if (element == NULL) {
+        return NULL;
+    }
+
+    attribute_t* attribute = get_attribute(element, attribute_name);
+    if (attribute) {
+        return attribute->value;
+    }
+
+    return NULL;
+}
+
+int xml_get_attribute_int(xml_handle_t xml, const char* element_ns, const char* element_name, const char* attribute_name)
+{
+    const char* text = xml_get_attribute_text(xml, element_ns, element_name, attribute_name);
+    if (text) {
+        return atoi(text);
+    } else {
+        return -1;
+    }
+}
+
+float xml_get_attribute_float(xml_handle_t xml, const char* element_ns, const char* element_name, const char* attribute_name)
+{
+    const char* text = xml_get_attribute_text(xml, element_ns, element_name, attribute_name);
+    if (text) {
+        return atof(text);
+    } else {
+        return 0.0;
+    }
+}
+
+xml_element_t xml_get_element(xml_handle_t xml)
+{
+    if (xml == NULL) {
+        return NULL;
+    }
+
+    return xml->element;
+}
+
+xml_element_t element_get_sibling(xml_element_t element)
+{
+    if (element == NULL) {
+        return NULL;
+    }
+
+    element_t* sibling = element->siblings;
+    while (sibling && sibling->type == ELEMENT_TYPE_TEXT) {
+        sibling = sibling->siblings;
+    }
+
+    return sibling;
+}
+
+xml_element_t element_get_node(xml_element_t element)
+{
+    if (element == NULL) {
+        return NULL;
+    }
+
+    lazy_expand(element);
+    return element->children;
+}
+
+xml_element_t element_get_next_node(xml_element_t node)
+{
+    if (node == NULL) {
+        return NULL;
+    }
+
+    return node->siblings;
+}
+
+int element_is_text(xml_element_t node)
+{
+    if (node == NULL) {
+        return 0;
+    }
+
+    return node->type == ELEMENT_TYPE_TEXT;
+}
+
+const char* element_get_name(xml_element_t element)
+{
+    if (element == NULL || element->type != ELEMENT_TYPE_ELEMENT) {
+        return NULL;
+    }
+
+    return element->name;
+}
+
+const char* element_get_prefix(xml_element_t element)
+{
+    if (element == NULL || element->type != ELEMENT_TYPE_ELEMENT) {
+        return NULL;
+    }
+
+    return element->ns;
+}
+
+xml_attribute_t element_get_attributes(xml_element_t element)
+{
+    if (element == NULL) {
+        return NULL;
+    }
+
+    return element->attributes;
+}
+
+xml_attribute_t attribute_get_next(xml_attribute_t attribute)
+{
+    if (attribute == NULL) {
+        return NULL;
+    }
+
+    return attribute->next;
+}
+
+const char* attribute_get_name(xml_attribute_t attribute)
+{
+    if (attribute == NULL) {
+        return NULL;
+    }
+
+    return attribute->name;
+}
+
+const char* attribute_get_value(xml_attribute_t attribute)
+{
+    if (attribute == NULL) {
+        return NULL;
+    }
+
+    return attribute->value;
+}
+
+xml_element_t element_get_child(xml_element_t element, const char* child_ns, const char* child_name)
+{
+    if (element == NULL || child_name == NULL || strlen(child_name) == 0) {
+        return NULL;
+    }
+
+    return get_child(element, child_ns, child_name);
+}
+
+const char* element_get_child_text(xml_element_t element, const char* child_ns, const char* child_name)
+{
+    if (element == NULL || child_name == NULL || strlen(child_name) == 0) {
+        return NULL;
+    }
+
+    element_t* child = get_child(element, child_ns, child_name);
+    if (child == NULL) {
+        return NULL;
+    }
+
+    lazy_expand(child);
+    return child->text;
+}
+
+int element_get_child_int(xml_element_t element, const char* child_ns, const char* child_name)
+{
+    const char* text = element_get_child_text(element, child_ns, child_name);
+    if (text) {
+        return atoi(text);
+    } else {
+        return -1;
+    }
+}
+
+float element_get_child_float(xml_element_t element, const char* child_ns, const char* child_name)
+{
+    const char* text = element_get_child_text(element, child_ns, child_name);
+    if (text) {
+        return atof(text);
+    } else {
+        return 0.0;
+    }
+}
+
+int xml_get_ns_id(xml_handle_t xml, const char* uri)
+{
+    if (xml == NULL || uri == NULL || strlen(uri) == 0) {
+        return 0;
+    }
+
+    // a lookup leaves the handle as it is, lazy indexing interns the names before their elements are built,
+    // a uri that never appeared is -1 so it matches nothing
+    int id = atom_find(xml, uri, strlen(uri), 0);
+    return id > 0 ? id : -1;
+}
+
+int xml_get_name_id(xml_handle_t xml, const char* local_name)
+{
+    if (xml == NULL || local_name == NULL || strlen(local_name) == 0) {
+        return 0;
+    }
+
+    return atom_find(xml, local_name, strlen(local_name), 0);
+}
+
+const char* xml_get_atom(xml_handle_t xml, int id)
+{
+    if (xml == NULL || id <= 0 || id > xml->atoms.count) {
+        return NULL;
+    }
+
+    return xml->atoms.strings[id - 1];
+}
+
+xml_element_t xml_get_element_ns(xml_handle_t xml, int ns_id, int name_id)
+{
+    if (xml == NULL || ns_id < 0 || name_id <= 0) {
+        return NULL;
+    }
+
+    return get_element_ns(xml->element, ns_id, name_id);
+}
+
+xml_element_t element_get_child_ns(xml_element_t element, int ns_id, int name_id)
+{
+    if (element == NULL || ns_id < 0 || name_id <= 0) {
+        return NULL;
+    }
+
+    STAT(double begin = stat_now(); unsigned long visited = 0;)
+
+    lazy_expand(element);
+    element_t* child = element->children;
+    while (child) {
+        STAT(visited++;)
+        if (child->name_id == name_id && child->ns_id == ns_id && child->type == ELEMENT_TYPE_ELEMENT) {
+            break;
+        }
+        child = child->siblings;
+    }
+
+    STAT(stat_lookup(element->owner, visited, begin);)
+    return child;
+}
+
+int element_child_count(xml_element_t element)
+{
+    if (element == NULL || element->type != ELEMENT_TYPE_ELEMENT) {
+        return 0;
+    }
+
+    child_index_t* index = get_child_index(element);
+    return index ? index->count : 0;
+}
+
+xml_element_t element_child_at(xml_element_t element, int i)
+{
+    if (element == NULL || element->type != ELEMENT_TYPE_ELEMENT || i < 0) {
+        return NULL;
+    }
+
+    child_index_t* index = get_child_index(element);
+    if (index == NULL || i >= index->count) {
+        return NULL;
+    }
+
+    return index->children[i];
+}
+
+xml_element_t element_next_named(xml_element_t element, const char* ns, const char* name)
+{
+    if (element == NULL || element->parent == NULL || name == NULL || strlen(name) == 0) {
+        return NULL;
+    }
+
+    child_index_t* index = get_child_index(element->parent);
+    if (index == NULL) {
+        return NULL;
+    }
+
+    // a text node starts from the element after it
+    while (element && element->type != ELEMENT_TYPE_ELEMENT) {
+        element = element->siblings;
+        if (element && element->type == ELEMENT_TYPE_ELEMENT && strcmp(element->name, name) == 0
+            && (ns == NULL || strlen(ns) == 0 || (element->ns && strcmp(element->ns, ns) == 0))) {
+            return element;
+        }
+    }
+    int position = element ? child_position(index, element) : -1;
+    if (position < 0) {
+        return NULL;
+    }
+
+    // following the chain of the name only visits its own children
+    int next = -1;
+    if (strcmp(element->name, name) == 0) {
+        next = index->next_named[position];
+    } else {
+        for (next=position+1; next<index->count && strcmp(index->children[next]->name, name) != 0; next++) {
+        }
+        if (next == index->count) {
+            next = -1;
+        }
+    }
+    while (next >= 0) {
+        element_t* child = index->children[next];
+        if (ns == NULL || strlen(ns) == 0 || (child->ns && strcmp(child->ns, ns) == 0)) {
+            return child;
+        }
+        next = index->next_named[next];
+    }
+
+    return NULL;
+}
+
+int element_get_ns_id(xml_element_t element)
+{
+    if (element == NULL) {
+        return 0;
+    }
+
+    return element->ns_id;
+}
+
+int element_get_name_id(xml_element_t element)
+{
+    if (element == NULL) {
+        return 0;
+    }
+
+    return element->name_id;
+}
+
+const char* element_get_attribute_ns(xml_element_t element, int ns_id, int name_id)
+{
+    if (element == NULL || ns_id < 0 || name_id <= 0) {
+        return NULL;
+    }
+
+    attribute_t* attribute = element->attributes;
+    while (attribute) {
+        if (attribute->name_id == name_id && attribute->ns_id == ns_id) {
+            return attribute->value;
+        }
+        attribute = attribute->next;
+    }
+
+    return NULL;
+}
+
+const char* element_get_text(xml_element_t element)
+{
+    if (element == NULL) {
+        return NULL;
+    }
+
+    lazy_expand(element);
+    return element->text;
+}
+
+int element_get_text_concat(xml_element_t element, char* buffer, int size)
+{
+    if (element == NULL) {
+        return -1;
+    }
+
+    int length = 0;
+    lazy_expand(element);
+    element_t* node = element->type == ELEMENT_TYPE_TEXT ? element : element->children;
+    while (node) {
+        if (node->type == ELEMENT_TYPE_TEXT && node->text) {
+            int n = strlen(node->text);
+            if (buffer && length < size) {
+                int room = size - 1 - length;
+                memcpy(buffer + length, node->text, n < room ? n : room);
+            }
+            length += n;
+        }
+        if (element->type == ELEMENT_TYPE_TEXT) {
+            break;
+        }
+        node = node->siblings;
+    }
+
+    if (buffer && size > 0) {
+        buffer[length < size ? length : size - 1] = '\0';
+    }
+
+    return length;
+}
+
+int element_get_int(xml_element_t element)
+{
+    const char* text = element_get_text(element);
+    if (text) {
+        return atoi(text);
+    } else {
+        return -1;
+    }
+}
+
+float element_get_float(xml_element_t element)
+{
+    const char* text = element_get_text(element);
+     if (text) {
+        return atof(text);
+    } else {
+        return 0.0;
+    }
+}
+
+const char* element_get_attribute_text(xml_element_t element, const char* attribute_name)
+{
+    if (element == NULL || attribute_name == NULL || strlen(attribute_name) == 0) {
+        return NULL;
+    }
+
+    attribute_t* attribute = get_attribute(element, attribute_name);
+    if (attribute) {
+        return attribute->value;
+    } else {
+        return NULL;
+    }
+}
+
+int element_get_attribute_int(xml_element_t element, const char* attribute_name)
+{
+    const char* text = element_get_attribute_text(element, attribute_name);
+    if (text) {
+        return atoi(text);
+    } else {
+        return -1;
+    }
+}
+
+float element_get_attribute_float(xml_element_t element, const char* attribute_name)
+{
+    const char* text = element_get_attribute_text(element, attribute_name);
+    if (text) {
+        return atof(text);
+    } else {
+        return 0.0;
+    }
+}
+
+int xml_add_element(xml_handle_t xml, const char* parent_ns, const char* parent_name, const char* ns, const char* name, XML_VALUE_TYPE type, const void* value)
+{
+    if (xml == NULL || name == NULL || strlen(name) == 0) {
+        return XML_STATUS_FAULT;
+    }
+
+    element_t* parent = NULL;
+    if (parent_name && strlen(parent_name) > 0) {
+        parent = get_element(xml->element, parent_ns, parent_name);
+        if (parent == NULL) {
+            return XML_STATUS_FAULT;
+        }
+        // parsed children first, the new one goes after them
+        if (lazy_expand(parent) != XML_STATUS_SUCCEED) {
+            return XML_STATUS_NO_MEMORY;
+        }
+    }
+
+    char tmp[64] = {0};
+    const char* text = format_value(type, value, tmp, sizeof(tmp));
 
-        child = child->siblings;
+    if (add_element(xml, parent, ns, name, text) != NULL) {
+        return XML_STATUS_SUCCEED;
+    } else {
+        return XML_STATUS_FAULT;
     }
-
-    return NULL;
 }
 
-static attribute_t* get_attribute(element_t* element, const char* attribute_name)
+int xml_add_attribute(xml_handle_t xml, const char* element_ns, const char* element_name, const char* name, XML_VALUE_TYPE type, const void* value)
 {
-    if (element == NULL || attribute_name == NULL || strlen(attribute_name) == 0) {
-        return NULL;
+    if (xml == NULL || element_name == NULL || strlen(element_name) == 0 || name == NULL || strlen(name) == 0 || value == NULL) {
+        return XML_STATUS_FAULT;
     }
 
-    attribute_t* attributes = element->attributes;
-    while (attributes) {
-        if (attributes->name && strcmp(attributes->name, attribute_name) == 0) {
-            return attributes;
-        }
-        attributes = attributes->next;
+    element_t* element = get_element(xml->element, element_ns, element_name);
+    if (element == NULL) {
+        return XML_STATUS_FAULT;
     }
 
-    return NULL;
+    char tmp[64] = {0};
+    const char* text = format_value(type, value, tmp, sizeof(tmp));
+
+    if (add_attribute(xml, element, name, text) != NULL) {
+        return XML_STATUS_SUCCEED;
+    } else {
+        return XML_STATUS_FAULT;
+    }
 }
 
-static element_t* add_element(xml_handle_t xml, element_t* parent, const char* ns, const char* name, const char* text)
+xml_element_t xml_new_element(xml_handle_t xml, const char* ns, const char* name)
 {
-    if (name == NULL || strlen(name) == 0) {
+    if (xml == NULL || name == NULL || strlen(name) == 0) {
         return NULL;
     }
 
-    element_t* element = xml_malloc(xml, sizeof(element_t));
+    element_t* element = new_element(xml, ELEMENT_TYPE_ELEMENT);
     if (element == NULL) {
         return NULL;
     }
-    if (xml->element == NULL) {
-        xml->element = element;
-    }
-
+    element->dirty = 1;
     if (ns && strlen(ns)) {
         element->ns = xml_strdup2(xml, ns);
     }
     element->name = xml_strdup2(xml, name);
-    if (text && strlen(text)) {
-        element->text = xml_strdup2(xml, text);
-    }
-    
-    if (parent) {
-        element_t** children = &parent->children;
-        while (*children) {
-            children = &(*children)->siblings;
-        }
-        *children = element;
+    element->owned = OWN_NS | OWN_NAME;
+    element->name_id = atom_intern(xml, element->name);
+    if (element->name == NULL || element->name_id < 0) {
+        return NULL;
     }
 
     return element;
 }
 
-static attribute_t* add_attribute(xml_handle_t xml, element_t* element, const char* name, const char* value)
+xml_element_t xml_new_text(xml_handle_t xml, const char* text)
 {
-    if (element == NULL || name == NULL || strlen(name)==0 || value == NULL || strlen(value)==0) {
+    if (xml == NULL || text == NULL || strlen(text) == 0) {
         return NULL;
     }
 
-    attribute_t** attribute = &element->attributes;
-    while (*attribute) {
-        attribute = &(*attribute)->next;
+    element_t* node = new_element(xml, ELEMENT_TYPE_TEXT);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->dirty = 1;
+    node->text = xml_strdup2(xml, text);
+    node->owned = OWN_VALUE;
+    if (node->text == NULL) {
+        return NULL;
     }
-    *attribute = xml_malloc(xml, sizeof(attribute_t));
-    (*attribute)->name = xml_strdup2(xml, name);
-    (*attribute)->value = xml_strdup2(xml, value);
 
-    return *attribute;
+    return node;
 }
 
-static int serialize_header(xml_handle_t xml, header_t* header)
+int element_set_text(xml_element_t element, XML_VALUE_TYPE type, const void* value)
 {
-    if (xml == NULL || header == NULL) {
-        return xml->status = XML_STATUS_FAULT;
+    if (element == NULL || element->type != ELEMENT_TYPE_ELEMENT) {
+        return XML_STATUS_FAULT;
     }
-    xml_strdup(xml, "<?xml");
-    header_t* temp_header = header;
-    while (temp_header) {
-        xml_strdup(xml, " ");
-        xml_strdup(xml, temp_header->name);
-        xml_strdup(xml, "=");
-        xml_strdup(xml, "\"");
-        xml_strdup(xml, temp_header->value);
-        xml_strdup(xml, "\"");
-        temp_header = temp_header->next;
+
+    xml_handle_t xml = element->owner;
+    char tmp[64] = {0};
+    const char* text = format_value(type, value, tmp, sizeof(tmp));
+
+    // all segments are replaced by one, a parsed segment left unbuilt would come back with the expansion
+    if (lazy_expand(element) != XML_STATUS_SUCCEED) {
+        return XML_STATUS_NO_MEMORY;
+    }
+    // element->text is set while any text child is linked, without one there is nothing to walk
+    element_t* child = element->text ? element->children : NULL;
+    while (child) {
+        element_t* next = child->siblings;
+        if (child->type == ELEMENT_TYPE_TEXT) {
+            unlink_node(child);
+            free_subtree(xml, child);
+        }
+        child = next;
     }
-    xml_strdup(xml, "?>");
+    element->text = NULL;
+    mark_dirty(element);
 
-    return xml->status = XML_STATUS_SUCCEED;
+    if (text && strlen(text)) {
+        element_t* node = xml_new_text(xml, text);
+        if (node == NULL) {
+            return XML_STATUS_NO_MEMORY;
+        }
+        // text goes before child elements like a parsed "<a>text<b/></a>"
+        return link_node(element, element->children, node);
+    }
+
+    return XML_STATUS_SUCCEED;
 }
 
-static int serialize_element(xml_handle_t xml, element_t* element)
+int element_set_attribute(xml_element_t element, const char* name, XML_VALUE_TYPE type, const void* value)
 {
-    if (element == NULL) {
-        return xml->status = XML_STATUS_SUCCEED;
+    if (element == NULL || element->type != ELEMENT_TYPE_ELEMENT || name == NULL || strlen(name) == 0) {
+        return XML_STATUS_FAULT;
     }
 
-    if (xml == NULL) {
-        return xml->status = XML_STATUS_FAULT;
+    xml_handle_t xml = element->owner;
+    char tmp[64] = {0};
+    const char* text = format_value(type, value, tmp, sizeof(tmp));
+
+    attribute_t** pattribute = &element->attributes;
+    while (*pattribute && ((*pattribute)->name == NULL || strcmp((*pattribute)->name, name) != 0)) {
+        pattribute = &(*pattribute)->next;
     }
 
-    xml_strdup(xml, "<");
-    if (element->ns) {
-        xml_strdup(xml, element->ns);
-        xml_strdup(xml, ":");
+    if (*pattribute == NULL) {
+        if (text == NULL) {
+            return XML_STATUS_SUCCEED;
+        }
+        return add_attribute(xml, element, name, text) ? XML_STATUS_SUCCEED : XML_STATUS_NO_MEMORY;
     }
-    xml_strdup(xml, element->name);
-    attribute_t* attributes = element->attributes;
-    while (attributes) {
-        xml_strdup(xml, " ");
-        xml_strdup(xml, attributes->name);
-        xml_strdup(xml, "=");
-        xml_strdup(xml, "\"");
-        xml_strdup(xml, attributes->value);
-        xml_strdup(xml, "\"");
-        attributes = attributes->next;
+
+    attribute_t* attribute = *pattribute;
+    mark_dirty(element);
+    if (text == NULL) {
+        // NULL value removes the attribute
+        *pattribute = attribute->next;
+        free_attribute(xml, attribute);
+    } else {
+        char* copy = xml_strdup2(xml, text);
+        if (copy == NULL && strlen(text) > 0) {
+            return XML_STATUS_NO_MEMORY;
+        }
+        xml_recycle_string(xml, attribute->value, attribute->owned & OWN_VALUE);
+        attribute->value = copy;
+        attribute->owned |= OWN_VALUE;
     }
-    xml_strdup(xml, ">");
 
-    if (element->text) {
-        xml_strdup(xml, element->text);
+    if (is_xmlns(name)) {
+        if (resolve_subtree(xml, element) != XML_STATUS_SUCCEED) {
+            return XML_STATUS_NO_MEMORY;
+        }
     }
 
-    xml->status = serialize_element(xml, element->children);
-    if (xml->status != XML_STATUS_SUCCEED){
-        return xml->status;
+    return XML_STATUS_SUCCEED;
+}
+
+int element_remove(xml_element_t element)
+{
+    if (element == NULL) {
+        return XML_STATUS_FAULT;
     }
 
-    xml_strdup(xml, "</");
-    if (element->ns) {
-        xml_strdup(xml, element->ns);
-        xml_strdup(xml, ":");
+    unlink_node(element);
+    free_subtree(element->owner, element);
+
+    return XML_STATUS_SUCCEED;
+}
+
+int element_insert_before(xml_element_t ref, xml_element_t node)
+{
+    if (ref == NULL || node == NULL || ref == node || ref->parent == NULL || ref->owner != node->owner) {
+        return XML_STATUS_FAULT;
     }
-    xml_strdup(xml, element->name);
-    xml_strdup(xml, ">");
 
-    xml->status = serialize_element(xml, element->siblings);
-    if (xml->status != XML_STATUS_SUCCEED) {
-        return xml->status;
+    return link_node(ref->parent, ref, node);
+}
+
+int element_insert_after(xml_element_t ref, xml_element_t node)
+{
+    if (ref == NULL || node == NULL || ref == node || ref->parent == NULL || ref->owner != node->owner) {
+        return XML_STATUS_FAULT;
     }
 
-    return xml->status = XML_STATUS_SUCCEED;
+    return link_node(ref->parent, ref->siblings, node);
 }
 
-static void print_header(const header_t* header)
+int element_append_child(xml_element_t parent, xml_element_t node)
 {
-    if (header == NULL) {
-        return;
+    if (parent == NULL || node == NULL || parent->type != ELEMENT_TYPE_ELEMENT || parent->owner != node->owner) {
+        return XML_STATUS_FAULT;
     }
 
-    const header_t* tmp = header;
-    while (tmp) {
-        if (tmp->name) {
-            printf("hader_name:%s\n", tmp->name);
-        }
-        if (tmp->value) {
-            printf("header_value:%s\n", tmp->value);
-        }
-        tmp = tmp->next;
+    return link_node(parent, NULL, node);
+}
+
+static size_t string_chunk(const char* s)
+{
+    return s ? (strlen(s) + 1 + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1) : 0;
+}
+
+// copy s to the reservation at *cursor and step over its rounded chunk, as xml_strdup2 would lay it out
+static char* clone_string(char** cursor, const char* s)
+{
+    if (s == NULL) {
+        return NULL;
     }
 
-    return;
+    size_t size = strlen(s) + 1;
+    char* copy = *cursor;
+    memcpy(copy, s, size);
+    *cursor += (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    return copy;
 }
 
-static void print_element(const element_t* element)
+// id of the same atom in dst, map caches source id -> dst id when the handles differ
+static int clone_atom(xml_handle_t dst, xml_handle_t src, int* map, int id)
 {
-    if (element){
-        printf("\n");
-        if (element->ns)
-            printf("ns:\t\t[%s]\n", element->ns);
-        if (element->name)
-            printf("name:\t\t[%s]\n", element->name);
-        if (element->text)
-            printf("text:\t\t[%s]\n", element->text);
-        attribute_t* attribute = element->attributes;
-        while (attribute)
-        {
-            if (attribute->name)
-                printf("attribute_name:\t[%s]\n", attribute->name);
-            if (attribute->value)
-                printf("attribute_value:[%s]\n", attribute->value);
-            attribute = attribute->next;
-        }
-        printf("\n");
-    } else{
-        return;
+    if (id <= 0 || map == NULL) {
+        return id;
+    }
+    if (map[id] == 0) {
+        map[id] = atom_intern(dst, src->atoms.strings[id - 1]);
     }
-    print_element(element->children);
-    print_element(element->siblings);
 
-    return;
+    return map[id];
 }
 
-xml_handle_t xml_malloc_handle()
+// element is still open in an eager parse, its subtree is not all in
+static int is_open(xml_handle_t xml, const element_t* element)
 {
-    xml_handle_t xml = malloc(sizeof(gb_xml_t));
-    if (xml) {
-        memset(xml, 0x0, sizeof(gb_xml_t));
+    stack_t* stack = xml->extend[1];
+    int i = 0;
+    for (i=0; stack && i<=stack->header; i++) {
+        if (stack->data[i] == element) {
+            return 1;
+        }
     }
 
-    return xml;
+    return 0;
 }
 
-void xml_free_handle(xml_handle_t xml)
+// remember a prefix once, name points into the source, prefixes are not atoms: a parse never interns them
+static int add_prefix(xml_handle_t xml, prefix_t** prefixes, int* count, int* capacity, const char* name, int size)
 {
-    if (xml) {
-        free(xml);
+    int i = 0;
+    for (i=0; i<*count; i++) {
+        if ((*prefixes)[i].size == size && strncmp((*prefixes)[i].name, name, size) == 0) {
+            return 0;
+        }
+    }
+    if (*count == *capacity) {
+        int grown = *capacity ? *capacity * 2 : 8;
+        prefix_t* resized = heap_realloc(xml, *prefixes, *capacity * sizeof(prefix_t), grown * sizeof(prefix_t));
+        if (resized == NULL) {
+            return -1;
+        }
+        *prefixes = resized;
+        *capacity = grown;
     }
+    memset(&(*prefixes)[*count], 0x0, sizeof(prefix_t));
+    (*prefixes)[*count].name = name;
+    (*prefixes)[*count].size = size;
+    (*count)++;
 
-    return;
+    return 0;
 }
 
-int xml_input_raw(xml_handle_t xml, const char* raw, int size)
+// bytes of the declaration name "xmlns" or "xmlns:prefix", rounded like string_chunk
+static size_t declaration_chunk(const prefix_t* prefix)
 {
-    if (xml == NULL || raw == NULL || strlen(raw) == 0 || size == 0) {
-        return xml->status = XML_STATUS_FAULT;
+    return (prefix->size + (prefix->size ? 7 : 6) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+// put xmlns="uri" or xmlns:prefix="uri" first on element, the attribute and its strings come from
+// the reservation of the copy, the local name was interned before it was taken
+static void declare_prefix(xml_handle_t xml, element_t* element, attribute_t* attribute, char** cursor, const prefix_t* prefix)
+{
+    memset(attribute, 0x0, sizeof(attribute_t));
+    char* name = *cursor;
+    if (prefix->size) {
+        snprintf(name, prefix->size + 7, "xmlns:%.*s", prefix->size, prefix->name);
+    } else {
+        strcpy(name, "xmlns");
+    }
+    *cursor += declaration_chunk(prefix);
+    attribute->name = name;
+    attribute->local = prefix->size ? name + 6 : name;
+    attribute->value = clone_string(cursor, prefix->uri);
+    attribute->owned = OWN_NAME | (attribute->value ? OWN_VALUE : 0);
+    attribute->name_id = atom_find(xml, attribute->local, strlen(attribute->local), 0);
+    attribute->next = element->attributes;
+    element->attributes = attribute;
+    STAT(xml->stats.attributes++;)
+}
+
+xml_element_t xml_clone_subtree(xml_handle_t dst, xml_element_t dst_parent, xml_element_t src_element)
+{
+    if (dst == NULL || src_element == NULL) {
+        return NULL;
+    }
+    // a text node is no document element, and a source that failed or is still open has no whole subtree
+    xml_handle_t src = src_element->owner;
+    if ((dst_parent && (dst_parent->owner != dst || dst_parent->type != ELEMENT_TYPE_ELEMENT))
+        || (dst_parent == NULL && src_element->type == ELEMENT_TYPE_TEXT)
+        || src->input_status != XML_STATUS_SUCCEED || is_open(src, src_element)) {
+        dst->status = XML_STATUS_FAULT;
+        return NULL;
+    }
+    if (dst_parent && lazy_expand(dst_parent) != XML_STATUS_SUCCEED) {
+        dst->status = XML_STATUS_NO_MEMORY;
+        return NULL;
+    }
+    int* map = NULL;
+    if (dst != src) {
+        map = heap_alloc(dst, (src->atoms.count + 1) * sizeof(int));
+        if (map == NULL) {
+            dst->status = XML_STATUS_NO_MEMORY;
+            return NULL;
+        }
+        memset(map, 0x0, (src->atoms.count + 1) * sizeof(int));
     }
 
-    char* node = xml->extend[0];
-    if (node == NULL) {
-        xml->extend[0] = node = xml_newstr(xml);
+    // first pass expands lazy elements, interns the names of the copy in dst, collects the prefixes it uses
+    // and sizes one reservation for the whole copy, nothing is allocated and nothing can fail once it is taken
+    int status = XML_STATUS_SUCCEED;
+    size_t element_count = 0;
+    size_t attribute_count = 0;
+    size_t string_bytes = 0;
+    prefix_t* prefixes = NULL;
+    int prefix_count = 0;
+    int prefix_capacity = 0;
+    element_t* from = NULL;
+    for (from=src_element; from && status == XML_STATUS_SUCCEED; from=next_preorder(src_element, from)) {
+        int expanded = lazy_expand(from);
+        if (expanded != XML_STATUS_SUCCEED || from->lazy) {
+            // out of memory, or still open in a lazy parse
+            status = expanded == XML_STATUS_SUCCEED ? XML_STATUS_FAULT : XML_STATUS_NO_MEMORY;
+            break;
+        }
+        element_count++;
+        if (from->type == ELEMENT_TYPE_TEXT) {
+            string_bytes += string_chunk(from->text);
+            continue;
+        }
+        string_bytes += string_chunk(from->ns);
+        int ns_id = clone_atom(dst, src, map, from->ns_id);
+        int name_id = from->name_id > 0 ? clone_atom(dst, src, map, from->name_id) : atom_intern(dst, from->name);
+        if ((from->ns_id > 0 && ns_id < 0) || name_id <= 0
+            || add_prefix(dst, &prefixes, &prefix_count, &prefix_capacity, from->ns ? from->ns : "", from->ns ? strlen(from->ns) : 0) != 0) {
+            status = XML_STATUS_NO_MEMORY;
+            break;
+        }
+        attribute_t* attribute = NULL;
+        for (attribute=from->attributes; attribute; attribute=attribute->next) {
+            attribute_count++;
+            string_bytes += string_chunk(attribute->name) + string_chunk(attribute->value);
+            const char* colon = attribute->name ? strchr(attribute->name, ':') : NULL;
+            if ((attribute->ns_id > 0 && clone_atom(dst, src, map, attribute->ns_id) < 0) || clone_atom(dst, src, map, attribute->name_id) < 0
+                || (colon && !is_xmlns(attribute->name)
+                    && add_prefix(dst, &prefixes, &prefix_count, &prefix_capacity, attribute->name, colon - attribute->name) != 0)) {
+                status = XML_STATUS_NO_MEMORY;
+                break;
+            }
+        }
+        if (status != XML_STATUS_SUCCEED) {
+            break;
+        }
     }
 
+    // prefixes bound above the source element are declared on the copy unless dst_parent binds them the same,
+    // so the copy reads the same wherever it goes
+    size_t declarations = 0;
     int i = 0;
-    for (i=0; i<size; i++) {
-        const char c = raw[i];
-        if (c == '<') {
-            if (node != NULL && strlen(node) > 0) {
-                xml_strinc(xml, node, '\0');
-                if (parse_node(xml) == 0) {
-                    xml->extend[0] = node = xml_newstr(xml);
-                } else {
-                    return xml->status = XML_STATUS_SYNTAX;
-                }
+    for (i=0; i<prefix_count && status == XML_STATUS_SUCCEED; i++) {
+        prefix_t* prefix = &prefixes[i];
+        if ((prefix->size == 3 && strncmp(prefix->name, "xml", 3) == 0) || own_uri(src_element, prefix->name, prefix->size)) {
+            continue;
+        }
+        const char* uri = declared_uri(src_element->parent, prefix->name, prefix->size);
+        const char* in_scope = dst_parent ? declared_uri(dst_parent, prefix->name, prefix->size) : NULL;
+        if (strcmp(uri ? uri : "", in_scope ? in_scope : "") == 0 || (prefix->size && (uri == NULL || uri[0] == '\0'))) {
+            continue;   // same binding, or a prefix the source did not bind either
+        }
+        prefix->declare = 1;
+        prefix->uri = uri && uri[0] ? uri : NULL;
+        // the local name of a declaration is an atom, as for a parsed one
+        if ((prefix->size ? atom_find(dst, prefix->name, prefix->size, 1) : atom_intern(dst, "xmlns")) < 0) {
+            status = XML_STATUS_NO_MEMORY;
+        }
+        declarations++;
+        string_bytes += declaration_chunk(prefix) + string_chunk(prefix->uri);
+    }
+
+    size_t size = element_count * sizeof(element_t) + (attribute_count + declarations) * sizeof(attribute_t) + string_bytes;
+    element_t* elements = status == XML_STATUS_SUCCEED ? xml_malloc(dst, size) : NULL;
+    if (elements == NULL) {
+        heap_free(dst, map, (src->atoms.count + 1) * sizeof(int));
+        heap_free(dst, prefixes, prefix_capacity * sizeof(prefix_t));
+        dst->status = status == XML_STATUS_SUCCEED ? XML_STATUS_NO_MEMORY : status;
+        return NULL;
+    }
+    attribute_t* attributes = (attribute_t*)(elements + element_count);
+    char* strings = (char*)(attributes + attribute_count + declarations);
+    STAT(dst->stats.nodes += element_count;)
+    STAT(dst->stats.attributes += attribute_count;)
+
+    // second pass copies in preorder, parent is the copy of from->parent,
+    // local names point into the atom table of dst, every id is found there now
+    element_t* copy = elements;
+    element_t* parent = NULL;
+    from = src_element;
+    while (from) {
+        memset(copy, 0x0, sizeof(element_t));   // here rather than over the whole reservation, it is touched once
+        copy->type = from->type;
+        copy->owner = dst;
+        copy->dirty = 1;
+        if (from->type == ELEMENT_TYPE_TEXT) {
+            copy->text = clone_string(&strings, from->text);
+            copy->owned = OWN_VALUE;
+        } else {
+            copy->ns = clone_string(&strings, from->ns);
+            copy->owned = OWN_ATOM | (copy->ns ? OWN_NS : 0);
+            copy->ns_id = clone_atom(dst, src, map, from->ns_id);
+            copy->name_id = from->name_id > 0 ? clone_atom(dst, src, map, from->name_id) : atom_find(dst, from->name, strlen(from->name), 0);
+            copy->name = (char*)dst->atoms.strings[copy->name_id - 1];
+
+            attribute_t** tail = &copy->attributes;
+            attribute_t* attribute = NULL;
+            for (attribute=from->attributes; attribute; attribute=attribute->next, attributes++) {
+                memset(attributes, 0x0, sizeof(attribute_t));
+                attributes->name = clone_string(&strings, attribute->name);
+                attributes->value = clone_string(&strings, attribute->value);
+                const char* colon = attributes->name ? strchr(attributes->name, ':') : NULL;
+                attributes->local = colon ? colon + 1 : attributes->name;
+                attributes->ns_id = clone_atom(dst, src, map, attribute->ns_id);
+                attributes->name_id = clone_atom(dst, src, map, attribute->name_id);
+                attributes->owned = (attribute->name ? OWN_NAME : 0) | (attribute->value ? OWN_VALUE : 0);
+                *tail = attributes;
+                tail = &attributes->next;
             }
-            xml_strinc(xml, node, c);
-        } else if (c == '>') {
-            xml_strinc(xml, node, c);
-            xml_strinc(xml, node, '\0');
-            if (parse_node(xml) == 0) {
-                xml->extend[0] = node = xml_newstr(xml);
-            } else {
-                return xml->status = XML_STATUS_SYNTAX;
+        }
+        if (parent) {
+            add_child(parent, copy);
+            if (copy->type == ELEMENT_TYPE_TEXT && (parent->text == NULL || (is_blank(parent->text) && !is_blank(copy->text)))) {
+                parent->text = copy->text;
             }
-        } else if (c == '\r' || c == '\n') {
+        }
+
+        copy++;
+        if (from->type == ELEMENT_TYPE_ELEMENT && from->children) {
+            parent = copy - 1;
+            from = from->children;
             continue;
-        } else {
-            xml_strinc(xml, node, c);
         }
+        while (from != src_element && from->siblings == NULL) {
+            from = from->parent;
+            parent = parent->parent;
+        }
+        from = from == src_element ? NULL : from->siblings;
+    }
+    for (i=0; i<prefix_count; i++) {
+        if (prefixes[i].declare) {
+            declare_prefix(dst, elements, attributes++, &strings, &prefixes[i]);
+        }
+    }
+    heap_free(dst, map, (src->atoms.count + 1) * sizeof(int));
+    heap_free(dst, prefixes, prefix_capacity * sizeof(prefix_t));
+
+    if (dst_parent) {
+        add_child(dst_parent, elements);
+        mark_dirty(dst_parent);
+        dst->lazy_changed = 1;
+    } else if (dst->element == NULL) {
+        dst->element = elements;
     }
 
-    return xml->status = XML_STATUS_SUCCEED;
+    return elements;
 }
 
-const char* xml_get_text(xml_handle_t xml, const char* element_ns, const char* element_name)
+xml_handle_t xml_clone_handle(xml_handle_t src)
 {
-    if (xml == NULL || element_name == NULL || strlen(element_name) == 0){
+    if (src == NULL) {
         return NULL;
     }
 
-    element_t* element = get_element(xml->element, element_ns, element_name);
-    if (element) {
-        return element->text;
-    } else {
+    if (src->input_status != XML_STATUS_SUCCEED) {
+        return NULL;    // the tree of a failed input is cut short
+    }
+
+    xml_handle_t xml = xml_malloc_handle_ex(&src->allocator, src->budget);
+    if (xml == NULL) {
         return NULL;
     }
-}
+    // the copy is a built tree, there is no source to index
+    xml->options = src->options & ~XML_OPTION_LAZY;
+    xml->limits = src->limits;
+    xml->log = src->log;
+    xml->log_context = src->log_context;
+    xml->encoding = src->encoding;
+
+    // atoms in the same order, ids taken from the source stay valid for the copy
+    int i = 0;
+    for (i=0; i<src->atoms.count; i++) {
+        if (atom_intern(xml, src->atoms.strings[i]) != i + 1) {
+            xml_free_handle(xml);
+            return NULL;
+        }
+    }
 
-int xml_get_int(xml_handle_t xml, const char* element_ns, const char* element_name)
-{
-    const char* text = xml_get_text(xml, element_ns, element_name);
-    if (text) {
-        return atoi(text);
-    } else {
-        return -1;
+    header_t** pheader = &xml->header;
+    header_t* header = NULL;
+    for (header=src->header; header; header=header->next) {
+        size_t name_size = header->name ? strlen(header->name) + 1 : 0;
+        size_t value_size = header->value ? strlen(header->value) + 1 : 0;
+        *pheader = xml_malloc(xml, sizeof(header_t) + name_size + value_size);
+        if (*pheader == NULL) {
+            xml_free_handle(xml);
+            return NULL;
+        }
+        memset(*pheader, 0x0, sizeof(header_t));
+        char* strings = (char*)(*pheader + 1);
+        if (header->name) {
+            (*pheader)->name = memcpy(strings, header->name, name_size);
+        }
+        if (header->value) {
+            (*pheader)->value = memcpy(strings + name_size, header->value, value_size);
+        }
+        pheader = &(*pheader)->next;
+    }
+
+    if (src->element && xml_clone_subtree(xml, NULL, src->element) == NULL) {
+        xml_free_handle(xml);
+        return NULL;
     }
+
+    return xml;
 }
 
-float xml_get_float(xml_handle_t xml, const char* element_ns, const char* element_name)
+const char* xml_serialize(xml_handle_t xml)
 {
-    const char* text = xml_get_text(xml, element_ns, element_name);
-    if (text) {
-        return atof(text);
-    } else {
-        return 0.0;
-    }
+    return xml_serialize_ex(xml, XML_SERIALIZE_COMPACT, NULL);
 }
 
-const char* xml_get_attribute_text(xml_handle_t xml, const char* element_ns, const char* element_name, const char* attribute_name)
+const char* xml_serialize_ex(xml_handle_t xml, int mode, int* size)
 {
-    if (xml == NULL || element_name == NULL || strlen(element_name) == 0 || attribute_name == NULL || strlen(attribute_name) == 0) {
+    if (xml == NULL || mode < XML_SERIALIZE_COMPACT || mode > XML_SERIALIZE_CANONICAL) {
         return NULL;
     }
 
-    element_t* element = get_element(xml->element, element_ns, element_name);
-    if (element == NULL) {
+    xml->output_size = 0;
+    xml->status = XML_STATUS_SUCCEED;
+    // canonical form has no declaration
+    if (mode != XML_SERIALIZE_CANONICAL) {
+        if (xml->header) {
+            serialize_header(xml, xml->header);
+        } else {
+            out_puts(xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
+        }
+    }
+    size_t header_size = xml->output_size;
+
+    if (xml->status == XML_STATUS_SUCCEED) {
+        serialize_element(xml, xml->element, mode);
+    }
+    if (xml->status != XML_STATUS_SUCCEED) {
+        return NULL;
+    }
+    if (mode == XML_SERIALIZE_INDENT) {
+        out_write(xml, "\n", 1);
+    }
+    if (xml->encoding == ENCODING_GB18030 && (xml->options & XML_OPTION_KEEP_ENCODING) && output_gb18030(xml, header_size) != XML_STATUS_SUCCEED) {
         return NULL;
     }
 
-    attribute_t* attribute = get_attribute(element, attribute_name);
-    if (attribute) {
-        return attribute->value;
+    if (size) {
+        *size = xml->output_size;
     }
 
-    return NULL;
+    return xml->output;
 }
 
-int xml_get_attribute_int(xml_handle_t xml, const char* element_ns, const char* element_name, const char* attribute_name)
+int xml_save_snapshot(xml_handle_t xml, const char* path)
 {
-    const char* text = xml_get_attribute_text(xml, element_ns, element_name, attribute_name);
-    if (text) {
-        return atoi(text);
-    } else {
-        return -1;
+    if (xml == NULL || path == NULL) {
+        return XML_STATUS_FAULT;
     }
-}
 
-float xml_get_attribute_float(xml_handle_t xml, const char* element_ns, const char* element_name, const char* attribute_name)
-{
-    const char* text = xml_get_attribute_text(xml, element_ns, element_name, attribute_name);
-    if (text) {
-        return atof(text);
+    size_t element_count = 0;
+    size_t attribute_count = 0;
+    size_t header_count = 0;
+    size_t atom_count = xml->atoms.count;
+    element_t* element = NULL;
+    attribute_t* attribute = NULL;
+    header_t* header = NULL;
+    for (element=xml->element; element; element=next_preorder(NULL, element)) {
+        element_count++;
+        for (attribute=element->attributes; attribute; attribute=attribute->next) {
+            attribute_count++;
+        }
+    }
+    for (header=xml->header; header; header=header->next) {
+        header_count++;
+    }
+
+    snapshot_t snapshot;
+    memset(&snapshot, 0x0, sizeof(snapshot_t));
+    memcpy(snapshot.magic, SNAPSHOT_MAGIC, sizeof(snapshot.magic));
+    snapshot.version = SNAPSHOT_VERSION;
+    snapshot.order = SNAPSHOT_ORDER;
+    snapshot.pointer_size = sizeof(void*);
+    snapshot.element_size = sizeof(element_t);
+    snapshot.attribute_size = sizeof(attribute_t);
+    snapshot.header_size = sizeof(header_t);
+    snapshot.element_count = element_count;
+    snapshot.attribute_count = attribute_count;
+    snapshot.header_count = header_count;
+    snapshot.atom_count = atom_count;
+    snapshot.elements = sizeof(snapshot_t);
+    snapshot.attributes = snapshot.elements + element_count * sizeof(element_t);
+    snapshot.headers = snapshot.attributes + attribute_count * sizeof(attribute_t);
+    snapshot.atoms = snapshot.headers + header_count * sizeof(header_t);
+    snapshot.strings = snapshot.atoms + atom_count * sizeof(unsigned long long);
+
+    // every record and string gets its offset first, then the image is written in one go
+    size_t keys = element_count * 4 + attribute_count * 3 + header_count * 3 + atom_count;
+    size_t slot_count = 64;
+    while (slot_count < keys * 2) {
+        slot_count *= 2;
+    }
+    snapshot_map_t map;
+    map.slots = heap_alloc(xml, slot_count * sizeof(snapshot_slot_t));
+    if (map.slots == NULL) {
+        return xml->status = XML_STATUS_NO_MEMORY;
+    }
+    memset(map.slots, 0x0, slot_count * sizeof(snapshot_slot_t));
+    map.mask = slot_count - 1;
+    map.strings = snapshot.strings;
+
+    size_t offset = snapshot.elements;
+    for (element=xml->element; element; element=next_preorder(NULL, element)) {
+        snapshot_record(&map, element, offset);
+        offset += sizeof(element_t);
+        snapshot_string(&map, element->ns);
+        snapshot_string(&map, element->name);
+        snapshot_string(&map, element->text);
+    }
+    offset = snapshot.attributes;
+    for (element=xml->element; element; element=next_preorder(NULL, element)) {
+        for (attribute=element->attributes; attribute; attribute=attribute->next) {
+            snapshot_record(&map, attribute, offset);
+            offset += sizeof(attribute_t);
+            snapshot_string(&map, attribute->name);
+            snapshot_string(&map, attribute->value);
+        }
+    }
+    offset = snapshot.headers;
+    for (header=xml->header; header; header=header->next) {
+        snapshot_record(&map, header, offset);
+        offset += sizeof(header_t);
+        snapshot_string(&map, header->name);
+        snapshot_string(&map, header->value);
+    }
+    size_t i = 0;
+    for (i=0; i<atom_count; i++) {
+        snapshot_string(&map, xml->atoms.strings[i]);
+    }
+    // a trailing NUL even for an empty pool, the loader checks it
+    snapshot.image_size = map.strings + 1;
+    snapshot.root = (size_t)snapshot_offset(&map, xml->element);
+    snapshot.header = (size_t)snapshot_offset(&map, xml->header);
+
+    char* image = heap_alloc(xml, snapshot.image_size);
+    if (image == NULL) {
+        heap_free(xml, map.slots, slot_count * sizeof(snapshot_slot_t));
+        return xml->status = XML_STATUS_NO_MEMORY;
+    }
+    memset(image, 0x0, snapshot.image_size);
+    memcpy(image, &snapshot, sizeof(snapshot_t));
+
+    element_t* element_record = (element_t*)(image + snapshot.elements);
+    attribute_t* attribute_record = (attribute_t*)(image + snapshot.attributes);
+    for (element=xml->element; element; element=next_preorder(NULL, element), element_record++) {
+        element_record->type = element->type;
+        element_record->ns_id = element->ns_id;
+        element_record->name_id = element->name_id;
+        element_record->ns = snapshot_copy(&map, image, element->ns);
+        element_record->name = snapshot_copy(&map, image, element->name);
+        element_record->text = snapshot_copy(&map, image, element->text);
+        element_record->attributes = snapshot_offset(&map, element->attributes);
+        element_record->parent = snapshot_offset(&map, element->parent);
+        element_record->children = snapshot_offset(&map, element->children);
+        element_record->last = snapshot_offset(&map, element->last);
+        element_record->siblings = snapshot_offset(&map, element->siblings);
+        element_record->prev = snapshot_offset(&map, element->prev);
+        for (attribute=element->attributes; attribute; attribute=attribute->next, attribute_record++) {
+            attribute_record->ns_id = attribute->ns_id;
+            attribute_record->name_id = attribute->name_id;
+            attribute_record->name = snapshot_copy(&map, image, attribute->name);
+            attribute_record->value = snapshot_copy(&map, image, attribute->value);
+            if (attribute->local) {
+                // local name points into the qualified name
+                attribute_record->local = (char*)attribute_record->name + (attribute->local - attribute->name);
+            }
+            attribute_record->next = snapshot_offset(&map, attribute->next);
+        }
+    }
+    header_t* header_record = (header_t*)(image + snapshot.headers);
+    for (header=xml->header; header; header=header->next, header_record++) {
+        header_record->name = snapshot_copy(&map, image, header->name);
+        header_record->value = snapshot_copy(&map, image, header->value);
+        header_record->next = snapshot_offset(&map, header->next);
+    }
+    unsigned long long* atoms = (unsigned long long*)(image + snapshot.atoms);
+    for (i=0; i<atom_count; i++) {
+        atoms[i] = (size_t)snapshot_copy(&map, image, xml->atoms.strings[i]);
+    }
+    heap_free(xml, map.slots, slot_count * sizeof(snapshot_slot_t));
+
+    int status = XML_STATUS_SUCCEED;
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        status = XML_STATUS_FAULT;
     } else {
-        return 0.0;
+        if (fwrite(image, 1, snapshot.image_size, file) != snapshot.image_size) {
+            status = XML_STATUS_FAULT;
+        }
+        if (fclose(file) != 0) {
+            status = XML_STATUS_FAULT;
+        }
     }
+    heap_free(xml, image, snapshot.image_size);
+
+    return xml->status = status;
 }
 
-xml_element_t xml_get_element(xml_handle_t xml)
+xml_handle_t xml_load_snapshot(const char* path)
 {
-    if (xml == NULL) {
+    if (path == NULL) {
         return NULL;
     }
 
-    return xml->element;
-}
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    void* image = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > (off_t)sizeof(snapshot_t)) {
+        // private pages, rebasing writes only touch the record sections
+        image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (image == MAP_FAILED) {
+        return NULL;
+    }
 
-xml_element_t element_get_sibling(xml_element_t element)
-{
-    if (element == NULL) {
+    xml_handle_t xml = xml_malloc_handle();
+    if (xml == NULL) {
+        munmap(image, st.st_size);
+        return NULL;
+    }
+    xml->mapping = image;
+    xml->mapping_size = st.st_size;
+    if (snapshot_rebase(xml, image, st.st_size) != XML_STATUS_SUCCEED) {
+        xml_free_handle(xml);
         return NULL;
     }
 
-    return element->siblings;
+    return xml;
 }
 
-xml_element_t element_get_child(xml_element_t element, const char* child_ns, const char* child_name)
+xml_bind_t xml_bind_compile(const char* record_path, const xml_binding_t* bindings, int count)
 {
-    if (element == NULL || child_name == NULL || strlen(child_name) == 0) {
+    if (record_path == NULL || bindings == NULL || count <= 0) {
         return NULL;
     }
 
-    return get_child(element, child_ns, child_name);
-}
+    size_t names_size = strlen(record_path) + 1;
+    int segments = 1;
+    const char* s = NULL;
+    for (s=record_path; *s; s++) {
+        segments += *s == '/';
+    }
+    int i = 0;
+    for (i=0; i<count; i++) {
+        if (bindings[i].path == NULL) {
+            return NULL;
+        }
+        names_size += strlen(bindings[i].path) + 1;
+        segments++;
+        for (s=bindings[i].path; *s; s++) {
+            segments += *s == '/';
+        }
+    }
 
-const char* element_get_child_text(xml_element_t element, const char* child_ns, const char* child_name)
-{
-    if (element == NULL || child_name == NULL || strlen(child_name) == 0) {
+    bind_t* bind = malloc(sizeof(bind_t));
+    if (bind == NULL) {
+        return NULL;
+    }
+    memset(bind, 0x0, sizeof(bind_t));
+    int edge_count = 16;
+    while (edge_count < segments * 2) {
+        edge_count *= 2;
+    }
+    bind->edge_mask = edge_count - 1;
+    bind->state_count = 1;
+    bind->names = malloc(names_size);
+    bind->edges = calloc(edge_count, sizeof(bind_edge_t));
+    bind->fields = malloc(count * sizeof(bind_field_t));
+    bind->fields_of = malloc((segments + 1) * sizeof(int));
+    if (bind->names == NULL || bind->edges == NULL || bind->fields == NULL || bind->fields_of == NULL) {
+        xml_bind_free(bind);
         return NULL;
     }
+    for (i=0; i<segments+1; i++) {
+        bind->fields_of[i] = -1;
+    }
 
-    element_t* child = get_child(element, child_ns, child_name);
-    if (child == NULL) {
+    char* names = bind->names;
+    strcpy(names, record_path);
+    int record_depth = 0;
+    bind->record = bind_add_path(bind, 0, names, &record_depth);
+    names += strlen(record_path) + 1;
+    if (bind->record == 0) {
+        xml_bind_free(bind);
         return NULL;
     }
+    bind->depth = record_depth;
+
+    for (i=0; i<count; i++) {
+        bind_field_t* field = &bind->fields[i];
+        memset(field, 0x0, sizeof(bind_field_t));
+        strcpy(names, bindings[i].path);
+        // "a/b/@name" is an attribute of the last element, "@name" of the record itself
+        char* attribute = strrchr(names, '@');
+        if (attribute && (attribute == names || attribute[-1] == '/')) {
+            *attribute = '\0';
+            field->attribute = attribute + 1;
+            field->attribute_size = strlen(attribute + 1);
+        }
+        int depth = record_depth;
+        int state = bind_add_path(bind, bind->record, names, &depth);
+        names += strlen(bindings[i].path) + 1;
+        field->type = bindings[i].type;
+        field->offset = bindings[i].offset;
+        field->size = bindings[i].size;
+        field->next = bind->fields_of[state];
+        bind->fields_of[state] = i;
+        if (depth > bind->depth) {
+            bind->depth = depth;
+        }
+    }
+    bind->field_count = count;
 
-    return child->text;
+    return bind;
 }
 
-int element_get_child_int(xml_element_t element, const char* child_ns, const char* child_name)
+void xml_bind_free(xml_bind_t bind)
 {
-    const char* text = element_get_child_text(element, child_ns, child_name);
-    if (text) {
-        return atoi(text);
-    } else {
-        return -1;
+    if (bind) {
+        free(bind->names);
+        free(bind->edges);
+        free(bind->fields);
+        free(bind->fields_of);
+        free(bind);
     }
+
+    return;
 }
 
-float element_get_child_float(xml_element_t element, const char* child_ns, const char* child_name)
+// length of the element name at name, a tag cut by the end of the input ends it
+static int bind_name_size(const char* name, const char* end)
 {
-    const char* text = element_get_child_text(element, child_ns, child_name);
-    if (text) {
-        return atof(text);
-    } else {
-        return 0.0;
+    const char* p = name;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '/' && *p != '>') {
+        p++;
     }
+
+    return p - name;
 }
 
-const char* element_get_text(xml_element_t element)
+static int bind_extract_utf8(const bind_t* bind, const char* raw, int size, void* records, size_t record_size, int capacity, int* count)
 {
-    if (element == NULL) {
-        return NULL;
+    // states of the open elements that are still on a bound path, deeper ones are only counted
+    int fixed[STACK_SIZE];
+    int* states = fixed;
+    if (bind->depth + 1 > STACK_SIZE) {
+        states = malloc((bind->depth + 1) * sizeof(int));
+        if (states == NULL) {
+            return XML_STATUS_NO_MEMORY;
+        }
+    }
+    unsigned char filled_fixed[STACK_SIZE];
+    unsigned char* filled = filled_fixed;
+    if (bind->field_count > STACK_SIZE) {
+        filled = malloc(bind->field_count);
+        if (filled == NULL) {
+            if (states != fixed) {
+                free(states);
+            }
+            return XML_STATUS_NO_MEMORY;
+        }
     }
 
-    return element->text;
-}
+    // offsets of the names of all open elements, an end tag must name the innermost one
+    int opened_fixed[STACK_SIZE];
+    int* opened = opened_fixed;
+    int opened_capacity = STACK_SIZE;
+
+    int status = XML_STATUS_SUCCEED;
+    int depth = 0;
+    int unbound = 0;
+    states[0] = 0;
+    char* record = NULL;
+    const char* p = raw;
+    const char* end = raw + size;
+    while (p < end && status == XML_STATUS_SUCCEED) {
+        if (*p != '<') {
+            const char* text = p;
+            p = memchr(p, '<', end - p);
+            if (p == NULL) {
+                p = end;
+            }
+            int field = unbound ? -1 : bind->fields_of[states[depth]];
+            for (; record && field >= 0; field = bind->fields[field].next) {
+                if (bind->fields[field].attribute == NULL && !filled[field] && !is_blank_span(text, p - text)) {
+                    bind_store(&bind->fields[field], record, text, p - text);
+                    filled[field] = 1;
+                }
+            }
+            continue;
+        }
 
-int element_get_int(xml_element_t element)
-{
-    const char* text = element_get_text(element);
-    if (text) {
-        return atoi(text);
-    } else {
-        return -1;
+        if (end - p >= 9 && memcmp(p, "<![CDATA[", 9) == 0) {
+            const char* text = p + 9;
+            p = find_span(text, end, "]]>");
+            if (p == NULL) {
+                status = XML_STATUS_SYNTAX;
+                break;
+            }
+            int field = unbound ? -1 : bind->fields_of[states[depth]];
+            for (; record && field >= 0; field = bind->fields[field].next) {
+                if (bind->fields[field].attribute == NULL && !filled[field] && p > text) {
+                    bind_store(&bind->fields[field], record, text, p - text);
+                    filled[field] = 1;
+                }
+            }
+            p += 3;
+        } else if (end - p >= 4 && memcmp(p, "<!--", 4) == 0) {
+            p = find_span(p + 4, end, "-->");
+            if (p == NULL) {
+                status = XML_STATUS_SYNTAX;
+                break;
+            }
+            p += 3;
+        } else if (end - p >= 2 && (p[1] == '?' || p[1] == '!')) {
+            p = memchr(p, '>', end - p);
+            if (p == NULL) {
+                status = XML_STATUS_SYNTAX;
+                break;
+            }
+            p++;
+        } else if (end - p >= 2 && p[1] == '/') {
+            const char* name = p + 2;
+            p = memchr(p, '>', end - p);
+            if (p == NULL) {
+                status = XML_STATUS_SYNTAX;
+                break;
+            }
+            p++;
+            int name_size = bind_name_size(name, end);
+            const char* open = depth + unbound > 0 ? raw + opened[depth + unbound - 1] : NULL;
+            if (open == NULL || memcmp(name, open, name_size) != 0 || bind_name_size(open + name_size, end) != 0) {
+                status = XML_STATUS_SYNTAX;
+                break;
+            }
+            if (unbound > 0) {
+                unbound--;
+            } else {
+                if (states[depth] == bind->record && record) {
+                    record = NULL;
+                    (*count)++;
+                }
+                depth--;
+            }
+        } else {
+            const char* name = ++p;
+            while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '/' && *p != '>') {
+                p++;
+            }
+            int state = unbound ? -1 : bind_step(bind, states[depth], name, p - name);
+            if (state == bind->record) {
+                if (*count == capacity) {
+                    status = XML_STATUS_NO_MEMORY;
+                    break;
+                }
+                record = (char*)records + *count * record_size;
+                memset(record, 0x0, record_size);
+                memset(filled, 0x0, bind->field_count);
+            }
+
+            // attributes, quoted values may hold '>' and '/'
+            while (p < end && *p != '>' && !(*p == '/' && p + 1 < end && p[1] == '>')) {
+                if (isspace((unsigned char)*p)) {
+                    p++;
+                    continue;
+                }
+                const char* attribute = p;
+                while (p < end && *p != '=' && *p != '>' && !isspace((unsigned char)*p)) {
+                    p++;
+                }
+                int attribute_size = p - attribute;
+                while (p < end && *p != '"' && *p != '\'' && *p != '>') {
+                    p++;
+                }
+                if (p == end || *p == '>') {
+                    continue;
+                }
+                const char quote = *p++;
+                const char* value = p;
+                p = memchr(p, quote, end - p);
+                if (p == NULL) {
+                    p = end;
+                    break;
+                }
+                int field = state > 0 && record ? bind->fields_of[state] : -1;
+                for (; field >= 0; field = bind->fields[field].next) {
+                    const bind_field_t* bound = &bind->fields[field];
+                    if (bound->attribute && bound->attribute_size == attribute_size && memcmp(bound->attribute, attribute, attribute_size) == 0) {
+                        bind_store(bound, record, value, p - value);
+                        filled[field] = 1;
+                    }
+                }
+                p++;
+            }
+            if (p >= end) {
+                status = XML_STATUS_SYNTAX;
+                break;
+            }
+            if (*p == '/') {
+                // <name/> closes at once
+                if (state == bind->record) {
+                    record = NULL;
+                    (*count)++;
+                }
+                p += 2;
+                continue;
+            }
+            p++;
+            if (depth + unbound == opened_capacity) {
+                int* grown = malloc(opened_capacity * 2 * sizeof(int));
+                if (grown == NULL) {
+                    status = XML_STATUS_NO_MEMORY;
+                    break;
+                }
+                memcpy(grown, opened, opened_capacity * sizeof(int));
+                if (opened != opened_fixed) {
+                    free(opened);
+                }
+                opened = grown;
+                opened_capacity *= 2;
+            }
+            opened[depth + unbound] = name - raw;
+            if (state < 0) {
+                unbound++;
+            } else {
+                states[++depth] = state;
+            }
+        }
+    }
+    if (status == XML_STATUS_SUCCEED && (depth > 0 || unbound > 0)) {
+        status = XML_STATUS_SYNTAX;
     }
-}
 
-float element_get_float(xml_element_t element)
-{
-    const char* text = element_get_text(element);
-     if (text) {
-        return atof(text);
-    } else {
-        return 0.0;
+    if (states != fixed) {
+        free(states);
+    }
+    if (filled != filled_fixed) {
+        free(filled);
     }
+    if (opened != opened_fixed) {
+        free(opened);
+    }
+
+    return status;
 }
 
-const char* element_get_attribute_text(xml_element_t element, const char* attribute_name)
+// value of encoding="..." in the header of raw, NULL without one
+static const char* bind_declared_encoding(const char* raw, int size, int* length)
 {
-    if (element == NULL || attribute_name == NULL || strlen(attribute_name) == 0) {
+    if (size < 5 || memcmp(raw, "<?xml", 5) != 0) {
         return NULL;
     }
-
-    attribute_t* attribute = get_attribute(element, attribute_name);
-    if (attribute) {
-        return attribute->value;
-    } else {
+    const char* end = find_span(raw + 5, raw + size, "?>");
+    const char* p = end ? find_span(raw + 5, end, "encoding") : NULL;
+    if (p == NULL) {
         return NULL;
     }
-}
-
-int element_get_attribute_int(xml_element_t element, const char* attribute_name)
-{
-    const char* text = element_get_attribute_text(element, attribute_name);
-    if (text) {
-        return atoi(text);
-    } else {
-        return -1;
+    p += 8;
+    while (p < end && (isspace((unsigned char)*p) || *p == '=')) {
+        p++;
     }
-}
-
-float element_get_attribute_float(xml_element_t element, const char* attribute_name)
-{
-    const char* text = element_get_attribute_text(element, attribute_name);
-    if (text) {
-        return atof(text);
-    } else {
-        return 0.0;
+    if (p == end || (*p != '"' && *p != '\'')) {
+        return NULL;
+    }
+    const char* value = p + 1;
+    p = memchr(value, *p, end - value);
+    if (p == NULL) {
+        return NULL;
     }
+    *length = p - value;
+
+    return value;
 }
 
-int xml_add_element(xml_handle_t xml, const char* parent_ns, const char* parent_name, const char* ns, const char* name, XML_VALUE_TYPE type, const void* value)
+int xml_bind_extract(xml_bind_t bind, const char* raw, int size, void* records, size_t record_size, int capacity, int* count)
 {
-    if (xml == NULL || name == NULL || strlen(name) == 0) {
+    if (bind == NULL || raw == NULL || size <= 0 || (records == NULL && capacity > 0) || count == NULL) {
         return XML_STATUS_FAULT;
     }
+    *count = 0;
 
-    element_t* parent = NULL;
-    if (parent_name && strlen(parent_name) > 0) {
-        parent = get_element(xml->element, parent_ns, parent_name);
-        if (parent == NULL) {
-            return XML_STATUS_FAULT;
-        }
+    // fields are filled in UTF-8 like the parser leaves text, GB documents are transcoded first, other encodings are refused
+    int length = 0;
+    const char* declared = bind_declared_encoding(raw, size, &length);
+    if (declared == NULL || (length == 5 && strncasecmp(declared, "UTF-8", 5) == 0) || (length == 4 && strncasecmp(declared, "UTF8", 4) == 0)) {
+        return bind_extract_utf8(bind, raw, size, records, record_size, capacity, count);
     }
-
-    const char* text = NULL;
-    char tmp[64] = {0};
-    if (value) {
-        if (type == XML_VALUE_TYPE_INT) {
-            snprintf(tmp, sizeof(tmp), "%d", *((int*)value));
-            text = tmp;
-        } else if (type == XML_VALUE_TYPE_FLOAT) {
-            snprintf(tmp, sizeof(tmp), "%f", *((float*)value));
-            text = tmp;
-        } else {
-            text = value;
-        }
+    if (!((length == 6 && strncasecmp(declared, "GB2312", 6) == 0) || (length == 3 && strncasecmp(declared, "GBK", 3) == 0)
+        || (length == 7 && strncasecmp(declared, "GB18030", 7) == 0) || (length == 5 && strncasecmp(declared, "CP936", 5) == 0))) {
+        return XML_STATUS_ENCODING;
     }
 
-    if (add_element(xml, parent, ns, name, text) != NULL) {
-        return XML_STATUS_SUCCEED;
-    } else {
-        return XML_STATUS_FAULT;
+    // the decoder keeps its state in a handle, a cut sequence at the end is an error here as there is no next chunk
+    xml_handle_t xml = xml_malloc_handle();
+    char* decoded = malloc((size_t)size * 3 / 2 + 4);
+    if (xml == NULL || decoded == NULL) {
+        xml_free_handle(xml);
+        free(decoded);
+        return XML_STATUS_NO_MEMORY;
+    }
+    int status = XML_STATUS_ENCODING;
+    int decoded_size = gb18030_to_utf8(xml, (const unsigned char*)raw, size, decoded);
+    if (decoded_size >= 0 && xml->pending_size == 0) {
+        status = bind_extract_utf8(bind, decoded, decoded_size, records, record_size, capacity, count);
     }
+    xml_free_handle(xml);
+    free(decoded);
+
+    return status;
 }
 
-int xml_add_attribute(xml_handle_t xml, const char* element_ns, const char* element_name, const char* name, XML_VALUE_TYPE type, const void* value)
+int xml_get_utf8_error(xml_handle_t xml, size_t* offset)
 {
-    if (xml == NULL || element_name == NULL || strlen(element_name) == 0 || name == NULL || strlen(name) == 0 || value == NULL || strlen(value) == 0) {
+    if (xml == NULL) {
         return XML_STATUS_FAULT;
     }
-
-    element_t* element = get_element(xml->element, element_ns, element_name);
-    if (element == NULL) {
-        return XML_STATUS_FAULT;
+    if (xml->input_status != XML_STATUS_ENCODING) {
+        return XML_STATUS_SUCCEED;
     }
 
-    const char* text = NULL;
-    char tmp[64] = {0};
-    if (value) {
-        if (type == XML_VALUE_TYPE_INT) {
-            snprintf(tmp, sizeof(tmp), "%d", *((int*)value));
-            text = tmp;
-        } else if (type == XML_VALUE_TYPE_FLOAT) {
-            snprintf(tmp, sizeof(tmp), "%f", *((float*)value));
-            text = tmp;
-        } else {
-            text = value;
-        }
+    if (offset) {
+        *offset = xml->utf8_error;
     }
 
-    if (add_attribute(xml, element, name, text) != NULL) {
-        return XML_STATUS_SUCCEED;
-    } else {
-        return XML_STATUS_FAULT;
-    }
+    return XML_STATUS_ENCODING;
 }
 
-const char* xml_serialize(xml_handle_t xml)
+int xml_get_memory_usage(xml_handle_t xml, size_t* arena_bytes, size_t* peak_bytes, size_t* allocations)
 {
     if (xml == NULL) {
-        return NULL;
+        return XML_STATUS_FAULT;
     }
 
-    char* ret = xml->buffer + xml->buffer_used;
-    if (xml->header) {
-        serialize_header(xml, xml->header);
-    } else {
-        xml_strdup(xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
+    if (arena_bytes) {
+        *arena_bytes = xml->arena_retired + xml->arena_used;
+    }
+    if (peak_bytes) {
+        *peak_bytes = xml->heap_peak;
+    }
+    if (allocations) {
+        *allocations = xml->heap_allocs;
     }
-    
-    serialize_element(xml, xml->element);
 
-    return ret;
+    return XML_STATUS_SUCCEED;
+}
+
+int xml_get_stats(xml_handle_t xml, xml_stats_t* stats)
+{
+    if (xml == NULL || stats == NULL) {
+        return XML_STATUS_FAULT;
+    }
+
+#ifdef XML_ENABLE_STATS
+    *stats = xml->stats;
+    stats->tokenize_seconds = stats->input_seconds - stats->build_seconds;
+    return XML_STATUS_SUCCEED;
+#else
+    memset(stats, 0x0, sizeof(xml_stats_t));
+    return XML_STATUS_FAULT;
+#endif
 }
 
 void xml_debug_print(xml_handle_t xml)
@@ -997,7 +5773,7 @@ void xml_debug_print(xml_handle_t xml)
     print_header(xml->header);
     print_element(xml->element);
 
-    printf("buffer_used:%d\n", xml->buffer_used);
+    printf("buffer_used:%lu\n", (unsigned long)(xml->arena_retired + xml->arena_used));
 
     return;
 }
\ No newline at end of file
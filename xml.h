@@ -1,6 +1,8 @@
 #ifndef __XML_H__
 #define __XML_H__
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -11,8 +13,19 @@ typedef enum
     XML_STATUS_NO_MEMORY,
     XML_STATUS_SYNTAX,
     XML_STATUS_FAULT,
+    XML_STATUS_ENCODING,    // invalid UTF-8 with XML_OPTION_VALIDATE_UTF8 or invalid GB18030, see xml_get_utf8_error
+    XML_STATUS_LIMIT,       // input went over xml_limits_t, the error names the limit
 } XML_STATUS;
 
+typedef enum
+{
+    XML_OPTION_KEEP_BLANK = 0x01,   // keep whitespace-only text segments and line breaks in text, CDATA always keeps them
+    XML_OPTION_KEEP_SOURCE = 0x02,  // keep the input, xml_serialize copies unchanged subtrees from it
+    XML_OPTION_VALIDATE_UTF8 = 0x04,    // reject invalid UTF-8 unless the header declares another encoding
+    XML_OPTION_KEEP_ENCODING = 0x08,    // serialize GB2312, GBK and GB18030 input in that encoding, not UTF-8
+    XML_OPTION_LAZY = 0x10,     // index the input, build elements when an accessor first reaches them, set before any input
+} XML_OPTION;
+
 typedef enum
 {
     XML_VALUE_TYPE_TEXT,
@@ -20,18 +33,111 @@ typedef enum
     XML_VALUE_TYPE_FLOAT,
 } XML_VALUE_TYPE;
 
+typedef enum
+{
+    XML_SERIALIZE_COMPACT = 0,  // no added whitespace, same as xml_serialize
+    XML_SERIALIZE_INDENT,       // one element per line, two spaces per level, blank text dropped
+    XML_SERIALIZE_CANONICAL,    // no declaration, sorted attributes, normalized text, references decoded and escaped one way
+} XML_SERIALIZE_MODE;
+
+// filled only when the library is built with -DXML_ENABLE_STATS
+typedef struct
+{
+    unsigned long long  bytes_consumed;
+    unsigned long long  nodes;          // elements and text nodes created
+    unsigned long long  attributes;
+    int                 max_depth;
+    int                 arena_blocks;   // blocks added after the embedded buffer
+    double              input_seconds;  // inside xml_input_raw
+    double              tokenize_seconds;
+    double              build_seconds;  // creating nodes, part of input_seconds
+    double              query_seconds;
+    unsigned long long  lookups;        // searches by name, element or child
+    unsigned long long  nodes_visited;  // by all lookups
+    unsigned long       last_lookup_visited;
+} xml_stats_t;
+
+// bounds for untrusted input, 0 is no limit, a new handle has none
+typedef struct
+{
+    size_t  max_document_bytes; // all xml_input_raw calls together
+    int     max_depth;
+    int     max_attributes;     // per element
+    int     max_name_length;    // element and attribute names, prefix included
+    int     max_text_length;    // text segment, CDATA section or attribute value
+    size_t  max_nodes;          // elements and text nodes
+} xml_limits_t;
+
+// why the last xml_input_raw failed
+typedef struct
+{
+    int     status;         // XML_STATUS_*
+    size_t  offset;         // byte offset in the input, after transcoding for GB documents
+    int     line;           // 1 based, 0 if unknown
+    int     column;         // 1 based, in bytes
+    char    expected[64];   // "</name>" for a tag mismatch, empty if nothing specific was expected
+    char    found[64];      // the offending token, truncated
+    char    path[256];      // open elements from the document element, "root/list/item"
+} xml_error_t;
+
+// called once per failure, instead of printing anything
+typedef void (*xml_log_t)(void* context, const xml_error_t* error);
+
+// memory of a handle: arena blocks, stacks, indexes and serializer buffers, the handle itself included
+// realloc gets pointer NULL with old_size 0 for a first allocation, free gets the size that was allocated
+typedef struct
+{
+    void*   (*alloc)(void* context, size_t size);
+    void*   (*realloc)(void* context, void* pointer, size_t old_size, size_t size);
+    void    (*free)(void* context, void* pointer, size_t size);
+    void*   context;
+} xml_allocator_t;
+
 // typedef
 typedef struct gb_xml_t* xml_handle_t;
 typedef struct element_t* xml_element_t;
+typedef struct attribute_t* xml_attribute_t;
+typedef struct bind_t* xml_bind_t;
+
+// one struct field filled by xml_bind_extract
+// path is relative to the record element: "name", "address/city", "@id", "address/@zip", "" for the record text
+typedef struct
+{
+    const char*     path;
+    XML_VALUE_TYPE  type;
+    size_t          offset; // offsetof the field
+    size_t          size;   // char array size for XML_VALUE_TYPE_TEXT, int and float fields ignore it
+} xml_binding_t;
 
 // xml handle
 xml_handle_t xml_malloc_handle();
 
+// allocator NULL is malloc, budget caps the heap bytes of the handle, 0 is no cap
+// an allocation over the budget fails like malloc would, input and serialize give XML_STATUS_NO_MEMORY
+xml_handle_t xml_malloc_handle_ex(const xml_allocator_t* allocator, size_t budget);
+
 void xml_free_handle(xml_handle_t handle);
 
-// input raw data
+// options, set before input
+int xml_set_option(xml_handle_t xml, int option, int enable);
+
+// limits are copied, NULL removes them, set before input
+int xml_set_limits(xml_handle_t xml, const xml_limits_t* limits);
+
+// input raw data, after a failed call every later one is refused with the same status
 int xml_input_raw(xml_handle_t xml, const char* raw, int size);
 
+// read gzip or zlib compressed input from fd to its end, inflating on a second thread while parsing
+// XML_STATUS_FAULT if fd can not be read, the stream is corrupt or cut short, or the library is built without XML_ENABLE_ZLIB
+// a stream failure is reported like a failed input, offset counts compressed bytes and found holds the reason
+int xml_input_gzip(xml_handle_t xml, int fd);
+
+// XML_STATUS_SUCCEED if input has not failed, otherwise the status and the details in error
+int xml_get_error(xml_handle_t xml, xml_error_t* error);
+
+// log may be NULL to stop logging
+int xml_set_log(xml_handle_t xml, xml_log_t log, void* context);
+
 // if element name is unique in xml, use below method to get element's value or attribute
 const char* xml_get_text(xml_handle_t xml, const char* element_ns, const char* element_name);
 
@@ -70,16 +176,134 @@ int element_get_attribute_int(xml_element_t element, const char* attribute_name)
 
 float element_get_attribute_float(xml_element_t element, const char* attribute_name);
 
+// mixed content, text segments are child nodes too: walk all children in document order
+xml_element_t element_get_node(xml_element_t element);
+
+xml_element_t element_get_next_node(xml_element_t node);
+
+int element_is_text(xml_element_t node);
+
+// local name and prefix as written, NULL for a text node, prefix NULL without one
+const char* element_get_name(xml_element_t element);
+
+const char* element_get_prefix(xml_element_t element);
+
+// attributes in document order, names are qualified, xmlns declarations included
+xml_attribute_t element_get_attributes(xml_element_t element);
+
+xml_attribute_t attribute_get_next(xml_attribute_t attribute);
+
+const char* attribute_get_name(xml_attribute_t attribute);
+
+const char* attribute_get_value(xml_attribute_t attribute);
+
+// join all text segments of element into buffer, return the full length like snprintf
+int element_get_text_concat(xml_element_t element, char* buffer, int size);
+
+// namespaces: uris and local names are interned per handle, look the ids up once and compare ints
+// xml_get_ns_id returns 0 for NULL or "", the id of "no namespace", and -1 when the uri never appeared,
+// an element or attribute whose prefix no xmlns declaration binds has ns id -1 and no _ns lookup finds it
+int xml_get_ns_id(xml_handle_t xml, const char* uri);
+
+int xml_get_name_id(xml_handle_t xml, const char* local_name);
+
+const char* xml_get_atom(xml_handle_t xml, int id);
+
+xml_element_t xml_get_element_ns(xml_handle_t xml, int ns_id, int name_id);
+
+xml_element_t element_get_child_ns(xml_element_t element, int ns_id, int name_id);
+
+// child elements by position, text nodes are not counted, the index is built on first use
+// and rebuilt after the children change, so a loop over positions costs one build
+int element_child_count(xml_element_t element);
+
+xml_element_t element_child_at(xml_element_t element, int i);
+
+// next sibling with this name, same ns rules as element_get_child, visits only the siblings of that name
+xml_element_t element_next_named(xml_element_t element, const char* ns, const char* name);
+
+int element_get_ns_id(xml_element_t element);
+
+int element_get_name_id(xml_element_t element);
+
+const char* element_get_attribute_ns(xml_element_t element, int ns_id, int name_id);
+
 // add and serialize
 int xml_add_element(xml_handle_t xml, const char* parent_ns, const char* parent_name, const char* ns, const char* name, XML_VALUE_TYPE type, const void* value);
 
 int xml_add_attribute(xml_handle_t xml, const char* element_ns, const char* element_name, const char* name, XML_VALUE_TYPE type, const void* value);
 
+// mutation on element handles, new nodes are detached until linked into the tree of the same handle
+xml_element_t xml_new_element(xml_handle_t xml, const char* ns, const char* name);
+
+xml_element_t xml_new_text(xml_handle_t xml, const char* text);
+
+// replace all text segments, NULL value clears the text
+// O(1) on an element without text, otherwise the children are walked once to drop the old segments
+int element_set_text(xml_element_t element, XML_VALUE_TYPE type, const void* value);
+
+// add or replace, NULL value removes the attribute
+int element_set_attribute(xml_element_t element, const char* name, XML_VALUE_TYPE type, const void* value);
+
+// unlink and recycle element with its subtree, the handle must not be used afterwards
+int element_remove(xml_element_t element);
+
+// node may be detached or linked elsewhere in the same handle, it is moved
+int element_insert_before(xml_element_t ref, xml_element_t node);
+
+int element_insert_after(xml_element_t ref, xml_element_t node);
+
+int element_append_child(xml_element_t parent, xml_element_t node);
+
+// copy src_element and its subtree, from any handle, into dst as last child of dst_parent,
+// as document element when dst_parent is NULL and dst has none, detached otherwise
+// one arena reservation for the copy, local names are shared with the atom table of dst, prefixes are copied,
+// namespace and name ids keep their meaning in the source and are re-interned in dst,
+// prefixes bound above src_element get xmlns declarations on the copy unless dst_parent binds them the same
+// NULL if src_element is a text node without dst_parent, or the source failed or is still open around it
+xml_element_t xml_clone_subtree(xml_handle_t dst, xml_element_t dst_parent, xml_element_t src_element);
+
+// new handle with the same allocator, budget, options, header and tree, atom ids stay valid, NULL if the source input failed or is not complete
+// the copy is fully built even if the source was parsed with XML_OPTION_LAZY, free with xml_free_handle
+xml_handle_t xml_clone_handle(xml_handle_t src);
+
 const char* xml_serialize(xml_handle_t xml);
 
+// result is owned by the handle and valid until the next serialize, size may be NULL
+const char* xml_serialize_ex(xml_handle_t xml, int mode, int* size);
+
+// write the parsed tree to a binary image, xml_load_snapshot maps it back without parsing
+// the image is only readable by a build with the same struct layout, pointer size and byte order
+int xml_save_snapshot(xml_handle_t xml, const char* path);
+
+// NULL if the file is missing, truncated or from an incompatible build, free with xml_free_handle
+xml_handle_t xml_load_snapshot(const char* path);
+
+// bind: fill an array of structs from the document in one pass, no element is built
+// record_path names the record element from the document element, "feed/item", qualified names as written
+xml_bind_t xml_bind_compile(const char* record_path, const xml_binding_t* bindings, int count);
+
+void xml_bind_free(xml_bind_t bind);
+
+// records are zeroed before they are filled, a field given twice keeps the first, count is set to the records completed
+// XML_STATUS_NO_MEMORY when there are more than capacity records, the first capacity ones are filled,
+// XML_STATUS_SYNTAX for an end tag that does not match, GB2312, GBK and GB18030 input is filled in as UTF-8,
+// XML_STATUS_ENCODING for any other declared encoding
+int xml_bind_extract(xml_bind_t bind, const char* raw, int size, void* records, size_t record_size, int capacity, int* count);
+
 // debug
 void xml_debug_print(xml_handle_t xml);
 
+// XML_STATUS_ENCODING and the input offset of the first invalid sequence after input failed validation,
+// a sequence cut short by the end of the input counts once the document element has closed
+int xml_get_utf8_error(xml_handle_t xml, size_t* offset);
+
+// arena bytes in use, peak bytes taken from the heap and number of heap allocations, any may be NULL
+int xml_get_memory_usage(xml_handle_t xml, size_t* arena_bytes, size_t* peak_bytes, size_t* allocations);
+
+// XML_STATUS_FAULT and zeroed stats when built without XML_ENABLE_STATS
+int xml_get_stats(xml_handle_t xml, xml_stats_t* stats);
+
 #ifdef __cplusplus
 }
 #endif
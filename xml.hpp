@@ -0,0 +1,340 @@
+#ifndef __XML_HPP__
+#define __XML_HPP__
+
+// C++17 layer over xml.h, header only
+// every wrapper holds just the C pointer and every call is inline, so it costs what the C call costs
+// strings are std::string_view into the handle, valid while the document lives and the node is not changed
+
+#include <cctype>
+#include <charconv>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include "xml.h"
+
+namespace xml {
+
+namespace detail {
+
+inline std::string_view view(const char* s)
+{
+    return s ? std::string_view(s) : std::string_view();
+}
+
+} // namespace detail
+
+// text as T, fallback when it is missing or not entirely a T, blanks around numbers are allowed
+template <typename T>
+inline T parse_value(const char* text, T fallback)
+{
+    if constexpr (std::is_same_v<T, std::string_view>) {
+        return text ? std::string_view(text) : fallback;
+    } else if constexpr (std::is_same_v<T, const char*>) {
+        return text ? text : fallback;
+    } else {
+        static_assert(std::is_arithmetic_v<T>, "get<T>: T is a number, bool, std::string_view or const char*");
+        if (text == nullptr) {
+            return fallback;
+        }
+        const char* begin = text;
+        const char* end = text + std::strlen(text);
+        while (begin < end && std::isspace((unsigned char)*begin)) {
+            begin++;
+        }
+        while (end > begin && std::isspace((unsigned char)end[-1])) {
+            end--;
+        }
+        if constexpr (std::is_same_v<T, bool>) {
+            std::string_view s(begin, end - begin);
+            if (s == "true" || s == "1") {
+                return true;
+            }
+            if (s == "false" || s == "0") {
+                return false;
+            }
+            return fallback;
+        } else {
+            if (begin < end && *begin == '+') {
+                begin++;    // from_chars takes no plus sign
+            }
+            T value{};
+            auto [stop, error] = std::from_chars(begin, end, value);
+            return error == std::errc() && stop == end && begin < end ? value : fallback;
+        }
+    }
+}
+
+class attribute
+{
+public:
+    attribute(xml_attribute_t a = nullptr) : a_(a) {}
+
+    explicit operator bool() const { return a_ != nullptr; }
+    xml_attribute_t c_attribute() const { return a_; }
+
+    std::string_view name() const { return detail::view(attribute_get_name(a_)); }
+    std::string_view value() const { return detail::view(attribute_get_value(a_)); }
+
+    template <typename T>
+    T get(T fallback = T()) const { return parse_value<T>(attribute_get_value(a_), fallback); }
+
+    attribute next() const { return attribute_get_next(a_); }
+
+    bool operator==(const attribute& other) const { return a_ == other.a_; }
+    bool operator!=(const attribute& other) const { return a_ != other.a_; }
+
+private:
+    xml_attribute_t a_;
+};
+
+template <typename Iterator>
+class range
+{
+public:
+    range(Iterator begin, Iterator end) : begin_(begin), end_(end) {}
+
+    Iterator begin() const { return begin_; }
+    Iterator end() const { return end_; }
+    bool empty() const { return begin_ == end_; }
+
+private:
+    Iterator begin_;
+    Iterator end_;
+};
+
+// forward iterator stepping a C pointer with a C function, Item wraps the pointer
+template <typename Item, typename Pointer, Pointer (*Next)(Pointer)>
+class step_iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Item;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Item*;
+    using reference = Item;
+
+    step_iterator(Pointer p = nullptr) : p_(p) {}
+
+    Item operator*() const { return Item(p_); }
+    step_iterator& operator++() { p_ = Next(p_); return *this; }
+    step_iterator operator++(int) { step_iterator old = *this; p_ = Next(p_); return old; }
+    bool operator==(const step_iterator& other) const { return p_ == other.p_; }
+    bool operator!=(const step_iterator& other) const { return p_ != other.p_; }
+
+private:
+    Pointer p_;
+};
+
+class element;
+
+namespace detail {
+
+inline xml_element_t first_element(xml_element_t node)
+{
+    while (node && element_is_text(node)) {
+        node = element_get_next_node(node);
+    }
+    return node;
+}
+
+} // namespace detail
+
+using node_iterator = step_iterator<element, xml_element_t, element_get_next_node>;
+using element_iterator = step_iterator<element, xml_element_t, element_get_sibling>;
+using attribute_iterator = step_iterator<attribute, xml_attribute_t, attribute_get_next>;
+
+// children with one name, prefix as written, empty or nullptr matches any
+class named_iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = element;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const element*;
+    using reference = element;
+
+    named_iterator(xml_element_t e = nullptr, const char* prefix = nullptr, const char* name = nullptr) : e_(e), prefix_(prefix), name_(name) {}
+
+    inline element operator*() const;
+    named_iterator& operator++() { e_ = element_next_named(e_, prefix_, name_); return *this; }
+    named_iterator operator++(int) { named_iterator old = *this; ++*this; return old; }
+    bool operator==(const named_iterator& other) const { return e_ == other.e_; }
+    bool operator!=(const named_iterator& other) const { return e_ != other.e_; }
+
+private:
+    xml_element_t e_;
+    const char* prefix_;
+    const char* name_;
+};
+
+// an element or a text node, text nodes have no name and only text
+class element
+{
+public:
+    element(xml_element_t e = nullptr) : e_(e) {}
+
+    explicit operator bool() const { return e_ != nullptr; }
+    xml_element_t c_element() const { return e_; }
+
+    bool is_text() const { return element_is_text(e_) != 0; }
+    std::string_view name() const { return detail::view(element_get_name(e_)); }
+    std::string_view prefix() const { return detail::view(element_get_prefix(e_)); }
+    int ns_id() const { return element_get_ns_id(e_); }
+    int name_id() const { return element_get_name_id(e_); }
+
+    // first text segment, element_get_text
+    std::string_view text() const { return detail::view(element_get_text(e_)); }
+
+    template <typename T>
+    T get(T fallback = T()) const { return parse_value<T>(element_get_text(e_), fallback); }
+
+    std::string_view attribute(const char* name) const { return detail::view(element_get_attribute_text(e_, name)); }
+
+    template <typename T>
+    T attribute(const char* name, T fallback) const { return parse_value<T>(element_get_attribute_text(e_, name), fallback); }
+
+    std::string_view attribute_ns(int ns_id, int name_id) const { return detail::view(element_get_attribute_ns(e_, ns_id, name_id)); }
+
+    element child(const char* name, const char* prefix = nullptr) const { return element_get_child(e_, prefix, name); }
+    element child_ns(int ns_id, int name_id) const { return element_get_child_ns(e_, ns_id, name_id); }
+    element next_sibling() const { return element_get_sibling(e_); }
+
+    // child elements, text nodes skipped
+    range<element_iterator> children() const
+    {
+        return range<element_iterator>(detail::first_element(element_get_node(e_)), element_iterator());
+    }
+
+    range<named_iterator> children(const char* name, const char* prefix = nullptr) const
+    {
+        return range<named_iterator>(named_iterator(element_get_child(e_, prefix, name), prefix, name), named_iterator());
+    }
+
+    // elements and text nodes in document order
+    range<node_iterator> nodes() const
+    {
+        return range<node_iterator>(element_get_node(e_), node_iterator());
+    }
+
+    range<attribute_iterator> attributes() const
+    {
+        return range<attribute_iterator>(element_get_attributes(e_), attribute_iterator());
+    }
+
+    bool operator==(const element& other) const { return e_ == other.e_; }
+    bool operator!=(const element& other) const { return e_ != other.e_; }
+
+private:
+    xml_element_t e_;
+};
+
+inline element named_iterator::operator*() const
+{
+    return element(e_);
+}
+
+// owns an xml_handle_t, move only
+class document
+{
+public:
+    document() : x_(xml_malloc_handle()) {}
+    explicit document(int options) : x_(xml_malloc_handle()) { xml_set_option(x_, options, 1); }
+    document(const xml_allocator_t& allocator, size_t budget = 0, int options = 0) : x_(xml_malloc_handle_ex(&allocator, budget))
+    {
+        xml_set_option(x_, options, 1);
+    }
+    // takes ownership, xml_load_snapshot for one
+    explicit document(xml_handle_t x) : x_(x) {}
+
+    ~document() { xml_free_handle(x_); }
+
+    document(const document&) = delete;
+    document& operator=(const document&) = delete;
+
+    document(document&& other) noexcept : x_(std::exchange(other.x_, nullptr)) {}
+    document& operator=(document&& other) noexcept
+    {
+        if (this != &other) {
+            xml_free_handle(x_);
+            x_ = std::exchange(other.x_, nullptr);
+        }
+        return *this;
+    }
+
+    // deep copy, xml_clone_handle, empty if it could not be allocated
+    document clone() const { return document(xml_clone_handle(x_)); }
+
+    // false if the handle could not be allocated
+    explicit operator bool() const { return x_ != nullptr; }
+    xml_handle_t c_handle() const { return x_; }
+    xml_handle_t release() { return std::exchange(x_, nullptr); }
+
+    // status gets what input returned, after a failure the document holds what was read before it,
+    // data that stops inside the document element is not a failure, input can go on with the rest
+    static document parse(std::string_view data, int options = 0, int* status = nullptr)
+    {
+        document d(options);
+        int result = d.input(data);
+        if (status) {
+            *status = result;
+        }
+        return d;
+    }
+
+    int set_option(int option, bool enable = true) { return xml_set_option(x_, option, enable); }
+    int set_limits(const xml_limits_t& limits) { return xml_set_limits(x_, &limits); }
+
+    // may be called per chunk, XML_STATUS_*
+    int input(std::string_view data)
+    {
+        int status = XML_STATUS_SUCCEED;
+        while (data.size() > 0 && status == XML_STATUS_SUCCEED) {
+            int size = data.size() < (size_t)INT_MAX ? (int)data.size() : INT_MAX;
+            status = xml_input_raw(x_, data.data(), size);
+            data.remove_prefix(size);
+        }
+        return status;
+    }
+
+    xml_error_t error() const
+    {
+        xml_error_t e{};
+        xml_get_error(x_, &e);
+        return e;
+    }
+
+    element root() const { return xml_get_element(x_); }
+
+    // first element with the name anywhere in the document, xml_get_text
+    std::string_view text(const char* name, const char* prefix = nullptr) const { return detail::view(xml_get_text(x_, prefix, name)); }
+
+    template <typename T>
+    T get(const char* name, T fallback = T(), const char* prefix = nullptr) const
+    {
+        return parse_value<T>(xml_get_text(x_, prefix, name), fallback);
+    }
+
+    int ns_id(const char* uri) const { return xml_get_ns_id(x_, uri); }
+    int name_id(const char* local_name) const { return xml_get_name_id(x_, local_name); }
+    element find_ns(int ns_id, int name_id) const { return xml_get_element_ns(x_, ns_id, name_id); }
+
+    // valid until the next serialize, empty on failure
+    std::string_view serialize(int mode = XML_SERIALIZE_COMPACT) const
+    {
+        int size = 0;
+        const char* s = xml_serialize_ex(x_, mode, &size);
+        return s ? std::string_view(s, size) : std::string_view();
+    }
+
+private:
+    xml_handle_t x_;
+};
+
+} // namespace xml
+
+#endif